@@ -172,6 +172,9 @@ display_version (void) {
 #ifdef HAVE_LIBSSL
   fprintf (stdout, "  --with-openssl\n");
 #endif
+#ifdef HAVE_LIBZ
+  fprintf (stdout, "  --with-zlib\n");
+#endif
 }
 
 /* Get the enumerated value given a string.
@@ -162,6 +162,12 @@ typedef struct GMetrics {
     uint64_t nts;
   } maxts;
 
+  /* percentiles of the time served, see --latency-percentiles */
+  union {
+    char *sts;
+    uint64_t nts;
+  } p50ts, p95ts, p99ts;
+
   GSLList *keys;
 } GMetrics;
 
@@ -194,6 +200,20 @@ typedef struct GHolder_ {
   int holder_size;              /* number of allocated items */
   uint32_t ht_size;             /* size of the hash table/store */
   int sub_items_size;           /* number of sub items  */
+
+  /* largest metrics across items and sub items, set once loaded, so
+   * columns can be sized without going over them again */
+  uint32_t max_hits;
+  uint32_t max_visitors;
+  int max_bw_len;               /* of the bandwidth, human readable */
+  int max_method_len;
+  int max_data_len;
+  int max_sub_data_len;
+
+  /* id of each row, items followed by their sub items, in the find
+   * index, set on the first search */
+  uint32_t *find_ids;
+  int find_rows;
 } GHolder;
 
 /* Enum-to-string */
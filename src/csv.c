@@ -143,6 +143,11 @@ print_csv_metric_block (FILE * fp, GMetrics * nmetrics) {
     fprintf (fp, "\"%lld\",", (long long) nmetrics->cumts.nts);
     fprintf (fp, "\"%lld\",", (long long) nmetrics->maxts.nts);
   }
+  if (conf.serve_usecs && conf.latency_percentiles) {
+    fprintf (fp, "\"%lld\",", (long long) nmetrics->p50ts.nts);
+    fprintf (fp, "\"%lld\",", (long long) nmetrics->p95ts.nts);
+    fprintf (fp, "\"%lld\",", (long long) nmetrics->p99ts.nts);
+  }
 
   /* request method */
   if (conf.append_method && nmetrics->method)
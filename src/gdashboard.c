@@ -46,17 +46,42 @@
 #include "color.h"
 #include "error.h"
 #include "gstorage.h"
+#include "gtrigram.h"
 #include "util.h"
 #include "xmalloc.h"
 
+/* chars to use for child nodes based on encoding used */
+#ifdef HAVE_LIBNCURSESW
+#define CHILD_BEND "\xe2\x94\x9c"
+#define CHILD_HORZ "\xe2\x94\x80"
+#else
+#define CHILD_BEND "|"
+#define CHILD_HORZ "`-"
+#endif
+
 static GFind find_t;
 
+/* Trigram index of the rows of each panel, kept across holder reloads,
+ * and the rows that may match the current pattern, see get_find_cands() */
+static GTrigram *find_idx[TOTAL_MODULES];
+static uint8_t *find_cands[TOTAL_MODULES];
+static uint32_t find_cands_size[TOTAL_MODULES];
+static int find_cands_set[TOTAL_MODULES];
+
 /* Reset find indices */
 void
 reset_find (void) {
+  GModule module;
+
   if (find_t.pattern != NULL && *find_t.pattern != '\0')
     free (find_t.pattern);
 
+  for (module = 0; module < TOTAL_MODULES; module++) {
+    free (find_cands[module]);
+    find_cands[module] = NULL;
+    find_cands_set[module] = 0;
+  }
+
   find_t.look_in_sub = 0;
   find_t.module = 0;
   find_t.next_idx = 0;  /* next total index    */
@@ -106,6 +131,12 @@ free_dashboard_data (GDashData item) {
     free (item.metrics->cumts.sts);
   if (conf.serve_usecs && item.metrics->maxts.sts)
     free (item.metrics->maxts.sts);
+  if (conf.latency_percentiles && item.metrics->p50ts.sts)
+    free (item.metrics->p50ts.sts);
+  if (conf.latency_percentiles && item.metrics->p95ts.sts)
+    free (item.metrics->p95ts.sts);
+  if (conf.latency_percentiles && item.metrics->p99ts.sts)
+    free (item.metrics->p99ts.sts);
   free (item.metrics);
 }
 
@@ -123,6 +154,7 @@ free_dashboard (GDash * dash) {
       free_dashboard_data (dash->module[module].data[j]);
     }
     free (dash->module[module].data);
+    free (dash->module[module].rows);
   }
   free (dash);
 }
@@ -230,25 +262,23 @@ render_child_node (const char *data) {
   char *buf;
   int len = 0;
 
-  /* chars to use based on encoding used */
-#ifdef HAVE_LIBNCURSESW
-  const char *bend = "\xe2\x94\x9c";
-  const char *horz = "\xe2\x94\x80";
-#else
-  const char *bend = "|";
-  const char *horz = "`-";
-#endif
-
   if (data == NULL || *data == '\0')
     return NULL;
 
-  len = snprintf (NULL, 0, " %s%s %s", bend, horz, data);
+  len = snprintf (NULL, 0, " %s%s %s", CHILD_BEND, CHILD_HORZ, data);
   buf = xmalloc (len + 3);
-  sprintf (buf, " %s%s %s", bend, horz, data);
+  sprintf (buf, " %s%s %s", CHILD_BEND, CHILD_HORZ, data);
 
   return buf;
 }
 
+/* Get the length of a child node rendered from data of the given
+ * length. */
+static int
+child_node_len (int len) {
+  return snprintf (NULL, 0, " %s%s ", CHILD_BEND, CHILD_HORZ) + len;
+}
+
 /* Get a string of bars given current hits, maximum hit & xpos.
  *
  * On success, the newly allocated string representing the chart is
@@ -724,6 +754,32 @@ out:
   *x += DASH_SRV_TM_LEN + DASH_SPACE;
 }
 
+/* Render a percentile of the time served for each panel, colored as
+ * the maximum time served */
+static void
+render_pts (GDashModule * data, GDashRender render, int *x, const char *pts) {
+  GColors *color = get_color_by_item_module (COLOR_MTRC_MAXTS, data->module);
+  WINDOW *win = render.win;
+
+  int y = render.y, w = render.w, idx = render.idx, sel = render.sel;
+
+  if (data->module == HOSTS && data->data[idx].is_subitem)
+    goto out;
+
+  if (sel) {
+    /* selected state */
+    draw_header (win, pts, "%9s", y, *x, w, color_selected);
+  } else {
+    /* regular state */
+    wattron (win, color->attr | COLOR_PAIR (color->pair->idx));
+    mvwprintw (win, y, *x, "%9s", pts);
+    wattroff (win, color->attr | COLOR_PAIR (color->pair->idx));
+  }
+
+out:
+  *x += DASH_SRV_TM_LEN + DASH_SPACE;
+}
+
 /* Render the bandwidth metric for each panel */
 static void
 render_bw (GDashModule * data, GDashRender render, int *x) {
@@ -941,6 +997,11 @@ render_metrics (GDashModule * data, GDashRender render, int expanded) {
     render_cumts (data, render, &x);
   if (output->maxts && conf.serve_usecs)
     render_maxts (data, render, &x);
+  if (output->maxts && conf.serve_usecs && conf.latency_percentiles) {
+    render_pts (data, render, &x, data->data[render.idx].metrics->p50ts.sts);
+    render_pts (data, render, &x, data->data[render.idx].metrics->p95ts.sts);
+    render_pts (data, render, &x, data->data[render.idx].metrics->p99ts.sts);
+  }
 
   /* render request method if available */
   if (output->method && conf.append_method)
@@ -973,6 +1034,7 @@ render_data_line (WINDOW * win, GDashModule * data, int *y, int j,
 
   if (j >= data->idx_data)
     goto out;
+  get_dash_data (data, j);
 
   sel = expanded && j == gscroll->module[module].scroll ? 1 : 0;
 
@@ -1060,6 +1122,12 @@ render_cols (WINDOW * win, GDashModule * data, int *y) {
   if (output->maxts && conf.serve_usecs)
     rprint_col (win, *y, &x, DASH_SRV_TM_LEN, "%*s", MTRC_MAXTS_LBL);
 
+  if (output->maxts && conf.serve_usecs && conf.latency_percentiles) {
+    rprint_col (win, *y, &x, DASH_SRV_TM_LEN, "%*s", MTRC_P50TS_LBL);
+    rprint_col (win, *y, &x, DASH_SRV_TM_LEN, "%*s", MTRC_P95TS_LBL);
+    rprint_col (win, *y, &x, DASH_SRV_TM_LEN, "%*s", MTRC_P99TS_LBL);
+  }
+
   if (output->method && conf.append_method)
     lprint_col (win, *y, &x, data->meta.method_len, "%s",
                 MTRC_METHODS_SHORT_LBL);
@@ -1202,12 +1270,90 @@ perform_find_dash_scroll (GScroll * gscroll, GModule module) {
   find_t.module = module;
 }
 
-/* Find the searched item within the given sub list.
+/* Free the find index of every panel. */
+void
+free_find (void) {
+  GModule module;
+
+  reset_find ();
+  for (module = 0; module < TOTAL_MODULES; module++) {
+    trgm_free (find_idx[module]);
+    find_idx[module] = NULL;
+  }
+}
+
+/* Set the id of each row of the given holder in the find index of its
+ * panel, adding the rows not indexed yet. */
+static void
+set_find_ids (GHolder * h, GModule module) {
+  GSubItem *iter;
+  int i, n = 0;
+
+  if (find_idx[module] == NULL)
+    find_idx[module] = trgm_new ();
+
+  for (i = 0; i < h->idx; i++) {
+    n++;
+    if (h->items[i].sub_list)
+      n += h->items[i].sub_list->size;
+  }
+
+  h->find_ids = xcalloc (n ? n : 1, sizeof (uint32_t));
+  h->find_rows = n;
+
+  for (i = 0, n = 0; i < h->idx; i++) {
+    h->find_ids[n++] = trgm_add (find_idx[module], h->items[i].metrics->data);
+    if (h->items[i].sub_list == NULL)
+      continue;
+    iter = h->items[i].sub_list->head;
+    for (; iter && n < h->find_rows; iter = iter->next)
+      h->find_ids[n++] = trgm_add (find_idx[module], iter->metrics->data);
+  }
+}
+
+/* Get the rows of the given panel that may match the current pattern,
+ * narrowed down through its trigram index.
+ *
+ * If every row is to be matched, NULL is returned.
+ * Otherwise, the candidates' bit set is returned. */
+static uint8_t *
+get_find_cands (GHolder * h, GModule module) {
+  if (h->find_ids == NULL)
+    set_find_ids (h, module);
+
+  if (!find_cands_set[module]) {
+    find_cands[module] =
+      trgm_match (find_idx[module], find_t.pattern, &find_cands_size[module]);
+    find_cands_set[module] = 1;
+  }
+
+  return find_cands[module];
+}
+
+/* Determine if the given row of a panel may match the current pattern,
+ * i.e., it's a candidate or it was indexed after the candidates were
+ * set.
+ *
+ * If it may match, 1 is returned, otherwise 0. */
+static int
+is_find_cand (GHolder * h, const uint8_t * cands, GModule module, int row) {
+  uint32_t id;
+
+  if (cands == NULL || row < 0 || row >= h->find_rows)
+    return 1;
+
+  id = h->find_ids[row];
+  return id >= find_cands_size[module] || TRGM_HAS (cands, id);
+}
+
+/* Find the searched item within the given sub list. The row of the
+ * sub item past the current one is that of next_idx, plus one.
  *
  * If not found, the GFind structure is reset and 1 is returned.
  * If found, a GFind structure is set and 0 is returned. */
 static int
-find_next_sub_item (GSubList * sub_list, regex_t * regex) {
+find_next_sub_item (GHolder * h, GModule module, GSubList * sub_list,
+                    regex_t * regex, const uint8_t * cands) {
   GSubItem *iter;
   int i = 0, rc;
 
@@ -1216,7 +1362,9 @@ find_next_sub_item (GSubList * sub_list, regex_t * regex) {
 
   for (iter = sub_list->head; iter; iter = iter->next) {
     if (i >= find_t.next_sub_idx) {
-      rc = regexec (regex, iter->metrics->data, 0, NULL, 0);
+      rc = REG_NOMATCH;
+      if (is_find_cand (h, cands, module, find_t.next_idx + 1))
+        rc = regexec (regex, iter->metrics->data, 0, NULL, 0);
       if (rc == 0) {
         find_t.next_idx++;
         find_t.next_sub_idx = (1 + i);
@@ -1234,7 +1382,9 @@ out:
   return 1;
 }
 
-/* Perform a forward search across all modules.
+/* Perform a forward search across all modules. Rows are first narrowed
+ * down through the trigram index of each panel, and only the candidates
+ * are matched against the pattern.
  *
  * On error or if not found, 1 is returned.
  * On success or if found, a GFind structure is set and 0 is returned. */
@@ -1243,6 +1393,7 @@ perform_next_find (GHolder * h, GScroll * gscroll) {
   GModule module;
   GSubList *sub_list;
   regex_t regex;
+  uint8_t *cands;
   char buf[REGEX_ERROR], *data;
   int y, x, j, n, rc;
   size_t idx = 0;
@@ -1262,10 +1413,15 @@ perform_next_find (GHolder * h, GScroll * gscroll) {
     module = module_list[idx];
 
     n = h[module].idx;
+    cands = get_find_cands (&h[module], module);
     for (j = find_t.next_parent_idx; j < n; j++, find_t.next_idx++) {
       data = h[module].items[j].metrics->data;
 
-      rc = regexec (&regex, data, 0, NULL, 0);
+      /* the item's row, next_idx is past the sub items seen */
+      rc = REG_NOMATCH;
+      if (is_find_cand (&h[module], cands, module,
+                        find_t.next_idx - find_t.next_sub_idx))
+        rc = regexec (&regex, data, 0, NULL, 0);
       /* error matching against the precompiled pattern buffer */
       if (rc != 0 && rc != REG_NOMATCH) {
         regerror (rc, &regex, buf, sizeof (buf));
@@ -1283,7 +1439,8 @@ perform_next_find (GHolder * h, GScroll * gscroll) {
       /* look at sub list nodes */
       else {
         sub_list = h[module].items[j].sub_list;
-        if (find_next_sub_item (sub_list, &regex) == 0) {
+        if (find_next_sub_item (&h[module], module, sub_list, &regex, cands) ==
+            0) {
           perform_find_dash_scroll (gscroll, module);
           goto out;
         }
@@ -1347,21 +1504,12 @@ render_find_dialog (WINDOW * main_win, GScroll * gscroll) {
   return valid;
 }
 
+/* Format the given holder metrics into a dashboard row. */
 static void
-set_dash_metrics (GDash ** dash, GMetrics * metrics, GModule module,
-                  GPercTotals totals, int is_subitem) {
-  GDashData *idata = NULL;
-  GDashMeta *meta = NULL;
+set_dash_data (GDashData * idata, GMetrics * metrics, GPercTotals totals,
+               int is_subitem) {
   GSLList *node = NULL;
   char *data = NULL;
-  int *idx;
-
-  if (!metrics->data)
-    return;
-
-  idx = &(*dash)->module[module].idx_data;
-  idata = &(*dash)->module[module].data[(*idx)];
-  meta = &(*dash)->module[module].meta;
 
   idata->metrics = new_gmetrics ();
   idata->is_subitem = is_subitem;
@@ -1393,17 +1541,124 @@ set_dash_metrics (GDash ** dash, GMetrics * metrics, GModule module,
   idata->metrics->avgts.sts = usecs_to_str (metrics->avgts.nts);
   idata->metrics->cumts.sts = usecs_to_str (metrics->cumts.nts);
   idata->metrics->maxts.sts = usecs_to_str (metrics->maxts.nts);
+  if (conf.latency_percentiles) {
+    idata->metrics->p50ts.sts = usecs_to_str (metrics->p50ts.nts);
+    idata->metrics->p95ts.sts = usecs_to_str (metrics->p95ts.nts);
+    idata->metrics->p99ts.sts = usecs_to_str (metrics->p99ts.nts);
+  }
 
 out:
   if (is_subitem)
     free (data);
+}
+
+static void
+set_dash_metrics (GDash ** dash, GMetrics * metrics, GModule module,
+                  GPercTotals totals, int is_subitem) {
+  GDashData *idata = NULL;
+  GDashMeta *meta = NULL;
+  int *idx;
+
+  if (!metrics->data)
+    return;
+
+  idx = &(*dash)->module[module].idx_data;
+  idata = &(*dash)->module[module].data[(*idx)];
+  meta = &(*dash)->module[module].meta;
 
+  set_dash_data (idata, metrics, totals, is_subitem);
   set_metrics_len (meta, idata);
   set_max_metrics (meta, idata);
 
   (*idx)++;
 }
 
+/* Get the given row of a panel. Rows of an expanded panel are formatted
+ * from the holder the first time they come into view, so only those
+ * scrolled through are.
+ *
+ * On success, the dashboard row is returned. */
+GDashData *
+get_dash_data (GDashModule * data, int idx) {
+  GDashData *idata = &data->data[idx];
+
+  if (idata->metrics == NULL && data->rows != NULL)
+    set_dash_data (idata, data->rows[idx].metrics, data->totals,
+                   data->rows[idx].is_subitem);
+
+  return idata;
+}
+
+/* Get the column length of a metric given the length of its largest
+ * value, at least that of the column name. */
+static int
+get_col_len (int vlen, const char *lbl) {
+  int llen = strlen (lbl);
+
+  return vlen > llen ? vlen : llen;
+}
+
+/* Set the column lengths of an expanded panel from the largest metrics
+ * of its holder, i.e., as set_metrics_len() would across all rows. */
+static void
+set_meta_from_holder (GDashMeta * meta, GHolder * h, GPercTotals totals) {
+  int len = 0;
+
+  meta->max_hits = h->max_hits;
+  meta->max_visitors = h->max_visitors;
+
+  meta->hits_len = get_col_len (intlen (h->max_hits), MTRC_HITS_LBL);
+  meta->hits_perc_len =
+    get_col_len (intlen (get_percentage (totals.hits, h->max_hits)),
+                 MTRC_HITS_PERC_LBL);
+  meta->visitors_len =
+    get_col_len (intlen (h->max_visitors), MTRC_VISITORS_SHORT_LBL);
+  meta->visitors_perc_len =
+    get_col_len (intlen (get_percentage (totals.visitors, h->max_visitors)),
+                 MTRC_VISITORS_PERC_LBL);
+  meta->bw_len = get_col_len (h->max_bw_len, MTRC_BW_LBL);
+
+  if (conf.append_method && h->max_method_len)
+    meta->method_len = get_col_len (h->max_method_len, MTRC_METHODS_SHORT_LBL);
+
+  len = h->max_data_len;
+  if (h->max_sub_data_len && child_node_len (h->max_sub_data_len) > len)
+    len = child_node_len (h->max_sub_data_len);
+  meta->data_len = get_col_len (len, MTRC_DATA_LBL);
+}
+
+/* Load the rows of an expanded panel without formatting them, see
+ * get_dash_data(). */
+static void
+load_rows_to_dash (GHolder * h, GDashModule * data, GPercTotals totals) {
+  GSubItem *iter;
+  int i, n = 0;
+
+  data->rows = xcalloc (data->alloc_data, sizeof (GDashRow));
+  data->totals = totals;
+
+  for (i = 0; i < h->idx && n < data->alloc_data; i++) {
+    if (h->items[i].metrics->data == NULL)
+      continue;
+
+    data->rows[n].metrics = h->items[i].metrics;
+    data->rows[n++].is_subitem = 0;
+    if (h->items[i].sub_list == NULL)
+      continue;
+
+    iter = h->items[i].sub_list->head;
+    for (; iter && n < data->alloc_data; iter = iter->next) {
+      if (iter->metrics->data == NULL)
+        continue;
+      data->rows[n].metrics = iter->metrics;
+      data->rows[n++].is_subitem = 1;
+    }
+  }
+  data->idx_data = n;
+
+  set_meta_from_holder (&data->meta, h, totals);
+}
+
 /* Add an item from a sub list to the dashboard.
  *
  * If no items on the sub list, the function returns.
@@ -1449,6 +1704,11 @@ load_data_to_dash (GHolder * h, GDash * dash, GModule module, GScroll * gscroll)
 
   set_module_totals (&totals);
 
+  if (gscroll->expanded && module == gscroll->current) {
+    load_rows_to_dash (h, &dash->module[module], totals);
+    return;
+  }
+
   for (i = 0, j = 0; i < alloc_size; i++) {
     if (h->items[j].metrics->data == NULL)
       continue;
@@ -74,6 +74,13 @@ typedef struct GDashData_
   short is_subitem;
 } GDashData;
 
+/* Dashboard panel row of an expanded panel, formatted once in view */
+typedef struct GDashRow_
+{
+  GMetrics *metrics;     /* holder metrics */
+  short is_subitem;
+} GDashRow;
+
 /* Dashboard panel meta data */
 typedef struct GDashMeta_
 {
@@ -99,6 +106,8 @@ typedef struct GDashMeta_
 typedef struct GDashModule_
 {
   GDashData *data;       /* data metrics */
+  GDashRow *rows;        /* holder rows if expanded, see get_dash_data() */
+  GPercTotals totals;    /* totals the rows are formatted against */
   GModule module;        /* module */
   GDashMeta meta;        /* meta data */
 
@@ -123,6 +132,7 @@ typedef struct GDash_
 } GDash;
 
 /* Function Prototypes */
+GDashData *get_dash_data (GDashModule * data, int idx);
 GDashData *new_gdata (uint32_t size);
 GDash *new_gdash (void);
 int get_num_collapsed_data_rows(void);
@@ -134,6 +144,7 @@ uint32_t get_ht_size_by_module (GModule module);
 void display_content (WINDOW * win, GDash * dash, GScroll * scroll);
 void free_dashboard (GDash * dash);
 void load_data_to_dash (GHolder * h, GDash * dash, GModule module, GScroll * scroll);
+void free_find (void);
 void reset_find (void);
 void reset_scroll_offsets (GScroll * scroll);
 
@@ -62,11 +62,25 @@
 
 #include "error.h"
 #include "goaccess.h"
+#include "khash.h"
+#include "settings.h"
 #include "util.h"
 #include "xmalloc.h"
 
+/* IPs queued or being resolved map to 0, IPs whose lookup timed out
+ * map to the time they may be retried at */
+KHASH_MAP_INIT_STR (dnsq, time_t);
+
 GDnsThread gdns_thread;
 static GDnsQueue *gdns_queue;
+static khash_t (dnsq) * gdns_pending = NULL;
+static int gdns_inflight = 0;   /* queued or being resolved */
+
+/* Get the number of seconds a timed out IP is not retried for. */
+static time_t
+negative_ttl (void) {
+  return conf.dns_negative_ttl ? conf.dns_negative_ttl : DNS_NEGATIVE_TTL;
+}
 
 /* Initialize the queue. */
 void
@@ -107,7 +121,8 @@ gqueue_destroy (GDnsQueue * q) {
   free (q);
 }
 
-/* Add at the end of the queue a string item.
+/* Add at the end of the queue a string item. The queue doesn't take
+ * ownership of it.
  *
  * If the queue is full, -1 is returned.
  * If added to the queue, 0 is returned. */
@@ -117,28 +132,11 @@ gqueue_enqueue (GDnsQueue * q, char *item) {
     return -1;
 
   q->tail = (q->tail + 1) % q->capacity;
-  strcpy (q->buffer[q->tail], item);
+  q->buffer[q->tail] = item;
   q->size++;
   return 0;
 }
 
-/* Find a string item in the queue.
- *
- * If the queue is empty, or the item is not in the queue, 0 is returned.
- * If found, 1 is returned. */
-int
-gqueue_find (GDnsQueue * q, const char *item) {
-  int i;
-  if (gqueue_empty (q))
-    return 0;
-
-  for (i = 0; i < q->size; i++) {
-    if (strcmp (item, q->buffer[i]) == 0)
-      return 1;
-  }
-  return 0;
-}
-
 /* Remove a string item from the head of the queue.
  *
  * If the queue is empty, NULL is returned.
@@ -155,28 +153,30 @@ gqueue_dequeue (GDnsQueue * q) {
   return item;
 }
 
-/* Get the corresponding hostname given an IP address.
+/* Get the corresponding hostname given an IP address. The status
+ * returned by getnameinfo(3) is set into st.
  *
  * On error, a string error message is returned.
  * On success, a malloc'd hostname is returned. */
 static char *
-reverse_host (const struct sockaddr *a, socklen_t length) {
+reverse_host (const struct sockaddr *a, socklen_t length, int *st) {
   char h[H_SIZE];
-  int flags, st;
+  int flags;
 
   flags = NI_NAMEREQD;
-  st = getnameinfo (a, length, h, H_SIZE, NULL, 0, flags);
-  if (!st)
+  *st = getnameinfo (a, length, h, H_SIZE, NULL, 0, flags);
+  if (!*st)
     return alloc_string (h);
-  return alloc_string (gai_strerror (st));
+  return alloc_string (gai_strerror (*st));
 }
 
-/* Determine if IPv4 or IPv6 and resolve.
+/* Determine if IPv4 or IPv6 and resolve, setting the status of the
+ * lookup into st.
  *
  * On error, NULL is returned.
  * On success, a malloc'd hostname is returned. */
-char *
-reverse_ip (char *str) {
+static char *
+resolve_ip (const char *str, int *st) {
   union {
     struct sockaddr addr;
     struct sockaddr_in6 addr6;
@@ -189,32 +189,93 @@ reverse_ip (char *str) {
   memset (&a, 0, sizeof (a));
   if (1 == inet_pton (AF_INET, str, &a.addr4.sin_addr)) {
     a.addr4.sin_family = AF_INET;
-    return reverse_host (&a.addr, sizeof (a.addr4));
+    return reverse_host (&a.addr, sizeof (a.addr4), st);
   } else if (1 == inet_pton (AF_INET6, str, &a.addr6.sin6_addr)) {
     a.addr6.sin6_family = AF_INET6;
-    return reverse_host (&a.addr, sizeof (a.addr6));
+    return reverse_host (&a.addr, sizeof (a.addr6), st);
   }
   return NULL;
 }
 
-/* Producer - Resolve an IP address and add it to the queue. */
+/* Determine if IPv4 or IPv6 and resolve.
+ *
+ * On error, NULL is returned.
+ * On success, a malloc'd hostname is returned. */
+char *
+reverse_ip (char *str) {
+  int st = 0;
+  return resolve_ip (str, &st);
+}
+
+/* Queue the given IP address unless it's already queued, being
+ * resolved, or failed too recently to retry. The caller must hold the
+ * DNS mutex.
+ *
+ * If the queue is full, -1 is returned.
+ * On success, or if there's nothing to do, 0 is returned. */
+static int
+enqueue_ip (const char *addr) {
+  khint_t k;
+  int ret;
+
+  k = kh_get (dnsq, gdns_pending, addr);
+  if (k != kh_end (gdns_pending)) {
+    /* pending, or negatively cached */
+    if (kh_val (gdns_pending, k) == 0 || kh_val (gdns_pending, k) > time (NULL))
+      return 0;
+  } else {
+    if (gqueue_full (gdns_queue))
+      return -1;
+    k = kh_put (dnsq, gdns_pending, xstrdup (addr), &ret);
+  }
+
+  if (gqueue_enqueue (gdns_queue, (char *) kh_key (gdns_pending, k)) == -1)
+    return -1;
+
+  kh_val (gdns_pending, k) = 0;
+  gdns_inflight++;
+  pthread_cond_signal (&gdns_thread.not_empty);
+
+  return 0;
+}
+
+/* Producer - Resolve an IP address and add it to the queue. If the
+ * queue is full the IP address is dropped, to be asked for again. */
 void
 dns_resolver (char *addr) {
   pthread_mutex_lock (&gdns_thread.mutex);
-  /* queue is not full and the IP address is not in the queue */
-  if (!gqueue_full (gdns_queue) && !gqueue_find (gdns_queue, addr)) {
-    /* add the IP to the queue */
-    gqueue_enqueue (gdns_queue, addr);
-    pthread_cond_broadcast (&gdns_thread.not_empty);
-  }
+  enqueue_ip (addr);
+  pthread_mutex_unlock (&gdns_thread.mutex);
+}
+
+/* Producer - Resolve an IP address ahead, waiting for room in the queue
+ * if full. Used along with gdns_wait() to resolve a batch of IPs. */
+void
+dns_prefetch (char *addr) {
+  pthread_mutex_lock (&gdns_thread.mutex);
+  while (enqueue_ip (addr) == -1 && gdns_thread.workers && active_gdns)
+    pthread_cond_wait (&gdns_thread.not_full, &gdns_thread.mutex);
+  pthread_mutex_unlock (&gdns_thread.mutex);
+}
+
+/* Block until every IP address queued so far has been resolved, or
+ * has failed. */
+void
+gdns_wait (void) {
+  pthread_mutex_lock (&gdns_thread.mutex);
+  while (gdns_inflight > 0 && gdns_thread.workers && active_gdns)
+    pthread_cond_wait (&gdns_thread.not_full, &gdns_thread.mutex);
   pthread_mutex_unlock (&gdns_thread.mutex);
 }
 
-/* Consumer - Once an IP has been resolved, add it to dwithe hostnames
- * hash structure. */
+/* Consumer - Once an IP has been resolved, add it to the hostnames
+ * hash structure. Timeouts and other temporary failures are not, but
+ * are kept in the pending set and retried after a while instead. */
 static void
 dns_worker (void GO_UNUSED (*ptr_data)) {
-  char *ip = NULL, *host = NULL;
+  char ip[H_SIZE] = "", *key = NULL, *host = NULL;
+  khint_t k;
+  int st = 0;
 
   while (1) {
     pthread_mutex_lock (&gdns_thread.mutex);
@@ -222,25 +283,35 @@ dns_worker (void GO_UNUSED (*ptr_data)) {
     while (gqueue_empty (gdns_queue))
       pthread_cond_wait (&gdns_thread.not_empty, &gdns_thread.mutex);
 
-    ip = gqueue_dequeue (gdns_queue);
+    key = gqueue_dequeue (gdns_queue);
+    /* the pending set is freed on exit, even while resolving */
+    snprintf (ip, sizeof (ip), "%s", key);
 
     pthread_mutex_unlock (&gdns_thread.mutex);
-    host = reverse_ip (ip);
+    host = resolve_ip (ip, &st);
     pthread_mutex_lock (&gdns_thread.mutex);
 
     if (!active_gdns) {
       if (host)
         free (host);
+      pthread_mutex_unlock (&gdns_thread.mutex);
       break;
     }
 
-    /* insert the corresponding IP -> hostname map */
-    if (host != NULL && active_gdns) {
-      ht_insert_hostname (ip, host);
-      free (host);
+    k = kh_get (dnsq, gdns_pending, key);
+    if (host != NULL && st == EAI_AGAIN) {
+      kh_val (gdns_pending, k) = time (NULL) + negative_ttl ();
+    } else {
+      /* insert the corresponding IP -> hostname map */
+      if (host != NULL)
+        ht_insert_hostname (ip, host);
+      kh_del (dnsq, gdns_pending, k);
+      free (key);
     }
+    free (host);
 
-    pthread_cond_signal (&gdns_thread.not_full);
+    gdns_inflight--;
+    pthread_cond_broadcast (&gdns_thread.not_full);
     pthread_mutex_unlock (&gdns_thread.mutex);
   }
 }
@@ -250,6 +321,8 @@ void
 gdns_init (void) {
   gdns_queue = xmalloc (sizeof (GDnsQueue));
   gqueue_init (gdns_queue, QUEUE_SIZE);
+  gdns_pending = kh_init (dnsq);
+  gdns_inflight = 0;
 
   if (pthread_cond_init (&(gdns_thread.not_empty), NULL))
     FATAL ("Failed init thread condition");
@@ -264,17 +337,34 @@ gdns_init (void) {
 /* Destroy (free) queue */
 void
 gdns_free_queue (void) {
+  khint_t k;
+
   gqueue_destroy (gdns_queue);
+  /* never set up, e.g., parsing failed early on */
+  if (gdns_pending == NULL)
+    return;
+
+  for (k = kh_begin (gdns_pending); k != kh_end (gdns_pending); ++k) {
+    if (kh_exist (gdns_pending, k))
+      free ((char *) kh_key (gdns_pending, k));
+  }
+  kh_destroy (dnsq, gdns_pending);
+  gdns_pending = NULL;
 }
 
-/* Create a DNS thread and make it active */
+/* Create the pool of DNS threads and make it active. The number of
+ * threads bounds the lookups in flight at once. */
 void
 gdns_thread_create (void) {
-  int th;
+  int th, i, workers = conf.dns_workers ? conf.dns_workers : DNS_WORKERS;
 
   active_gdns = 1;
-  th = pthread_create (&(gdns_thread.thread), NULL, (void *) &dns_worker, NULL);
-  if (th)
-    FATAL ("Return code from pthread_create(): %d", th);
-  pthread_detach (gdns_thread.thread);
+  for (i = 0; i < workers; i++) {
+    th = pthread_create (&(gdns_thread.thread), NULL, (void *) &dns_worker,
+                         NULL);
+    if (th)
+      FATAL ("Return code from pthread_create(): %d", th);
+    pthread_detach (gdns_thread.thread);
+  }
+  gdns_thread.workers = workers;
 }
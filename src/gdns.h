@@ -33,11 +33,16 @@
 #define H_SIZE     1025
 #define QUEUE_SIZE 400
 
+#define DNS_WORKERS      4      /* resolver threads by default */
+#define DNS_MAX_WORKERS  64
+#define DNS_NEGATIVE_TTL 300    /* secs before retrying a timed out IP */
+
 typedef struct GDnsThread_ {
   pthread_cond_t not_empty;     /* not empty queue condition */
   pthread_cond_t not_full;      /* not full queue condition */
   pthread_mutex_t mutex;
   pthread_t thread;
+  int workers;                  /* resolver threads running */
 } GDnsThread;
 
 typedef struct GDnsQueue_ {
@@ -45,7 +50,7 @@ typedef struct GDnsQueue_ {
   int tail;                     /* index to tail of queue */
   int size;                     /* queue size */
   int capacity;                 /* length at most */
-  char buffer[QUEUE_SIZE][H_SIZE];      /* data item */
+  char *buffer[QUEUE_SIZE];     /* data item, owned by the pending set */
 } GDnsQueue;
 
 extern GDnsThread gdns_thread;
@@ -54,10 +59,11 @@ char *gqueue_dequeue (GDnsQueue * q);
 char *reverse_ip (char *str);
 int gqueue_empty (GDnsQueue * q);
 int gqueue_enqueue (GDnsQueue * q, char *item);
-int gqueue_find (GDnsQueue * q, const char *item);
 int gqueue_full (GDnsQueue * q);
 int gqueue_size (GDnsQueue * q);
+void dns_prefetch (char *addr);
 void dns_resolver (char *addr);
+void gdns_wait (void);
 void gdns_free_queue (void);
 void gdns_init (void);
 void gdns_queue_free (void);
@@ -0,0 +1,302 @@
+/**
+ * geocache.c -- bounded cache of GeoIP lookups
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "geocache.h"
+
+#include "error.h"
+#include "util.h"
+#include "xmalloc.h"
+
+static GGeoCache geocache;
+
+/* Convert the given IPv4/6 string into its binary form.
+ *
+ * On error, 0 is returned.
+ * On success, the address family is returned and the number of
+ * address bytes is set. */
+static int
+geocache_addr (const char *ip, uint8_t * addr, int *nbytes) {
+  memset (addr, 0, 16);
+
+  if (strchr (ip, ':') == NULL) {
+    if (inet_pton (AF_INET, ip, addr) != 1)
+      return 0;
+    *nbytes = 4;
+    return AF_INET;
+  }
+  if (inet_pton (AF_INET6, ip, addr) != 1)
+    return 0;
+  *nbytes = 16;
+
+  return AF_INET6;
+}
+
+/* Zero out all the bits of the given address beyond `prefix`. */
+static void
+mask_addr (uint8_t * addr, int nbytes, int prefix) {
+  int i, bits;
+
+  for (i = 0; i < nbytes; ++i) {
+    bits = prefix - (i * 8);
+    if (bits >= 8)
+      continue;
+    addr[i] = bits <= 0 ? 0 : addr[i] & (uint8_t) (0xFF << (8 - bits));
+  }
+}
+
+/* FNV-1a hash over a masked network address and its prefix length.
+ *
+ * The bucket index is returned. */
+static uint32_t
+geocache_bucket (const uint8_t * addr, int nbytes, int family, int prefix) {
+  uint32_t h = 2166136261U;
+  int i;
+
+  for (i = 0; i < nbytes; ++i)
+    h = (h ^ addr[i]) * 16777619U;
+  h = (h ^ (uint8_t) family) * 16777619U;
+  h = (h ^ (uint8_t) prefix) * 16777619U;
+
+  return h & (geocache.buckets - 1);
+}
+
+/* Get the prefix list for the given address family. */
+static GGeoCachePrefix *
+geocache_prefixes (int family) {
+  return &geocache.prefixes[family == AF_INET6 ? 1 : 0];
+}
+
+/* Account a hit on the prefix at `idx` and keep the most hit prefix
+ * lengths first so they are probed first. */
+static void
+hit_prefix (GGeoCachePrefix * pfx, int idx) {
+  uint8_t len;
+  uint64_t hits;
+
+  pfx->hits[idx]++;
+  if (idx == 0 || pfx->hits[idx] <= pfx->hits[idx - 1])
+    return;
+
+  len = pfx->len[idx - 1];
+  hits = pfx->hits[idx - 1];
+  pfx->len[idx - 1] = pfx->len[idx];
+  pfx->hits[idx - 1] = pfx->hits[idx];
+  pfx->len[idx] = len;
+  pfx->hits[idx] = hits;
+}
+
+/* Register a prefix length for the given family. If the list is full,
+ * a new length has to wear down the hits of the least hit one before
+ * taking its place, so a stream of one-off lengths doesn't push out
+ * the ones most lookups hit. Entries stored under an evicted length
+ * become unreachable and are eventually recycled.
+ *
+ * If the length is not (yet) admitted, 1 is returned.
+ * If it is registered, 0 is returned. */
+static int
+add_prefix (GGeoCachePrefix * pfx, int prefix) {
+  int i;
+
+  for (i = 0; i < pfx->size; ++i)
+    if (pfx->len[i] == prefix)
+      return 0;
+
+  if (pfx->size < GEO_CACHE_PREFIXES) {
+    i = pfx->size++;
+  } else {
+    i = pfx->size - 1;
+    if (pfx->hits[i] > 0 && --pfx->hits[i] > 0)
+      return 1;
+  }
+  pfx->len[i] = prefix;
+  pfx->hits[i] = 1;
+
+  return 0;
+}
+
+/* Find a cached entry for the given network.
+ *
+ * If not found, NULL is returned.
+ * On success, the cached entry is returned. */
+static GGeoCacheEntry *
+find_entry (const uint8_t * addr, int nbytes, int family, int prefix) {
+  GGeoCacheEntry *bucket, *entry;
+  uint32_t idx;
+  int i;
+
+  idx = geocache_bucket (addr, nbytes, family, prefix);
+  bucket = geocache.entries + ((size_t) idx * GEO_CACHE_WAYS);
+  for (i = 0; i < GEO_CACHE_WAYS; ++i) {
+    entry = &bucket[i];
+    if (entry->family == family && entry->prefix == prefix &&
+        memcmp (entry->addr, addr, nbytes) == 0)
+      return entry;
+  }
+
+  return NULL;
+}
+
+/* Look up the geolocation of the given IP in the cache. Every known
+ * network prefix length is probed, most hit first.
+ *
+ * If not found, 1 is returned.
+ * On success, the given buffers are set and 0 is returned. */
+int
+geocache_get (const char *ip, char *continent, char *country, char *city) {
+  GGeoCachePrefix *pfx;
+  GGeoCacheEntry *entry;
+  uint8_t addr[16], net[16];
+  int family, nbytes = 0, i;
+
+  if (geocache.entries == NULL || ip == NULL)
+    return 1;
+
+  if ((family = geocache_addr (ip, addr, &nbytes)) == 0)
+    return 1;
+
+  pfx = geocache_prefixes (family);
+  for (i = 0; i < pfx->size; ++i) {
+    memcpy (net, addr, sizeof (net));
+    mask_addr (net, nbytes, pfx->len[i]);
+    if (!(entry = find_entry (net, nbytes, family, pfx->len[i])))
+      continue;
+
+    entry->stamp = ++geocache.stamp;
+    if (continent)
+      xstrncpy (continent, entry->continent, CONTINENT_LEN);
+    if (country)
+      xstrncpy (country, entry->country, COUNTRY_LEN);
+    if (city)
+      xstrncpy (city, entry->city, CITY_LEN);
+
+    hit_prefix (pfx, i);
+    geocache.hits++;
+    return 0;
+  }
+  geocache.misses++;
+
+  return 1;
+}
+
+/* Store the geolocation of the network enclosing the given IP. A
+ * negative or out of range prefix caches the single address only. */
+void
+geocache_set (const char *ip, int prefix, const char *continent,
+              const char *country, const char *city) {
+  GGeoCacheEntry *bucket, *entry;
+  uint8_t addr[16];
+  uint32_t idx;
+  int family, nbytes = 0, i;
+
+  if (geocache.entries == NULL || ip == NULL)
+    return;
+
+  if ((family = geocache_addr (ip, addr, &nbytes)) == 0)
+    return;
+
+  if (prefix < 0 || prefix > nbytes * 8)
+    prefix = nbytes * 8;
+  mask_addr (addr, nbytes, prefix);
+  /* it couldn't be looked up under this length */
+  if (add_prefix (geocache_prefixes (family), prefix))
+    return;
+
+  /* reuse an existing slot for the same network, else the least
+   * recently used way */
+  idx = geocache_bucket (addr, nbytes, family, prefix);
+  bucket = geocache.entries + ((size_t) idx * GEO_CACHE_WAYS);
+  entry = &bucket[0];
+  for (i = 0; i < GEO_CACHE_WAYS; ++i) {
+    if (bucket[i].family == family && bucket[i].prefix == prefix &&
+        memcmp (bucket[i].addr, addr, nbytes) == 0) {
+      entry = &bucket[i];
+      break;
+    }
+    if (bucket[i].stamp < entry->stamp)
+      entry = &bucket[i];
+  }
+
+  memcpy (entry->addr, addr, sizeof (entry->addr));
+  entry->family = family;
+  entry->prefix = prefix;
+  entry->stamp = ++geocache.stamp;
+  xstrncpy (entry->continent, continent ? continent : "", CONTINENT_LEN);
+  xstrncpy (entry->country, country ? country : "", COUNTRY_LEN);
+  xstrncpy (entry->city, city ? city : "", CITY_LEN);
+}
+
+/* Get the number of cache hits and misses so far. */
+void
+geocache_stats (uint64_t * hits, uint64_t * misses) {
+  *hits = geocache.hits;
+  *misses = geocache.misses;
+}
+
+/* Allocate a cache able to hold `size` networks. The number of
+ * buckets is rounded up to a power of two. */
+void
+geocache_init (uint32_t size) {
+  uint32_t buckets = 1;
+
+  if (size == 0 || geocache.entries != NULL)
+    return;
+
+  while (buckets * GEO_CACHE_WAYS < size)
+    buckets <<= 1;
+
+  memset (&geocache, 0, sizeof (geocache));
+  geocache.buckets = buckets;
+  geocache.entries = xcalloc ((size_t) buckets * GEO_CACHE_WAYS,
+                              sizeof (GGeoCacheEntry));
+}
+
+/* Free the cache and log its effectiveness. */
+void
+geocache_free (void) {
+  if (geocache.entries == NULL)
+    return;
+
+  LOG_DEBUG (("GeoIP cache: %llu hits, %llu misses\n",
+              (unsigned long long) geocache.hits,
+              (unsigned long long) geocache.misses));
+
+  free (geocache.entries);
+  memset (&geocache, 0, sizeof (geocache));
+}
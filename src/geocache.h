@@ -0,0 +1,83 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef GEOCACHE_H_INCLUDED
+#define GEOCACHE_H_INCLUDED
+
+#include <stdint.h>
+
+#include "geoip1.h"
+
+#define GEO_CACHE_SIZE    16384 /* max number of cached networks */
+#define GEO_CACHE_WAYS        4 /* entries per bucket */
+#define GEO_CACHE_PREFIXES   12 /* max distinct prefix lengths per family */
+
+/* A cached geolocation lookup. The address is stored masked to the
+ * prefix of the enclosing network reported by the GeoIP database, so
+ * any address within that network hits the same entry. */
+typedef struct GGeoCacheEntry_ {
+  uint8_t addr[16];             /* network address (binary) */
+  uint8_t family;               /* AF_INET, AF_INET6 or 0 if empty */
+  uint8_t prefix;               /* network prefix length */
+  uint32_t stamp;               /* last access, for eviction */
+
+  char continent[CONTINENT_LEN];
+  char country[COUNTRY_LEN];
+  char city[CITY_LEN];
+} GGeoCacheEntry;
+
+/* Prefix lengths seen so far for a family, most hit first */
+typedef struct GGeoCachePrefix_ {
+  uint8_t len[GEO_CACHE_PREFIXES];
+  uint64_t hits[GEO_CACHE_PREFIXES];
+  int size;
+} GGeoCachePrefix;
+
+typedef struct GGeoCache_ {
+  GGeoCacheEntry *entries;
+  uint32_t buckets;             /* number of buckets, power of two */
+  uint32_t stamp;               /* access clock */
+  GGeoCachePrefix prefixes[2];  /* IPv4, IPv6 */
+
+  uint64_t hits;
+  uint64_t misses;
+} GGeoCache;
+
+int geocache_get (const char *ip, char *continent, char *country, char *city);
+void geocache_free (void);
+void geocache_init (uint32_t size);
+void geocache_set (const char *ip, int prefix, const char *continent,
+                   const char *country, const char *city);
+void geocache_stats (uint64_t * hits, uint64_t * misses);
+
+#endif // for #ifndef GEOCACHE_H
@@ -40,6 +40,7 @@
 #include "geoip1.h"
 
 #include "error.h"
+#include "geocache.h"
 #include "util.h"
 
 static GeoIP *geo_location_data;
@@ -61,6 +62,8 @@ geoip_free (void) {
 
   GeoIP_delete (geo_location_data);
   GeoIP_cleanup ();
+
+  geocache_free ();
 }
 
 /* Open the given GeoLocation database and set its charset.
@@ -90,6 +93,9 @@ init_geoip (void) {
   /* fall back to legacy GeoIP database */
   else
     geo_location_data = GeoIP_new (conf.geo_db);
+
+  if (geo_location_data != NULL)
+    geocache_init (GEO_CACHE_SIZE);
 }
 
 /* Get continent name concatenated with code.
@@ -396,7 +402,8 @@ geoip_get_city (const char *ip, char *location, GTypeIP type_ip) {
 }
 
 /* Entry point to set GeoIP location into the corresponding buffers,
- * (continent, country, city).
+ * (continent, country, city). Results are cached per enclosing
+ * network, so neighbouring addresses don't hit the database.
  *
  * On error, 1 is returned
  * On success, buffers are set and 0 is returned */
@@ -410,10 +417,16 @@ set_geolocation (char *host, char *continent, char *country, char *city) {
   if (invalid_ipaddr (host, &type_ip))
     return 1;
 
+  if (geocache_get (host, continent, country, city) == 0)
+    return 0;
+
   geoip_get_country (host, country, type_ip);
   geoip_get_continent (host, continent, type_ip);
   if (conf.geoip_database)
     geoip_get_city (host, city, type_ip);
 
+  geocache_set (host, GeoIP_last_netmask (geo_location_data), continent,
+                country, city);
+
   return 0;
 }
@@ -43,6 +43,7 @@
 #include "geoip1.h"
 
 #include "error.h"
+#include "geocache.h"
 #include "util.h"
 #include "xmalloc.h"
 
@@ -68,6 +69,8 @@ geoip_free (void) {
   MMDB_close (mmdb);
   free (mmdb);
   mmdb = NULL;
+
+  geocache_free ();
 }
 
 /* Open the given GeoIP2 database.
@@ -91,11 +94,14 @@ init_geoip (void) {
 
   if (strcmp (mmdb->metadata.database_type, "GeoLite2-City") == 0)
     geoip_city_type = 1;
+
+  geocache_init (GEO_CACHE_SIZE);
 }
 
 /* Look up an IP address that is passed in as a null-terminated string.
  *
  * On error, it aborts.
+ * If the IP can't be parsed, -1 is returned.
  * If no entry is found, 1 is returned.
  * On success, MMDB_lookup_result_s struct is set and 0 is returned. */
 static int
@@ -104,7 +110,7 @@ geoip_lookup (MMDB_lookup_result_s * res, const char *ip) {
 
   *res = MMDB_lookup_string (mmdb, ip, &gai_err, &mmdb_err);
   if (0 != gai_err)
-    return 1;
+    return -1;
 
   if (MMDB_SUCCESS != mmdb_err)
     FATAL ("Error from libmaxminddb: %s\n", MMDB_strerror (mmdb_err));
@@ -212,6 +218,8 @@ geoip_query_city (MMDB_lookup_result_s res, char *location) {
     region = get_value (res, "subdivisions", "0", "names", "en", NULL);
   }
   geoip_set_city (city, region, location);
+  free (city);
+  free (region);
 }
 
 /* A wrapper to fetch the looked up result and set the country and code.
@@ -227,6 +235,8 @@ geoip_query_country (MMDB_lookup_result_s res, char *location) {
     code = get_value (res, "country", "iso_code", NULL);
   }
   geoip_set_country (country, code, location);
+  free (country);
+  free (code);
 }
 
 /* A wrapper to fetch the looked up result and set the continent code.
@@ -240,6 +250,7 @@ geoip_query_continent (MMDB_lookup_result_s res, char *location) {
   if (res.found_entry)
     code = get_value (res, "continent", "code", NULL);
   geoip_set_continent (code, location);
+  free (code);
 }
 
 /* Set country data by record into the given `location` buffer */
@@ -260,23 +271,46 @@ geoip_get_continent (const char *ip, char *location, GO_UNUSED GTypeIP type_ip)
   geoip_query_continent (res, location);
 }
 
+/* Get the prefix length of the network enclosing the looked up IP.
+ * IPv4 addresses within an IPv6 database are stored under ::/96, so
+ * their netmask is made relative to the IPv4 address.
+ *
+ * The prefix length is returned. */
+static int
+geoip_netmask (MMDB_lookup_result_s res, const char *ip) {
+  int netmask = res.netmask;
+
+  if (mmdb->metadata.ip_version == 6 && strchr (ip, ':') == NULL)
+    netmask -= 96;
+
+  return netmask;
+}
+
 /* Entry point to set GeoIP location into the corresponding buffers,
- * (continent, country, city).
+ * (continent, country, city). Results are cached per enclosing
+ * network, so neighbouring addresses don't hit the database.
  *
  * On error, 1 is returned
  * On success, buffers are set and 0 is returned */
 int
 set_geolocation (char *host, char *continent, char *country, char *city) {
   MMDB_lookup_result_s res;
+  int ret = 0;
 
   if (!is_geoip_resource ())
     return 1;
 
-  geoip_lookup (&res, host);
+  if (geocache_get (host, continent, country, city) == 0)
+    return 0;
+
+  ret = geoip_lookup (&res, host);
   geoip_query_country (res, country);
   geoip_query_continent (res, continent);
   if (geoip_city_type)
     geoip_query_city (res, city);
 
+  if (ret != -1)
+    geocache_set (host, geoip_netmask (res, host), continent, country, city);
+
   return 0;
 }
@@ -0,0 +1,204 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ghist.h"
+
+#include "xmalloc.h"
+
+/* Get the bucket a value falls in. */
+static uint32_t
+hist_index (uint64_t value) {
+  uint32_t e = 63;
+
+  if (value < (1U << HIST_SUB_BITS))
+    return (uint32_t) value;
+
+  while (!(value & (1ULL << e)))
+    e--;
+
+  return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+    (uint32_t) ((value >> (e - HIST_SUB_BITS)) & ((1U << HIST_SUB_BITS) - 1));
+}
+
+/* Get the value a bucket stands for, i.e., the middle of its range. */
+static uint64_t
+hist_value (uint32_t idx) {
+  uint32_t e, sub;
+  uint64_t lo;
+
+  if (idx < (1U << HIST_SUB_BITS))
+    return idx;
+
+  e = (idx >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+  sub = idx & ((1U << HIST_SUB_BITS) - 1);
+  lo = ((uint64_t) ((1U << HIST_SUB_BITS) | sub)) << (e - HIST_SUB_BITS);
+
+  return lo + ((1ULL << (e - HIST_SUB_BITS)) >> 1);
+}
+
+GHist *
+hist_new (void) {
+  return xcalloc (1, sizeof (GHist));
+}
+
+void
+hist_free (GHist * hist) {
+  if (hist == NULL)
+    return;
+  free (hist->bins);
+  free (hist);
+}
+
+/* Find the position of the given bucket among the ones hit, or where
+ * it would be inserted. */
+static uint32_t
+bin_find (const GHist * hist, uint32_t idx) {
+  uint32_t lo = 0, hi = hist->n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (hist->bins[mid].idx < idx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* Add `count` to the given bucket. Counts saturate rather than wrap. */
+static void
+add_bin (GHist * hist, uint32_t idx, uint32_t count) {
+  uint32_t pos = bin_find (hist, idx);
+
+  hist->total += count;
+  if (pos < hist->n && hist->bins[pos].idx == idx) {
+    if (hist->bins[pos].count > UINT32_MAX - count)
+      hist->bins[pos].count = UINT32_MAX;
+    else
+      hist->bins[pos].count += count;
+    return;
+  }
+
+  if (hist->n == hist->size) {
+    hist->size = hist->size ? hist->size * 2 : 4;
+    hist->bins = xrealloc (hist->bins, hist->size * sizeof (GHistBin));
+  }
+  memmove (hist->bins + pos + 1, hist->bins + pos,
+           (hist->n - pos) * sizeof (GHistBin));
+  hist->bins[pos].idx = idx;
+  hist->bins[pos].count = count;
+  hist->n++;
+}
+
+/* Add `count` occurrences of a value to the histogram. */
+void
+hist_add (GHist * hist, uint64_t value, uint32_t count) {
+  if (count == 0)
+    return;
+  add_bin (hist, hist_index (value), count);
+}
+
+/* Add the counts of `src` to those of `dst`. */
+void
+hist_merge (GHist * dst, const GHist * src) {
+  uint32_t i;
+
+  for (i = 0; i < src->n; ++i)
+    add_bin (dst, src->bins[i].idx, src->bins[i].count);
+}
+
+/* Get the value under which `q` percent of the values added fall, i.e.,
+ * the nearest rank, within the error of its bucket.
+ *
+ * If the histogram is empty, 0 is returned.
+ * On success, the percentile is returned. */
+uint64_t
+hist_percentile (const GHist * hist, double q) {
+  uint64_t rank, seen = 0;
+  uint32_t i;
+
+  if (hist == NULL || hist->total == 0)
+    return 0;
+
+  rank = (uint64_t) (q / 100.0 * (double) hist->total + 0.999999);
+  if (rank == 0)
+    rank = 1;
+
+  for (i = 0; i < hist->n; ++i) {
+    seen += hist->bins[i].count;
+    if (seen >= rank)
+      break;
+  }
+
+  return hist_value (hist->bins[i < hist->n ? i : hist->n - 1].idx);
+}
+
+/* Rebuild a histogram from its buckets, e.g., as persisted.
+ *
+ * If they are not valid, NULL is returned.
+ * On success, the new histogram is returned. */
+GHist *
+hist_load (uint32_t n, const void *bins) {
+  const unsigned char *p = bins;
+  GHist *hist = NULL;
+  GHistBin bin;
+  uint32_t i;
+
+  if (n > HIST_BUCKETS)
+    return NULL;
+
+  hist = hist_new ();
+  if (n) {
+    hist->bins = xmalloc (n * sizeof (GHistBin));
+    hist->size = n;
+  }
+
+  for (i = 0; i < n; ++i) {
+    memcpy (&bin, p + i * sizeof (GHistBin), sizeof (bin));
+    /* buckets must be sorted, hit, and within range */
+    if (bin.idx >= HIST_BUCKETS || bin.count == 0 ||
+        (i && bin.idx <= hist->bins[i - 1].idx)) {
+      hist_free (hist);
+      return NULL;
+    }
+    hist->bins[i] = bin;
+    hist->total += bin.count;
+    hist->n++;
+  }
+
+  return hist;
+}
@@ -0,0 +1,69 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef GHIST_H_INCLUDED
+#define GHIST_H_INCLUDED
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 4         /* 16 buckets per power of two, ~3% error */
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/* A bucket of the histogram and the number of values that fell in it. */
+typedef struct GHistBin_ {
+  uint32_t idx;
+  uint32_t count;
+} GHistBin;
+
+/* A log-linear histogram of values, e.g., times served.
+ *
+ * Values below 2^HIST_SUB_BITS get a bucket each. Above that, every
+ * power of two is split into 2^HIST_SUB_BITS buckets of equal width, so
+ * a value is off by at most half a bucket, i.e., ~3% of it. Only the
+ * buckets hit are kept, sorted by index, which makes two histograms
+ * mergeable by adding up their counts. */
+typedef struct GHist_ {
+  uint32_t n;                   /* buckets hit */
+  uint32_t size;                /* buckets allocated */
+  uint64_t total;               /* values added */
+  GHistBin *bins;
+} GHist;
+
+GHist *hist_load (uint32_t n, const void *bins);
+GHist *hist_new (void);
+uint64_t hist_percentile (const GHist * hist, double q);
+void hist_add (GHist * hist, uint64_t value, uint32_t count);
+void hist_free (GHist * hist);
+void hist_merge (GHist * dst, const GHist * src);
+
+#endif // for #ifndef GHIST_H
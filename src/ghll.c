@@ -0,0 +1,331 @@
+/**
+ * ghll.c -- HyperLogLog sketches to approximate unique visitors
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ghll.h"
+
+#include "xmalloc.h"
+
+#define HLL_REGS(p) (1U << (p))
+
+/* Get the most sparse entries a sketch of the given precision holds
+ * before turning dense, i.e., as long as they take less room. */
+uint32_t
+hll_sparse_max (uint8_t precision) {
+  return HLL_REGS (precision) / sizeof (uint32_t);
+}
+
+/* Hash a key into 64 bits. FNV-1a is followed by a finalizer so every
+ * bit of the hash depends on every byte of the key. */
+uint64_t
+hll_hash (const char *key) {
+  const unsigned char *p = (const unsigned char *) key;
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  while (*p) {
+    h ^= *p++;
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+/* Get the term of a register of the given rank in the registers' sum,
+ * in fixed point. Ranks beyond its bits add nothing measurable. */
+static uint64_t
+rank_term (uint8_t rank) {
+  return rank > HLL_SUM_BITS ? 0 : 1ULL << (HLL_SUM_BITS - rank);
+}
+
+static void
+hll_init (GHLL * hll, uint8_t precision) {
+  memset (hll, 0, sizeof (GHLL));
+  hll->precision = precision;
+  hll->zeros = HLL_REGS (precision);
+  hll->sum = (uint64_t) HLL_REGS (precision) << HLL_SUM_BITS;
+}
+
+/* Allocate an empty, sparse, sketch.
+ *
+ * On success, the new sketch is returned. */
+GHLL *
+hll_new (uint8_t precision) {
+  GHLL *hll = xmalloc (sizeof (GHLL));
+  hll_init (hll, precision);
+
+  return hll;
+}
+
+void
+hll_free (GHLL * hll) {
+  if (hll == NULL)
+    return;
+  free (hll->dense ? (void *) hll->regs : (void *) hll->sparse);
+  free (hll);
+}
+
+/* Find the position of the given register among the sparse entries,
+ * or where it would be inserted. */
+static uint32_t
+sparse_find (const GHLL * hll, uint32_t idx) {
+  uint32_t lo = 0, hi = hll->n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if ((hll->sparse[mid] >> 8) < idx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static void
+to_dense (GHLL * hll) {
+  uint8_t *regs = xcalloc (HLL_REGS (hll->precision), sizeof (uint8_t));
+  uint32_t i;
+
+  for (i = 0; i < hll->n; ++i)
+    regs[hll->sparse[i] >> 8] = hll->sparse[i] & 0xff;
+
+  free (hll->sparse);
+  hll->regs = regs;
+  hll->dense = 1;
+  hll->n = hll->size = 0;
+}
+
+/* Account for a register raised from one rank to another. */
+static void
+update_sum (GHLL * hll, uint8_t from, uint8_t to) {
+  if (from == 0)
+    hll->zeros--;
+  hll->sum -= rank_term (from);
+  hll->sum += rank_term (to);
+}
+
+/* Raise the given register to the given rank.
+ *
+ * If the register was lower, 1 is returned.
+ * Otherwise, 0 is returned. */
+static int
+set_reg (GHLL * hll, uint32_t idx, uint8_t rank) {
+  uint32_t pos, max;
+
+  if (hll->dense) {
+    if (hll->regs[idx] >= rank)
+      return 0;
+    update_sum (hll, hll->regs[idx], rank);
+    hll->regs[idx] = rank;
+    return 1;
+  }
+
+  pos = sparse_find (hll, idx);
+  if (pos < hll->n && (hll->sparse[pos] >> 8) == idx) {
+    if ((hll->sparse[pos] & 0xff) >= rank)
+      return 0;
+    update_sum (hll, hll->sparse[pos] & 0xff, rank);
+    hll->sparse[pos] = idx << 8 | rank;
+    return 1;
+  }
+
+  update_sum (hll, 0, rank);
+  max = hll_sparse_max (hll->precision);
+  if (hll->n == max) {
+    to_dense (hll);
+    hll->regs[idx] = rank;
+    return 1;
+  }
+  if (hll->n == hll->size) {
+    hll->size = hll->size ? hll->size * 2 : 4;
+    if (hll->size > max)
+      hll->size = max;
+    hll->sparse = xrealloc (hll->sparse, hll->size * sizeof (uint32_t));
+  }
+
+  memmove (hll->sparse + pos + 1, hll->sparse + pos,
+           (hll->n - pos) * sizeof (uint32_t));
+  hll->sparse[pos] = idx << 8 | rank;
+  hll->n++;
+
+  return 1;
+}
+
+/* Add a hashed key to the sketch. Its top bits pick a register, and
+ * the rest set its rank, i.e., the position of their first 1 bit.
+ *
+ * If the sketch changed, 1 is returned.
+ * Otherwise, 0 is returned. */
+int
+hll_add (GHLL * hll, uint64_t hash) {
+  uint8_t p = hll->precision, rank = 1;
+  uint64_t w = hash << p;
+
+  while (rank <= 64 - p && !(w & (1ULL << 63))) {
+    rank++;
+    w <<= 1;
+  }
+
+  return set_reg (hll, (uint32_t) (hash >> (64 - p)), rank);
+}
+
+/* Raise the registers of `dst` to those of `src`. A register of a more
+ * precise sketch is folded into the one it maps to in `dst`: the bits
+ * dropped from its index are the first bits counted by its rank. */
+static void
+merge_regs (GHLL * dst, const GHLL * src) {
+  uint32_t i, idx, low, n, d = src->precision - dst->precision;
+  uint8_t rank;
+
+  n = src->dense ? HLL_REGS (src->precision) : src->n;
+  for (i = 0; i < n; ++i) {
+    if (src->dense) {
+      idx = i;
+      rank = src->regs[i];
+    } else {
+      idx = src->sparse[i] >> 8;
+      rank = src->sparse[i] & 0xff;
+    }
+    if (rank == 0)
+      continue;
+
+    if (d) {
+      low = idx & ((1U << d) - 1);
+      idx >>= d;
+      if (low == 0) {
+        rank += d;
+      } else {
+        for (rank = 1; !(low & (1U << (d - 1))); low <<= 1)
+          rank++;
+      }
+    }
+    set_reg (dst, idx, rank);
+  }
+}
+
+/* Merge `src` into `dst`, so it estimates the union of both. Sketches
+ * of different precisions are merged at the lowest of them. */
+void
+hll_merge (GHLL * dst, const GHLL * src) {
+  GHLL tmp;
+
+  if (src->precision < dst->precision) {
+    hll_init (&tmp, src->precision);
+    merge_regs (&tmp, dst);
+    free (dst->dense ? (void *) dst->regs : (void *) dst->sparse);
+    *dst = tmp;
+  }
+  merge_regs (dst, src);
+}
+
+/* Rebuild a sketch from its registers, or its sparse entries, e.g., as
+ * persisted.
+ *
+ * If they are not valid, NULL is returned.
+ * On success, the new sketch is returned. */
+GHLL *
+hll_load (uint8_t precision, int dense, uint32_t n, const void *regs) {
+  const unsigned char *p = regs;
+  GHLL *hll = NULL;
+  uint32_t i, e, idx, m = HLL_REGS (precision);
+  uint8_t rank, max = 64 - precision + 1;
+
+  if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION ||
+      (!dense && n > hll_sparse_max (precision)))
+    return NULL;
+
+  hll = hll_new (precision);
+  if (dense)
+    to_dense (hll);
+
+  for (i = 0; i < (dense ? m : n); ++i) {
+    if (dense) {
+      idx = i;
+      rank = p[i];
+    } else {
+      memcpy (&e, p + i * sizeof (uint32_t), sizeof (e));
+      idx = e >> 8;
+      rank = e & 0xff;
+      /* entries must be sorted, set, and within the registers */
+      if (idx >= m || rank == 0 || (i && idx <= (hll->sparse[i - 1] >> 8)))
+        rank = max + 1;
+    }
+    if (rank > max) {
+      hll_free (hll);
+      return NULL;
+    }
+    set_reg (hll, idx, rank);
+  }
+
+  return hll;
+}
+
+/* Estimate the number of distinct keys added to the sketch. Small
+ * cardinalities, while registers are still empty, are counted through
+ * linear counting instead.
+ *
+ * The estimate is returned. */
+uint32_t
+hll_count (const GHLL * hll) {
+  uint32_t m = HLL_REGS (hll->precision);
+  double alpha, est;
+
+  switch (m) {
+  case 16:
+    alpha = 0.673;
+    break;
+  case 32:
+    alpha = 0.697;
+    break;
+  case 64:
+    alpha = 0.709;
+    break;
+  default:
+    alpha = 0.7213 / (1.0 + 1.079 / m);
+  }
+
+  est = alpha * m * m / ldexp ((double) hll->sum, -HLL_SUM_BITS);
+  if (est <= 2.5 * m && hll->zeros)
+    est = m * log ((double) m / hll->zeros);
+
+  return est >= UINT32_MAX ? UINT32_MAX : (uint32_t) (est + 0.5);
+}
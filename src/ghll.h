@@ -0,0 +1,73 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef GHLL_H_INCLUDED
+#define GHLL_H_INCLUDED
+
+#include <stdint.h>
+
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 16
+#define HLL_DEF_PRECISION 12    /* 4096 registers, ~1.6% standard error */
+#define HLL_SUM_BITS      47    /* fixed point of the registers' sum */
+
+/* A HyperLogLog sketch of 2^precision registers, each holding the
+ * longest run of leading zeros seen among the hashes routed to it.
+ *
+ * It starts sparse, holding only the registers set as sorted
+ * `index << 8 | rank` entries, and turns dense, one byte per register,
+ * once that takes less room. The sum of 2^-rank over all registers is
+ * kept as they change, so it is estimated in constant time. */
+typedef struct GHLL_ {
+  uint8_t precision;
+  uint8_t dense;
+  uint32_t n;                   /* sparse entries */
+  uint32_t size;                /* sparse entries allocated */
+  uint32_t zeros;               /* registers not set */
+  uint64_t sum;                 /* in units of 2^-HLL_SUM_BITS */
+  union {
+    uint32_t *sparse;
+    uint8_t *regs;
+  };
+} GHLL;
+
+GHLL *hll_load (uint8_t precision, int dense, uint32_t n, const void *regs);
+GHLL *hll_new (uint8_t precision);
+int hll_add (GHLL * hll, uint64_t hash);
+void hll_merge (GHLL * dst, const GHLL * src);
+uint32_t hll_count (const GHLL * hll);
+uint32_t hll_sparse_max (uint8_t precision);
+uint64_t hll_hash (const char *key);
+void hll_free (GHLL * hll);
+
+#endif // for #ifndef GHLL_H
@@ -219,10 +219,19 @@ free_holder_by_module (GHolder ** holder, GModule module) {
     free_holder_data ((*holder)[module].items[j]);
   }
   free ((*holder)[module].items);
+  free ((*holder)[module].find_ids);
 
+  (*holder)[module].find_ids = NULL;
+  (*holder)[module].find_rows = 0;
   (*holder)[module].holder_size = 0;
   (*holder)[module].idx = 0;
   (*holder)[module].sub_items_size = 0;
+  (*holder)[module].max_hits = 0;
+  (*holder)[module].max_visitors = 0;
+  (*holder)[module].max_bw_len = 0;
+  (*holder)[module].max_method_len = 0;
+  (*holder)[module].max_data_len = 0;
+  (*holder)[module].max_sub_data_len = 0;
 }
 
 /* Free all memory allocated in holder for all modules. */
@@ -242,6 +251,7 @@ free_holder (GHolder ** holder) {
       free_holder_data ((*holder)[module].items[j]);
     }
     free ((*holder)[module].items);
+    free ((*holder)[module].find_ids);
   }
   free (*holder);
   (*holder) = NULL;
@@ -299,6 +309,9 @@ sort_sub_list (GHolder * h, GSort sort) {
         arr[j].metrics->avgts.nts = iter->metrics->avgts.nts;
         arr[j].metrics->cumts.nts = iter->metrics->cumts.nts;
         arr[j].metrics->maxts.nts = iter->metrics->maxts.nts;
+        arr[j].metrics->p50ts.nts = iter->metrics->p50ts.nts;
+        arr[j].metrics->p95ts.nts = iter->metrics->p95ts.nts;
+        arr[j].metrics->p99ts.nts = iter->metrics->p99ts.nts;
       }
     }
     sort_holder_items (arr, j, sort);
@@ -331,20 +344,18 @@ set_host_child_metrics (char *data, uint8_t id, GMetrics ** nmetrics) {
   return 0;
 }
 
+#ifdef HAVE_GEOLOCATION
 /* Set host panel data, including sub items.
  *
  * On success, the host panel data is set. */
 static void
 set_host_sub_list (GHolder * h, GSubList * sub_list) {
   GMetrics *nmetrics;
-#ifdef HAVE_GEOLOCATION
   char city[CITY_LEN] = "";
   char continent[CONTINENT_LEN] = "";
   char country[COUNTRY_LEN] = "";
-#endif
+  char *host = h->items[h->idx].metrics->data;
 
-  char *host = h->items[h->idx].metrics->data, *hostname = NULL;
-#ifdef HAVE_GEOLOCATION
   /* add geolocation child nodes */
   set_geolocation (host, continent, country, city);
 
@@ -369,18 +380,8 @@ set_host_sub_list (GHolder * h, GSubList * sub_list) {
     /* flag only */
     conf.has_geocity = 1;
   }
-#endif
-
-  /* hostname */
-  if (conf.enable_html_resolver && conf.output_stdout) {
-    hostname = reverse_ip (host);
-    set_host_child_metrics (hostname, MTRC_ID_HOSTNAME, &nmetrics);
-    add_sub_item_back (sub_list, h->module, nmetrics);
-    h->items[h->idx].sub_list = sub_list;
-    h->sub_items_size++;
-    free (hostname);
-  }
 }
+#endif
 
 /* Set host panel data, including sub items.
  *
@@ -394,8 +395,14 @@ add_host_child_to_holder (GHolder * h) {
   char *hostname = NULL;
   int n = h->sub_items_size;
 
+#ifdef HAVE_GEOLOCATION
   /* add child nodes */
   set_host_sub_list (h, sub_list);
+#endif
+
+  /* hostnames are resolved all at once, see set_host_hostnames() */
+  if (conf.enable_html_resolver && conf.output_stdout)
+    goto out;
 
   pthread_mutex_lock (&gdns_thread.mutex);
   hostname = ht_get_hostname (ip);
@@ -412,6 +419,7 @@ add_host_child_to_holder (GHolder * h) {
     free (hostname);
   }
 
+out:
   /* did not add any items */
   if (n == h->sub_items_size)
     free (sub_list);
@@ -459,6 +467,28 @@ sum_u64_from_list (uint64_t (*cb) (GModule, uint32_t), GModule module,
   return data.value.u64value;
 }
 
+/* Set the percentiles of the time served of an item out of the
+ * histograms of all its keys, see --latency-percentiles. */
+static void
+set_latency_metrics (GModule module, GMetrics * metrics, GSLList * keys) {
+  GHist *hist = NULL, *sum = NULL;
+  GSLList *node = NULL;
+
+  if (!conf.latency_percentiles)
+    return;
+
+  sum = hist_new ();
+  for (node = keys; node; node = node->next) {
+    if ((hist = ht_get_latency (module, (*(uint32_t *) node->data))))
+      hist_merge (sum, hist);
+  }
+
+  metrics->p50ts.nts = hist_percentile (sum, 50);
+  metrics->p95ts.nts = hist_percentile (sum, 95);
+  metrics->p99ts.nts = hist_percentile (sum, 99);
+  hist_free (sum);
+}
+
 /* Given a GRawDataType, set the data and hits value.
  *
  * On error, no values are set and 1 is returned.
@@ -508,6 +538,7 @@ set_data_holder_metrics (GRawDataItem item, GHolder * h, char *data,
   h->items[h->idx].metrics->avgts.nts = cumts / hits;
   h->items[h->idx].metrics->cumts.nts = cumts;
   h->items[h->idx].metrics->maxts.nts = maxts;
+  set_latency_metrics (h->module, h->items[h->idx].metrics, item.key.lkeys);
 
   node = item.key.lkeys;
   while (node) {
@@ -629,6 +660,7 @@ set_root_metrics (GRawDataItem item, GModule module, GMetrics ** nmetrics) {
   metrics->avgts.nts = cumts / hits;
   metrics->cumts.nts = cumts;
   metrics->maxts.nts = maxts;
+  set_latency_metrics (module, metrics, item.key.lkeys);
   metrics->bw.nbw = bw;
   metrics->data = data;
   metrics->hits = hits;
@@ -644,6 +676,7 @@ add_root_to_holder (GRawDataItem item, GHolder * h,
                     GO_UNUSED const GPanel * panel) {
   GSubList *sub_list;
   GMetrics *metrics, *nmetrics;
+  GSLList *node = NULL;
   char *root = NULL;
   int root_idx = KEY_NOT_FOUND, idx = 0;
 
@@ -683,9 +716,92 @@ add_root_to_holder (GRawDataItem item, GHolder * h,
   if (nmetrics->maxts.nts > h->items[idx].metrics->maxts.nts)
     h->items[idx].metrics->maxts.nts = nmetrics->maxts.nts;
 
+  /* percentiles don't add up, the root's are set from all its
+   * children's keys once loaded */
+  if (conf.latency_percentiles) {
+    for (node = item.key.lkeys; node; node = node->next)
+      dup_key_list (node->data, &h->items[idx].metrics->keys);
+  }
+
   h->sub_items_size++;
 }
 
+/* Resolve the hostnames of all hosts in the holder at once, rather
+ * than one lookup at a time, then add them as sub items. */
+static void
+set_host_hostnames (GHolder * h) {
+  GMetrics *nmetrics;
+  char *hostname = NULL;
+  int i;
+
+  for (i = 0; i < h->idx; i++) {
+    pthread_mutex_lock (&gdns_thread.mutex);
+    hostname = ht_get_hostname (h->items[i].metrics->data);
+    pthread_mutex_unlock (&gdns_thread.mutex);
+
+    /* resolved already, e.g., on a previous real-time update */
+    if (hostname == NULL)
+      dns_prefetch (h->items[i].metrics->data);
+    free (hostname);
+  }
+  gdns_wait ();
+
+  for (i = 0; i < h->idx; i++) {
+    pthread_mutex_lock (&gdns_thread.mutex);
+    hostname = ht_get_hostname (h->items[i].metrics->data);
+    pthread_mutex_unlock (&gdns_thread.mutex);
+
+    if (hostname == NULL)
+      continue;
+
+    if (h->items[i].sub_list == NULL)
+      h->items[i].sub_list = new_gsublist ();
+    set_host_child_metrics (hostname, MTRC_ID_HOSTNAME, &nmetrics);
+    add_sub_item_back (h->items[i].sub_list, h->module, nmetrics);
+    h->sub_items_size++;
+    free (hostname);
+  }
+}
+
+/* Keep the given item's metrics if they are the largest so far. */
+static void
+set_holder_max (GHolder * h, GMetrics * metrics, int is_subitem) {
+  int len = 0;
+
+  if (metrics->data == NULL)
+    return;
+
+  if (h->max_hits < metrics->hits)
+    h->max_hits = metrics->hits;
+  if (h->max_visitors < metrics->visitors)
+    h->max_visitors = metrics->visitors;
+  if ((len = filesize_len (metrics->bw.nbw)) > h->max_bw_len)
+    h->max_bw_len = len;
+  if (metrics->method && (len = strlen (metrics->method)) > h->max_method_len)
+    h->max_method_len = len;
+
+  len = strlen (metrics->data);
+  if (is_subitem && len > h->max_sub_data_len)
+    h->max_sub_data_len = len;
+  else if (!is_subitem && len > h->max_data_len)
+    h->max_data_len = len;
+}
+
+/* Set the largest metrics across all items and sub items. */
+static void
+set_holder_meta (GHolder * h) {
+  GSubItem *iter;
+  int i;
+
+  for (i = 0; i < h->idx; i++) {
+    set_holder_max (h, h->items[i].metrics, 0);
+    if (h->items[i].sub_list == NULL)
+      continue;
+    for (iter = h->items[i].sub_list->head; iter; iter = iter->next)
+      set_holder_max (h, iter->metrics, 1);
+  }
+}
+
 /* Load raw data into our holder structure */
 void
 load_holder_data (GRawData * raw_data, GHolder * h, GModule module, GSort sort) {
@@ -704,8 +820,15 @@ load_holder_data (GRawData * raw_data, GHolder * h, GModule module, GSort sort)
   for (i = 0; i < h->holder_size; i++) {
     panel->insert (raw_data->items[i], h, panel);
   }
+  if (module == HOSTS && conf.enable_html_resolver && conf.output_stdout)
+    set_host_hostnames (h);
+  for (i = 0; i < h->idx && h->sub_items_size; i++) {
+    set_latency_metrics (module, h->items[i].metrics,
+                         h->items[i].metrics->keys);
+  }
   sort_holder_items (h->items, h->idx, sort);
   if (h->sub_items_size)
     sort_sub_list (h, sort);
+  set_holder_meta (h);
   free_raw_data (raw_data);
 }
@@ -0,0 +1,1158 @@
+/**
+ * gkdb.c -- versioned on-disk database of hash tables
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "gkdb.h"
+
+#include "error.h"
+#include "gstorage.h"
+#include "settings.h"
+#include "xmalloc.h"
+
+#define GKDB_PRIME 0x9E3779B97F4A7C15ULL
+#define GKDB_NONE  UINT64_MAX   /* offset of a NULL string */
+
+/* The memory layout shared by every khash_t type, see __KHASH_TYPE */
+typedef struct GKDBHash_ {
+  khint_t n_buckets, size, n_occupied, upper_bound;
+  khint32_t *flags;
+  void *keys;
+  void *vals;
+} GKDBHash;
+
+/* How keys and values are stored */
+typedef enum GKDBKind_ {
+  KIND_NONE,
+  KIND_U8,
+  KIND_U32,
+  KIND_U64,
+  KIND_STR,
+  KIND_GSL,
+  KIND_HLL,
+  KIND_HIST,
+} GKDBKind;
+
+/* How a sketch is stored in the pool, followed by its registers, or
+ * its sparse entries */
+typedef struct GKDBSketch_ {
+  uint8_t precision;
+  uint8_t dense;
+  uint16_t pad;
+  uint32_t n;
+} GKDBSketch;
+
+/* Tables being restored, handed out one at a time to the threads */
+typedef struct GKDBTasks_ {
+  const GKDB *db;
+  const GKHashMetric *mtrcs;
+  int n;
+  int next;
+  pthread_mutex_t mutex;
+} GKDBTasks;
+
+typedef struct GKDBWriter_ {
+  FILE *fp;
+  uint64_t off;                 /* as laid out uncompressed */
+  uint64_t foff;                /* within the file */
+  GKDBSum sum;
+  int err;
+#ifdef HAVE_LIBZ
+  z_stream zs;
+  int deflating;                /* within a compressed block */
+#endif
+} GKDBWriter;
+
+/* Databases currently mapped */
+static GKDB *gkdb_list = NULL;
+
+/* Get the kind of keys of the given table type. Tables that are not
+ * persisted have no kind. */
+static GKDBKind
+key_kind (GSMetricType type) {
+  switch (type) {
+  case MTRC_TYPE_II32:
+  case MTRC_TYPE_IS32:
+  case MTRC_TYPE_IU64:
+  case MTRC_TYPE_IGSL:
+  case MTRC_TYPE_IHLL:
+  case MTRC_TYPE_IHST:
+    return KIND_U32;
+  case MTRC_TYPE_SI32:
+  case MTRC_TYPE_SU64:
+    return KIND_STR;
+  case MTRC_TYPE_U648:
+    return KIND_U64;
+  default:
+    return KIND_NONE;
+  }
+}
+
+/* Get the kind of values of the given table type. */
+static GKDBKind
+val_kind (GSMetricType type) {
+  switch (type) {
+  case MTRC_TYPE_II32:
+  case MTRC_TYPE_SI32:
+    return KIND_U32;
+  case MTRC_TYPE_IU64:
+  case MTRC_TYPE_SU64:
+    return KIND_U64;
+  case MTRC_TYPE_IS32:
+    return KIND_STR;
+  case MTRC_TYPE_IGSL:
+    return KIND_GSL;
+  case MTRC_TYPE_IHLL:
+    return KIND_HLL;
+  case MTRC_TYPE_IHST:
+    return KIND_HIST;
+  case MTRC_TYPE_U648:
+    return KIND_U8;
+  default:
+    return KIND_NONE;
+  }
+}
+
+/* Get the size of an array element of the given kind as stored on
+ * disk. Strings and lists are stored as 64-bit offsets. */
+static size_t
+kind_size (GKDBKind kind) {
+  switch (kind) {
+  case KIND_U8:
+    return sizeof (uint8_t);
+  case KIND_U32:
+    return sizeof (uint32_t);
+  default:
+    return sizeof (uint64_t);
+  }
+}
+
+/* Get the table view shared by all khash types. */
+static GKDBHash *
+get_hash (GKHashMetric mtrc) {
+  return (GKDBHash *) (void *) mtrc.ii32;
+}
+
+/* Determine if the bucket at `i` holds a key. */
+static int
+bucket_used (const khint32_t * flags, khint_t i) {
+  return !((flags[i >> 4] >> ((i & 0xfU) << 1)) & 3);
+}
+
+static void
+sum_word (GKDBSum * s, uint64_t w) {
+  s->hash = (s->hash ^ w) * GKDB_PRIME;
+  s->hash ^= s->hash >> 29;
+}
+
+static void
+sum_init (GKDBSum * s) {
+  memset (s, 0, sizeof (GKDBSum));
+  s->hash = 0xcbf29ce484222325ULL;
+}
+
+/* Feed the given bytes to the running checksum. */
+static void
+sum_update (GKDBSum * s, const void *buf, size_t len) {
+  const unsigned char *p = buf;
+  uint64_t w;
+
+  s->len += len;
+  while (s->ntail && len) {
+    s->tail[s->ntail++] = *p++;
+    len--;
+    if (s->ntail == 8) {
+      memcpy (&w, s->tail, 8);
+      sum_word (s, w);
+      s->ntail = 0;
+    }
+  }
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy (&w, p, 8);
+    sum_word (s, w);
+  }
+  if (len) {
+    memcpy (s->tail, p, len);
+    s->ntail = (int) len;
+  }
+}
+
+static uint64_t
+sum_final (GKDBSum * s) {
+  uint64_t w = 0;
+
+  memcpy (&w, s->tail, s->ntail);
+  sum_word (s, w);
+  sum_word (s, s->len);
+
+  return s->hash;
+}
+
+/* Checksum a contiguous block of memory. */
+static uint64_t
+sum_block (const void *buf, size_t len) {
+  GKDBSum s;
+
+  sum_init (&s);
+  sum_update (&s, buf, len);
+
+  return sum_final (&s);
+}
+
+/* Write the given bytes out to the file as they are. */
+static void
+db_out (GKDBWriter * w, const void *buf, size_t len) {
+  if (len == 0 || w->err)
+    return;
+
+  if (fwrite (buf, 1, len, w->fp) != len)
+    w->err = errno ? errno : EIO;
+  w->foff += len;
+}
+
+#ifdef HAVE_LIBZ
+/* Feed the given bytes to the block being compressed, writing out the
+ * compressed output as it comes. */
+static void
+db_deflate (GKDBWriter * w, const void *buf, size_t len, int flush) {
+  unsigned char out[GKDB_CHUNK];
+  const unsigned char *p = buf;
+  uInt n;
+
+  do {
+    n = len > UINT_MAX ? UINT_MAX : (uInt) len;
+    w->zs.next_in = (Bytef *) p;
+    w->zs.avail_in = n;
+    p += n;
+    len -= n;
+
+    do {
+      w->zs.next_out = out;
+      w->zs.avail_out = sizeof (out);
+      if (deflate (&w->zs, len ? Z_NO_FLUSH : flush) == Z_STREAM_ERROR) {
+        w->err = EIO;
+        return;
+      }
+      db_out (w, out, sizeof (out) - w->zs.avail_out);
+    } while (w->zs.avail_out == 0);
+  } while (len);
+}
+#endif
+
+/* Write the given bytes, through the codec of the current block. */
+static void
+db_write (GKDBWriter * w, const void *buf, size_t len) {
+  if (len == 0 || w->err)
+    return;
+
+  sum_update (&w->sum, buf, len);
+  w->off += len;
+#ifdef HAVE_LIBZ
+  if (w->deflating) {
+    db_deflate (w, buf, len, Z_NO_FLUSH);
+    return;
+  }
+#endif
+  db_out (w, buf, len);
+}
+
+/* Start storing a table with the codec given through
+ * --db-compression, if any. */
+static void
+begin_block (GKDBWriter * w, GKDBTable * t) {
+  t->zoff = w->foff;
+  t->codec = GKDB_CODEC_NONE;
+
+#ifdef HAVE_LIBZ
+  if (conf.db_codec != GKDB_CODEC_ZLIB || t->n_buckets == 0)
+    return;
+
+  memset (&w->zs, 0, sizeof (z_stream));
+  if (deflateInit (&w->zs, conf.db_compression_level ?
+                   conf.db_compression_level : Z_DEFAULT_COMPRESSION) != Z_OK)
+    return;
+  w->deflating = 1;
+  t->codec = GKDB_CODEC_ZLIB;
+#endif
+}
+
+/* Finish storing a table, flushing its compressed block out. */
+static void
+end_block (GKDBWriter * w, GKDBTable * t) {
+#ifdef HAVE_LIBZ
+  if (w->deflating) {
+    db_deflate (w, NULL, 0, Z_FINISH);
+    deflateEnd (&w->zs);
+    w->deflating = 0;
+  }
+#endif
+  t->zlen = w->foff - t->zoff;
+}
+
+/* Pad the output to the next 8-byte boundary. */
+static void
+db_align (GKDBWriter * w) {
+  static const char zero[8] = { 0 };
+
+  if (w->off % 8)
+    db_write (w, zero, 8 - (w->off % 8));
+}
+
+/* Assign each string in the given keys or values array its offset
+ * within the table's pool, in bucket order.
+ *
+ * The array of offsets is returned. */
+static uint64_t *
+str_offsets (const GKDBHash * h, char **strs, uint64_t * pool_len) {
+  uint64_t *offs = xcalloc (h->n_buckets, sizeof (uint64_t));
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (!bucket_used (h->flags, i))
+      continue;
+    if (strs[i] == NULL) {
+      offs[i] = GKDB_NONE;
+      continue;
+    }
+    offs[i] = *pool_len;
+    *pool_len += strlen (strs[i]) + 1;
+  }
+
+  return offs;
+}
+
+/* Assign each list its offset within the table's pool, in bucket
+ * order. A list is stored as its number of items followed by them.
+ *
+ * The array of offsets is returned. */
+static uint64_t *
+gsl_offsets (const GKDBHash * h, uint64_t * pool_len) {
+  GSLList **lists = h->vals, *node;
+  uint64_t *offs = xcalloc (h->n_buckets, sizeof (uint64_t));
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (!bucket_used (h->flags, i))
+      continue;
+    offs[i] = *pool_len;
+    *pool_len += sizeof (uint32_t);
+    for (node = lists[i]; node; node = node->next)
+      *pool_len += sizeof (uint32_t);
+  }
+
+  return offs;
+}
+
+/* Get the size of the registers, or sparse entries, of a sketch. */
+static size_t
+sketch_len (uint8_t precision, uint8_t dense, uint32_t n) {
+  return dense ? (size_t) 1 << precision : n * sizeof (uint32_t);
+}
+
+/* Assign each sketch its offset within the table's pool, in bucket
+ * order.
+ *
+ * The array of offsets is returned. */
+static uint64_t *
+hll_offsets (const GKDBHash * h, uint64_t * pool_len) {
+  GHLL **hlls = h->vals;
+  uint64_t *offs = xcalloc (h->n_buckets, sizeof (uint64_t));
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (!bucket_used (h->flags, i))
+      continue;
+    offs[i] = *pool_len;
+    *pool_len += sizeof (GKDBSketch) +
+      sketch_len (hlls[i]->precision, hlls[i]->dense, hlls[i]->n);
+  }
+
+  return offs;
+}
+
+static void
+write_hll (GKDBWriter * w, const GKDBHash * h) {
+  GHLL **hlls = h->vals;
+  GKDBSketch s;
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (!bucket_used (h->flags, i))
+      continue;
+    memset (&s, 0, sizeof (GKDBSketch));
+    s.precision = hlls[i]->precision;
+    s.dense = hlls[i]->dense;
+    s.n = hlls[i]->n;
+    db_write (w, &s, sizeof (GKDBSketch));
+    db_write (w, s.dense ? (void *) hlls[i]->regs : (void *) hlls[i]->sparse,
+              sketch_len (s.precision, s.dense, s.n));
+  }
+}
+
+/* Assign each histogram its offset within the table's pool, in bucket
+ * order. A histogram is stored as its number of buckets hit, followed
+ * by them.
+ *
+ * The array of offsets is returned. */
+static uint64_t *
+hist_offsets (const GKDBHash * h, uint64_t * pool_len) {
+  GHist **hists = h->vals;
+  uint64_t *offs = xcalloc (h->n_buckets, sizeof (uint64_t));
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (!bucket_used (h->flags, i))
+      continue;
+    offs[i] = *pool_len;
+    *pool_len += sizeof (uint32_t) + hists[i]->n * sizeof (GHistBin);
+  }
+
+  return offs;
+}
+
+static void
+write_hist (GKDBWriter * w, const GKDBHash * h) {
+  GHist **hists = h->vals;
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (!bucket_used (h->flags, i))
+      continue;
+    db_write (w, &hists[i]->n, sizeof (uint32_t));
+    db_write (w, hists[i]->bins, hists[i]->n * sizeof (GHistBin));
+  }
+}
+
+static void
+write_strs (GKDBWriter * w, const GKDBHash * h, char **strs) {
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (bucket_used (h->flags, i) && strs[i] != NULL)
+      db_write (w, strs[i], strlen (strs[i]) + 1);
+  }
+}
+
+static void
+write_gsl (GKDBWriter * w, const GKDBHash * h) {
+  GSLList **lists = h->vals, *node;
+  uint32_t count;
+  khint_t i;
+
+  for (i = 0; i < h->n_buckets; ++i) {
+    if (!bucket_used (h->flags, i))
+      continue;
+    count = 0;
+    for (node = lists[i]; node; node = node->next)
+      count++;
+    db_write (w, &count, sizeof (count));
+    for (node = lists[i]; node; node = node->next)
+      db_write (w, node->data, sizeof (uint32_t));
+  }
+}
+
+/* Write the keys or values array of a table. */
+static void
+write_array (GKDBWriter * w, const GKDBHash * h, void *arr, GKDBKind kind,
+             const uint64_t * offs) {
+  if (offs != NULL)
+    db_write (w, offs, h->n_buckets * sizeof (uint64_t));
+  else
+    db_write (w, arr, h->n_buckets * kind_size (kind));
+  db_align (w);
+}
+
+/* Write a single table and fill in its directory entry.
+ *
+ * If the table is not persisted, 1 is returned.
+ * On success, 0 is returned. */
+static int
+write_table (GKDBWriter * w, GKHashMetric mtrc, GKDBTable * t) {
+  GKDBHash *h = get_hash (mtrc);
+  GKDBKind kk = key_kind (mtrc.type), vk = val_kind (mtrc.type);
+  uint64_t *koffs = NULL, *voffs = NULL, pool_len = 0;
+
+  if (h == NULL || kk == KIND_NONE || mtrc.filename == NULL ||
+      strlen (mtrc.filename) >= GKDB_NAME_LEN)
+    return 1;
+
+  memset (t, 0, sizeof (GKDBTable));
+  strcpy (t->name, mtrc.filename);
+  t->type = mtrc.type;
+  t->n_buckets = h->n_buckets;
+  t->size = h->size;
+  t->n_occupied = h->n_occupied;
+  t->upper_bound = h->upper_bound;
+
+  sum_init (&w->sum);
+  t->off = w->off;
+  begin_block (w, t);
+  if (h->n_buckets) {
+    if (kk == KIND_STR)
+      koffs = str_offsets (h, h->keys, &pool_len);
+    if (vk == KIND_STR)
+      voffs = str_offsets (h, h->vals, &pool_len);
+    else if (vk == KIND_GSL)
+      voffs = gsl_offsets (h, &pool_len);
+    else if (vk == KIND_HLL)
+      voffs = hll_offsets (h, &pool_len);
+    else if (vk == KIND_HIST)
+      voffs = hist_offsets (h, &pool_len);
+
+    t->flags_off = w->off;
+    db_write (w, h->flags, __ac_fsize (h->n_buckets) * sizeof (khint32_t));
+    db_align (w);
+
+    t->keys_off = w->off;
+    write_array (w, h, h->keys, kk, koffs);
+    t->vals_off = w->off;
+    write_array (w, h, h->vals, vk, voffs);
+
+    t->pool_off = w->off;
+    t->pool_len = pool_len;
+    if (kk == KIND_STR)
+      write_strs (w, h, h->keys);
+    if (vk == KIND_STR)
+      write_strs (w, h, h->vals);
+    else if (vk == KIND_GSL)
+      write_gsl (w, h);
+    else if (vk == KIND_HLL)
+      write_hll (w, h);
+    else if (vk == KIND_HIST)
+      write_hist (w, h);
+    db_align (w);
+  }
+  end_block (w, t);
+  t->len = w->off - t->off;
+  t->sum = sum_final (&w->sum);
+
+  free (koffs);
+  free (voffs);
+
+  return 0;
+}
+
+/* Write the given tables into a new database. The file is written
+ * next to the given path and renamed over it once complete, so a
+ * crash never leaves a truncated database behind.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+int
+gkdb_persist (const char *fn, const GKHashMetric * mtrcs, int n,
+              uint64_t lsn) {
+  GKDBWriter w;
+  GKDBHeader hdr;
+  GKDBTable *dir;
+  char *tmp = NULL;
+  int i, nt = 0;
+
+  tmp = xmalloc (strlen (fn) + 5);
+  sprintf (tmp, "%s.tmp", fn);
+
+  memset (&w, 0, sizeof (GKDBWriter));
+  if ((w.fp = fopen (tmp, "wb")) == NULL) {
+    LOG_DEBUG (("Unable to create %s: %s\n", tmp, strerror (errno)));
+    free (tmp);
+    return 1;
+  }
+
+  /* header is rewritten once the directory is known */
+  memset (&hdr, 0, sizeof (GKDBHeader));
+  db_write (&w, &hdr, sizeof (GKDBHeader));
+
+  dir = xcalloc (n > 0 ? n : 1, sizeof (GKDBTable));
+  for (i = 0; i < n; ++i) {
+    if (write_table (&w, mtrcs[i], &dir[nt]) == 0)
+      nt++;
+  }
+
+  memcpy (hdr.magic, GKDB_MAGIC, sizeof (hdr.magic));
+  hdr.version = GKDB_VERSION;
+  hdr.byteorder = GKDB_BYTEORDER;
+  hdr.ntables = nt;
+  hdr.lsn = lsn;
+  hdr.dir_off = w.foff;
+  hdr.dir_sum = sum_block (dir, nt * sizeof (GKDBTable));
+  db_write (&w, dir, nt * sizeof (GKDBTable));
+  free (dir);
+
+  if (!w.err && (fseek (w.fp, 0, SEEK_SET) != 0 ||
+                 fwrite (&hdr, sizeof (GKDBHeader), 1, w.fp) != 1))
+    w.err = errno ? errno : EIO;
+  if (!w.err && (fflush (w.fp) != 0 || fsync (fileno (w.fp)) != 0))
+    w.err = errno ? errno : EIO;
+  if (fclose (w.fp) != 0 && !w.err)
+    w.err = errno ? errno : EIO;
+
+  if (!w.err && rename (tmp, fn) != 0)
+    w.err = errno ? errno : EIO;
+  if (w.err) {
+    LOG_DEBUG (("Unable to write %s: %s\n", fn, strerror (w.err)));
+    unlink (tmp);
+  }
+  free (tmp);
+
+  return w.err ? 1 : 0;
+}
+
+/* Determine if the given pointer lives within a mapped database, i.e.,
+ * it is a restored string that must not be freed. */
+int
+gkdb_owns (const void *ptr) {
+  const char *p = ptr;
+  const GKDB *db;
+
+  for (db = gkdb_list; db != NULL; db = db->next) {
+    if (p >= db->map && p < db->map + db->size)
+      return 1;
+    if (db->arena && p >= db->arena && p < db->arena + db->arena_size)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Read the directory of the given database. Entries written before
+ * tables could be compressed are a prefix of the current ones. */
+static GKDBTable *
+read_dir (const char *map, const GKDBHeader * hdr, size_t esize) {
+  GKDBTable *dir = xcalloc (hdr->ntables ? hdr->ntables : 1, sizeof (GKDBTable));
+  uint64_t i;
+
+  for (i = 0; i < hdr->ntables; ++i) {
+    memcpy (&dir[i], map + hdr->dir_off + i * esize, esize);
+    if (hdr->version == GKDB_RAW_VERSION) {
+      dir[i].codec = GKDB_CODEC_NONE;
+      dir[i].zoff = dir[i].off;
+      dir[i].zlen = dir[i].len;
+    }
+  }
+
+  return dir;
+}
+
+/* Reserve the memory compressed tables are inflated into. It mirrors
+ * the uncompressed layout of the file, so pages are only committed
+ * as each table is restored. */
+static void
+map_arena (GKDB * db, const char *fn) {
+  uint64_t i, end = 0;
+  void *arena;
+
+  for (i = 0; i < db->ntables; ++i) {
+    if (db->dir[i].codec == GKDB_CODEC_NONE)
+      continue;
+    if (db->dir[i].len > UINT64_MAX - db->dir[i].off ||
+        db->dir[i].off + db->dir[i].len > SIZE_MAX)
+      FATAL ("Corrupted database file %s.", fn);
+    if (db->dir[i].off + db->dir[i].len > end)
+      end = db->dir[i].off + db->dir[i].len;
+  }
+  if (end == 0)
+    return;
+
+  arena = mmap (NULL, end, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (arena == MAP_FAILED)
+    FATAL ("Unable to map database file %s: %s", fn, strerror (errno));
+  db->arena = arena;
+  db->arena_size = end;
+}
+
+/* Map the given database and validate its header and directory.
+ *
+ * If the database cannot be opened, e.g., it does not exist, NULL is
+ * returned and errno is set by open(2).
+ * On success, the open database is returned. */
+GKDB *
+gkdb_open (const char *fn) {
+  GKDB *db = NULL;
+  GKDBHeader hdr;
+  struct stat st;
+  void *map;
+  size_t size, esize;
+  int fd, err;
+
+  if ((fd = open (fn, O_RDONLY)) == -1) {
+    err = errno;
+    LOG_DEBUG (("Unable to open %s: %s\n", fn, strerror (err)));
+    /* left for the caller to report, logging may clobber it */
+    errno = err;
+    return NULL;
+  }
+  if (fstat (fd, &st) == -1 || (size_t) st.st_size < sizeof (GKDBHeader)) {
+    close (fd);
+    FATAL ("Invalid database file %s.", fn);
+  }
+
+  size = st.st_size;
+  map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    FATAL ("Unable to map database file %s: %s", fn, strerror (errno));
+  posix_madvise (map, size, POSIX_MADV_WILLNEED);
+
+  memcpy (&hdr, map, sizeof (GKDBHeader));
+  if (memcmp (hdr.magic, GKDB_MAGIC, sizeof (hdr.magic)) != 0)
+    FATAL ("Invalid database file %s.", fn);
+  if (hdr.version < GKDB_RAW_VERSION || hdr.version > GKDB_VERSION ||
+      hdr.byteorder != GKDB_BYTEORDER)
+    FATAL ("Unsupported database version or byte order in %s.", fn);
+
+  esize = hdr.version == GKDB_RAW_VERSION ?
+    offsetof (GKDBTable, zoff) : sizeof (GKDBTable);
+  if (hdr.dir_off > size ||
+      hdr.ntables > (size - hdr.dir_off) / esize ||
+      sum_block ((char *) map + hdr.dir_off,
+                 hdr.ntables * esize) != hdr.dir_sum)
+    FATAL ("Corrupted database file %s.", fn);
+
+  db = xcalloc (1, sizeof (GKDB));
+  db->map = map;
+  db->size = size;
+  db->ntables = hdr.ntables;
+  db->lsn = hdr.lsn;
+  db->dir = read_dir (db->map, &hdr, esize);
+  map_arena (db, fn);
+
+  db->next = gkdb_list;
+  gkdb_list = db;
+
+  return db;
+}
+
+/* Inflate a compressed table into its place within the arena.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+inflate_table (const GKDB * db, const GKDBTable * t) {
+#ifdef HAVE_LIBZ
+  z_stream zs;
+  uint64_t in = t->zlen, out = t->len;
+  uInt n;
+  int ret = Z_OK;
+
+  memset (&zs, 0, sizeof (z_stream));
+  if (inflateInit (&zs) != Z_OK)
+    return 1;
+
+  zs.next_in = (Bytef *) (db->map + t->zoff);
+  zs.next_out = (Bytef *) (db->arena + t->off);
+  while (ret == Z_OK) {
+    /* feed both sides in chunks zlib's counters can hold */
+    if (zs.avail_in == 0 && in) {
+      n = in > UINT_MAX ? UINT_MAX : (uInt) in;
+      zs.avail_in = n;
+      in -= n;
+    }
+    if (zs.avail_out == 0 && out) {
+      n = out > UINT_MAX ? UINT_MAX : (uInt) out;
+      zs.avail_out = n;
+      out -= n;
+    }
+    ret = inflate (&zs, Z_NO_FLUSH);
+    if (ret == Z_BUF_ERROR && (zs.avail_in || in) && (zs.avail_out || out))
+      ret = Z_OK;
+  }
+  inflateEnd (&zs);
+
+  return ret != Z_STREAM_END || zs.avail_out || out;
+#else
+  (void) db;
+  FATAL ("Database table %.*s is compressed. Build with --with-zlib.",
+         GKDB_NAME_LEN, t->name);
+#endif
+}
+
+/* Determine if the section at `off` of `len` bytes lies within the
+ * given table. */
+static int
+in_table (const GKDBTable * t, uint64_t off, uint64_t len) {
+  return off >= t->off && off <= t->off + t->len &&
+    len <= t->off + t->len - off;
+}
+
+/* Validate the bounds and checksum of a directory entry and get the
+ * table's data, inflating it first if it was compressed.
+ *
+ * On error, NULL is returned.
+ * On success, the start of the table's data is returned. */
+static const char *
+table_data (const GKDB * db, const GKDBTable * t) {
+  GKDBKind kk = key_kind (t->type), vk = val_kind (t->type);
+  uint64_t nb = t->n_buckets;
+  const char *sec;
+
+  if (t->zoff > db->size || t->zlen > db->size - t->zoff)
+    return NULL;
+  if (t->len > UINT64_MAX - t->off)
+    return NULL;
+
+  switch (t->codec) {
+  case GKDB_CODEC_NONE:
+    if (t->zlen != t->len)
+      return NULL;
+    sec = db->map + t->zoff;
+    break;
+  case GKDB_CODEC_ZLIB:
+    if (db->arena == NULL || t->off + t->len > db->arena_size ||
+        inflate_table (db, t) != 0)
+      return NULL;
+    sec = db->arena + t->off;
+    break;
+  default:
+    FATAL ("Unsupported codec %u in database table %.*s.", t->codec,
+           GKDB_NAME_LEN, t->name);
+  }
+
+  if (sum_block (sec, t->len) != t->sum)
+    return NULL;
+  if (nb == 0)
+    return sec;
+
+  if ((nb & (nb - 1)) != 0 || t->size > nb)
+    return NULL;
+  if (!in_table (t, t->flags_off, __ac_fsize (nb) * sizeof (khint32_t)) ||
+      !in_table (t, t->keys_off, nb * kind_size (kk)) ||
+      !in_table (t, t->vals_off, nb * kind_size (vk)) ||
+      !in_table (t, t->pool_off, t->pool_len))
+    return NULL;
+
+  /* every string must be terminated within the pool */
+  if ((kk == KIND_STR || vk == KIND_STR) && t->pool_len &&
+      sec[t->pool_off - t->off + t->pool_len - 1] != '\0')
+    return NULL;
+
+  return sec;
+}
+
+/* Find the directory entry of the given table. */
+static const GKDBTable *
+find_table (const GKDB * db, const char *name, GSMetricType type) {
+  uint64_t i;
+
+  for (i = 0; i < db->ntables; ++i) {
+    if (db->dir[i].type == type &&
+        strncmp (db->dir[i].name, name, GKDB_NAME_LEN) == 0)
+      return &db->dir[i];
+  }
+
+  return NULL;
+}
+
+static void
+corrupted (const GKDBTable * t) {
+  FATAL ("Corrupted database table %.*s.", GKDB_NAME_LEN, t->name);
+}
+
+/* Point each string at its place within the table's pool. */
+static char **
+load_strs (const char *sec, const GKDBTable * t, const khint32_t * flags,
+           uint64_t off) {
+  char **strs = xcalloc (t->n_buckets, sizeof (char *));
+  uint64_t o;
+  khint_t i;
+
+  for (i = 0; i < t->n_buckets; ++i) {
+    if (!bucket_used (flags, i))
+      continue;
+    memcpy (&o, sec + (off - t->off) + (uint64_t) i * sizeof (uint64_t),
+            sizeof (o));
+    if (o == GKDB_NONE)
+      continue;
+    if (o >= t->pool_len)
+      corrupted (t);
+    strs[i] = (char *) sec + (t->pool_off - t->off) + o;
+  }
+
+  return strs;
+}
+
+/* Rebuild each list from its items in the pool. */
+static GSLList **
+load_gsl (const char *sec, const GKDBTable * t, const khint32_t * flags,
+          uint64_t off) {
+  GSLList **lists = xcalloc (t->n_buckets, sizeof (GSLList *)), *tail = NULL;
+  const char *item;
+  uint64_t o;
+  uint32_t count, j, val;
+  khint_t i;
+
+  for (i = 0; i < t->n_buckets; ++i) {
+    if (!bucket_used (flags, i))
+      continue;
+    memcpy (&o, sec + (off - t->off) + (uint64_t) i * sizeof (uint64_t),
+            sizeof (o));
+    if (o > t->pool_len || t->pool_len - o < sizeof (uint32_t))
+      corrupted (t);
+
+    item = sec + (t->pool_off - t->off) + o;
+    memcpy (&count, item, sizeof (count));
+    if (count > (t->pool_len - o) / sizeof (uint32_t) - 1)
+      corrupted (t);
+
+    for (j = 0; j < count; ++j) {
+      item += sizeof (uint32_t);
+      memcpy (&val, item, sizeof (val));
+      if (j == 0)
+        tail = lists[i] = list_create (i322ptr (val));
+      else
+        tail = list_insert_append (tail, i322ptr (val));
+    }
+  }
+
+  return lists;
+}
+
+/* Rebuild each sketch from the pool. Sketches keep changing once
+ * restored, hence they are copied out of it. */
+static GHLL **
+load_hll (const char *sec, const GKDBTable * t, const khint32_t * flags,
+          uint64_t off) {
+  GHLL **hlls = xcalloc (t->n_buckets, sizeof (GHLL *));
+  GKDBSketch s;
+  const char *item;
+  uint64_t o;
+  khint_t i;
+
+  for (i = 0; i < t->n_buckets; ++i) {
+    if (!bucket_used (flags, i))
+      continue;
+    memcpy (&o, sec + (off - t->off) + (uint64_t) i * sizeof (uint64_t),
+            sizeof (o));
+    if (o > t->pool_len || t->pool_len - o < sizeof (GKDBSketch))
+      corrupted (t);
+
+    item = sec + (t->pool_off - t->off) + o;
+    memcpy (&s, item, sizeof (GKDBSketch));
+    if (s.precision > HLL_MAX_PRECISION ||
+        sketch_len (s.precision, s.dense, s.n) >
+        t->pool_len - o - sizeof (GKDBSketch))
+      corrupted (t);
+
+    hlls[i] = hll_load (s.precision, s.dense, s.n, item + sizeof (GKDBSketch));
+    if (hlls[i] == NULL)
+      corrupted (t);
+  }
+
+  return hlls;
+}
+
+/* Rebuild each histogram from the pool, copying it out as sketches
+ * are. */
+static GHist **
+load_hist (const char *sec, const GKDBTable * t, const khint32_t * flags,
+           uint64_t off) {
+  GHist **hists = xcalloc (t->n_buckets, sizeof (GHist *));
+  const char *item;
+  uint64_t o;
+  uint32_t n;
+  khint_t i;
+
+  for (i = 0; i < t->n_buckets; ++i) {
+    if (!bucket_used (flags, i))
+      continue;
+    memcpy (&o, sec + (off - t->off) + (uint64_t) i * sizeof (uint64_t),
+            sizeof (o));
+    if (o > t->pool_len || t->pool_len - o < sizeof (uint32_t))
+      corrupted (t);
+
+    item = sec + (t->pool_off - t->off) + o;
+    memcpy (&n, item, sizeof (n));
+    if ((uint64_t) n * sizeof (GHistBin) >
+        t->pool_len - o - sizeof (uint32_t))
+      corrupted (t);
+
+    hists[i] = hist_load (n, item + sizeof (uint32_t));
+    if (hists[i] == NULL)
+      corrupted (t);
+  }
+
+  return hists;
+}
+
+/* Load the keys or values array of a table. */
+static void *
+load_array (const char *sec, const GKDBTable * t, const khint32_t * flags,
+            uint64_t off, GKDBKind kind) {
+  void *arr;
+
+  if (kind == KIND_STR)
+    return load_strs (sec, t, flags, off);
+  if (kind == KIND_GSL)
+    return load_gsl (sec, t, flags, off);
+  if (kind == KIND_HLL)
+    return load_hll (sec, t, flags, off);
+  if (kind == KIND_HIST)
+    return load_hist (sec, t, flags, off);
+
+  arr = xmalloc (t->n_buckets * kind_size (kind));
+  memcpy (arr, sec + (off - t->off), t->n_buckets * kind_size (kind));
+
+  return arr;
+}
+
+/* Restore the given, empty, table from an open database. Buckets are
+ * copied as they were laid out, so no key is rehashed.
+ *
+ * If the table is not found, 1 is returned.
+ * On success, 0 is returned. */
+int
+gkdb_restore (const GKDB * db, GKHashMetric mtrc) {
+  GKDBHash *h = get_hash (mtrc);
+  const GKDBTable *t;
+  const char *sec;
+  size_t fsize;
+
+  if (db == NULL || h == NULL || key_kind (mtrc.type) == KIND_NONE)
+    return 1;
+  if ((t = find_table (db, mtrc.filename, mtrc.type)) == NULL)
+    return 1;
+  /* a table restored already keeps pointing into the arena */
+  if (h->size != 0)
+    return 1;
+  if ((sec = table_data (db, t)) == NULL)
+    corrupted (t);
+
+  free (h->flags);
+  free (h->keys);
+  free (h->vals);
+  h->flags = NULL;
+  h->keys = h->vals = NULL;
+
+  h->n_buckets = t->n_buckets;
+  h->size = t->size;
+  h->n_occupied = t->n_occupied;
+  h->upper_bound = t->upper_bound;
+  if (t->n_buckets == 0)
+    return 0;
+
+  fsize = __ac_fsize (t->n_buckets) * sizeof (khint32_t);
+  h->flags = xmalloc (fsize);
+  memcpy (h->flags, sec + (t->flags_off - t->off), fsize);
+  h->keys = load_array (sec, t, h->flags, t->keys_off, key_kind (mtrc.type));
+  h->vals = load_array (sec, t, h->flags, t->vals_off, val_kind (mtrc.type));
+
+  return 0;
+}
+
+static void *
+restore_worker (void *ptr_data) {
+  GKDBTasks *tasks = ptr_data;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock (&tasks->mutex);
+    i = tasks->next++;
+    pthread_mutex_unlock (&tasks->mutex);
+
+    if (i >= tasks->n)
+      break;
+    gkdb_restore (tasks->db, tasks->mtrcs[i]);
+  }
+
+  return NULL;
+}
+
+/* Restore the given tables from an open database, one task per table,
+ * spread across up to GKDB_RESTORE_THREADS threads. The calling thread
+ * takes part in restoring them. */
+void
+gkdb_restore_tables (const GKDB * db, const GKHashMetric * mtrcs, int n) {
+  pthread_t threads[GKDB_RESTORE_THREADS - 1];
+  GKDBTasks tasks;
+  long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+  int i, nthreads = 0;
+
+  memset (&tasks, 0, sizeof (GKDBTasks));
+  tasks.db = db;
+  tasks.mtrcs = mtrcs;
+  tasks.n = n;
+  pthread_mutex_init (&tasks.mutex, NULL);
+
+  for (i = 1; i < GKDB_RESTORE_THREADS && i < ncpu && i < n; ++i) {
+    if (pthread_create (&threads[nthreads], NULL, restore_worker, &tasks) != 0)
+      break;
+    nthreads++;
+  }
+  restore_worker (&tasks);
+
+  for (i = 0; i < nthreads; ++i)
+    pthread_join (threads[i], NULL);
+  pthread_mutex_destroy (&tasks.mutex);
+}
+
+/* Get the last write-ahead log batch held by an open database. */
+uint64_t
+gkdb_lsn (const GKDB * db) {
+  return db ? db->lsn : 0;
+}
+
+/* Unmap the given database. Strings restored from it are no longer
+ * valid. */
+void
+gkdb_close (GKDB * db) {
+  GKDB **p;
+
+  if (db == NULL)
+    return;
+
+  for (p = &gkdb_list; *p != NULL; p = &(*p)->next) {
+    if (*p == db) {
+      *p = db->next;
+      break;
+    }
+  }
+
+  munmap (db->map, db->size);
+  if (db->arena)
+    munmap (db->arena, db->arena_size);
+  free (db->dir);
+  free (db);
+}
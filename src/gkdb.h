@@ -0,0 +1,134 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef GKDB_H_INCLUDED
+#define GKDB_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gkhash.h"
+
+#define GKDB_FILENAME  "goaccess.db"
+#define GKDB_MAGIC     "GOACCDB"
+#define GKDB_VERSION   4
+#define GKDB_RAW_VERSION 3      /* oldest version read, all tables raw */
+#define GKDB_BYTEORDER 0x01020304U
+#define GKDB_NAME_LEN  64
+
+#define GKDB_RESTORE_THREADS 8 /* max threads restoring tables */
+#define GKDB_CHUNK      (64 * 1024)     /* bytes deflated at a time */
+
+/* Codecs a table can be stored with */
+typedef enum GKDBCodec_ {
+  GKDB_CODEC_NONE,
+  GKDB_CODEC_ZLIB,
+} GKDBCodec;
+
+/* The database is a single file holding every persisted hash table.
+ * Each table is stored the way khash lays it out in memory, i.e., its
+ * bucket flags, keys and values arrays, so it can be restored without
+ * rehashing. Strings are stored in a per-table pool and referenced by
+ * offset, and are used in place from the mapped file once restored.
+ * Lists, sketches and histograms are stored in the pool too, and
+ * rebuilt from it.
+ * All sections are 8-byte aligned.
+ *
+ * A table may be stored compressed as a single block. Its offsets then
+ * refer to the table as laid out uncompressed, and it is decompressed
+ * into a memory area mirroring that layout once restored.
+ *
+ * header | table 1 | ... | table N | directory */
+typedef struct GKDBHeader_ {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;           /* GKDB_BYTEORDER as written */
+  uint64_t ntables;
+  uint64_t dir_off;             /* offset of the table directory */
+  uint64_t dir_sum;             /* checksum of the table directory */
+  uint64_t lsn;                 /* last write-ahead log batch it holds */
+} GKDBHeader;
+
+/* A directory entry. Offsets are from the start of the file, as if
+ * every table was stored uncompressed. The table itself is stored at
+ * `zoff`. */
+typedef struct GKDBTable_ {
+  char name[GKDB_NAME_LEN];     /* e.g., II32_HITS_REQUESTS.db */
+  uint32_t type;                /* GSMetricType */
+  uint32_t n_buckets;
+  uint32_t size;
+  uint32_t n_occupied;
+  uint32_t upper_bound;
+  uint32_t codec;               /* GKDBCodec it is stored with */
+  uint64_t flags_off;           /* bucket flags */
+  uint64_t keys_off;            /* keys, or offsets into the pool */
+  uint64_t vals_off;            /* values, or offsets into the pool */
+  uint64_t pool_off;            /* strings, or GSLList items */
+  uint64_t pool_len;
+  uint64_t off;                 /* whole table */
+  uint64_t len;
+  uint64_t sum;                 /* checksum of the whole table */
+  uint64_t zoff;                /* block stored in the file */
+  uint64_t zlen;
+} GKDBTable;
+
+/* Running checksum, 8 bytes at a time */
+typedef struct GKDBSum_ {
+  uint64_t hash;
+  uint64_t len;
+  unsigned char tail[8];
+  int ntail;
+} GKDBSum;
+
+/* An open database, mapped read-only */
+typedef struct GKDB_ {
+  char *map;
+  size_t size;
+  char *arena;                  /* compressed tables, once restored */
+  size_t arena_size;
+  GKDBTable *dir;               /* copy of the table directory */
+  uint64_t ntables;
+  uint64_t lsn;
+  struct GKDB_ *next;           /* next database mapped */
+} GKDB;
+
+GKDB *gkdb_open (const char *fn);
+int gkdb_owns (const void *ptr);
+int gkdb_persist (const char *fn, const GKHashMetric * mtrcs, int n,
+                  uint64_t lsn);
+int gkdb_restore (const GKDB * db, GKHashMetric mtrc);
+uint64_t gkdb_lsn (const GKDB * db);
+void gkdb_restore_tables (const GKDB * db, const GKHashMetric * mtrcs, int n);
+void gkdb_close (GKDB * db);
+
+#endif // for #ifndef GKDB_H
@@ -33,17 +33,23 @@
 #endif
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <limits.h>     /* for CHAR_BIT */
 
 #include "gkhash.h"
 
 #include "error.h"
+#include "gkdb.h"
+#include "gwal.h"
 #include "sort.h"
 #include "tpl.h"
 #include "util.h"
@@ -51,6 +57,67 @@
 
 /* Hash tables storage */
 static GKHashStorage *gkh_storage;
+/* On-disk database the storage was restored from */
+static GKDB *gkh_db = NULL;
+/* Guards the lazy restore of a module's tables */
+static pthread_mutex_t restore_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Background snapshots, see --persist-interval */
+static time_t snapshot_time = 0;
+static pid_t snapshot_pid = 0;
+static uint64_t snapshot_lsn = 0;
+static volatile sig_atomic_t snapshot_exited = 0;
+/* Data keys monitored by panels in heavy-hitter mode, see --heavy-hitters */
+static GTopKeys *top_keys[TOTAL_MODULES];
+static int top_keys_paused = 0;
+/* Keys of a capped panel that cannot be evicted as of its last round,
+ * see --max-keys */
+static uint32_t cap_fixed[TOTAL_MODULES];
+
+/* The storage is sharded by module, so that concurrent writers only
+ * contend when they hit the same panel. The last shard guards the tables
+ * used across the whole app. Once shared by several writers, see
+ * share_storage(), shards are locked by the ht_* entry points. Their
+ * locks are recursive, as these call each other, e.g., when folding an
+ * evicted key, and are always taken in this order: modules, in
+ * ascending order, the overall shard, then the key sequences. */
+#define OVERALL_SHARD TOTAL_MODULES
+static pthread_mutex_t shard_locks[TOTAL_MODULES + 1];
+static int shard_writers = 1;
+/* Guards the sequences handing out keys, shared by all shards */
+static pthread_mutex_t seqs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void restore_pending (GModule module);
+static void inc_cnt_overall_key (const char *key, uint32_t val);
+static void cap_keys (GModule module, uint32_t hit);
+static void count_top_key (GModule module, uint32_t key, uint32_t inc);
+static void migrate_uniqmap (GModule module);
+static void note_top_key (GModule module, khash_t (si32) * hash,
+                          const char *key, uint32_t value);
+
+/* Tables used across the whole app that are persisted, in the order
+ * get_persisted_tables() lays them out, ahead of the modules' */
+typedef enum GKHashOverall_ {
+  OVERALL_UNIQUE_KEYS,
+  OVERALL_AGENT_VALS,
+  OVERALL_AGENT_KEYS,
+  OVERALL_SEQS,
+  OVERALL_CNT_OVERALL,
+  OVERALL_LAST_PARSE,
+  OVERALL_CNT_VALID,
+  OVERALL_CNT_BW,
+  OVERALL_GZ_PARSE,
+  OVERALL_TOTAL,
+} GKHashOverall;
+
+/* Panels of a database being merged, handed out one at a time to the
+ * threads */
+typedef struct GKHashMergeTasks_ {
+  const GKHashMetric *mtrcs;
+  khash_t (ii32) * uniqs;
+  khash_t (ii32) * agents;
+  size_t next;
+  pthread_mutex_t mutex;
+} GKHashMergeTasks;
 
 /* *INDENT-OFF* */
 /* Hash tables used across the whole app */
@@ -60,12 +127,29 @@ static khash_t (si32) *ht_agent_keys  = NULL;
 static khash_t (si32) *ht_seqs        = NULL;
 static khash_t (si32) *ht_unique_keys = NULL;
 static khash_t (ss32) *ht_hostnames   = NULL;
+static khash_t (si32) *ht_hostname_ts = NULL; /* IP -> time it was resolved */
 
 /* overall counters */
-static khash_t (si32) *ht_cnt_overall = NULL;
+static khash_t (si32) *ht_cnt_overall = NULL; /* filled in to persist only */
 static khash_t (ii32) *ht_last_parse  = NULL;
 static khash_t (ii32) *ht_cnt_valid   = NULL; /* date key 20200101 -> 10,000 */
 static khash_t (iu64) *ht_cnt_bw      = NULL; /* date key 20200101 -> 45,200 */
+static khash_t (ii32) *ht_gz_parse    = NULL; /* compressed log -> lines parsed */
+
+/* Overall counters bumped for every line. They are plain integers
+ * updated and read with relaxed atomics, so neither the parser nor the
+ * threads reporting progress take a lock or hash a key for them. The
+ * sums of ht_cnt_valid and ht_cnt_bw are kept along. */
+static uint32_t cnt_overall[CNT_OVERALL_TOTAL];
+static uint32_t cnt_valid = 0;
+static uint64_t cnt_bw = 0;
+
+/* Keys of the overall counters within ht_cnt_overall */
+static const char *cnt_overall_keys[CNT_OVERALL_TOTAL] = {
+  [CNT_PROCESSED]   = "total_requests",
+  [CNT_INVALID]     = "failed_requests",
+  [CNT_EXCLUDED_IP] = "excluded_ip",
+};
 
 
 /* String metric types to enumerated modules */
@@ -80,9 +164,66 @@ static GEnum enum_metric_types[] = {
   {"SU64"  , MTRC_TYPE_SU64}  ,
   {"IUI8"  , MTRC_TYPE_IUI8}  ,
   {"U648"  , MTRC_TYPE_U648}  ,
+  {"IHLL"  , MTRC_TYPE_IHLL}  ,
+  {"IHST"  , MTRC_TYPE_IHST}  ,
 };
 /* *INDENT-ON* */
 
+/* Initialize the shard locks, recursive as entry points nest. */
+static void
+init_shard_locks (void) {
+  pthread_mutexattr_t attr;
+  int i;
+
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  for (i = 0; i <= OVERALL_SHARD; i++)
+    pthread_mutex_init (&shard_locks[i], &attr);
+  pthread_mutexattr_destroy (&attr);
+}
+
+/* Destroy the shard locks. */
+static void
+free_shard_locks (void) {
+  int i;
+
+  for (i = 0; i <= OVERALL_SHARD; i++)
+    pthread_mutex_destroy (&shard_locks[i]);
+}
+
+/* Lock the given shard, i.e., a module or OVERALL_SHARD. A single
+ * writer has no one to wait for. */
+static void
+lock_shard (int shard) {
+  if (shard_writers > 1)
+    pthread_mutex_lock (&shard_locks[shard]);
+}
+
+/* Unlock the given shard, i.e., a module or OVERALL_SHARD. */
+static void
+unlock_shard (int shard) {
+  if (shard_writers > 1)
+    pthread_mutex_unlock (&shard_locks[shard]);
+}
+
+/* Lock every shard, for changes spanning the whole storage. */
+static void
+lock_all_shards (void) {
+  int i;
+
+  for (i = 0; i <= OVERALL_SHARD; i++)
+    lock_shard (i);
+}
+
+/* Unlock every shard locked by lock_all_shards(). */
+static void
+unlock_all_shards (void) {
+  int i;
+
+  for (i = OVERALL_SHARD; i >= 0; i--)
+    unlock_shard (i);
+}
+
 static GKHashStorage *
 new_gkhstorage (uint32_t size) {
   GKHashStorage *storage = xcalloc (size, sizeof (GKHashStorage));
@@ -138,6 +279,22 @@ new_u648_ht (void) {
   return h;
 }
 
+/* Initialize a new uint32_t key - GHLL value hash table */
+static
+khash_t (ihll) *
+new_ihll_ht (void) {
+  khash_t (ihll) * h = kh_init (ihll);
+  return h;
+}
+
+/* Initialize a new uint32_t key - GHist value hash table */
+static
+khash_t (ihst) *
+new_ihst_ht (void) {
+  khash_t (ihst) * h = kh_init (ihst);
+  return h;
+}
+
 /* Initialize a new string key - uint32_t value hash table */
 static
 khash_t (si32) *
@@ -178,6 +335,14 @@ new_su64_ht (void) {
   return h;
 }
 
+/* Free a string key or value, unless it lives within the mapped
+ * database it was restored from. */
+static void
+free_str (char *str) {
+  if (!gkdb_owns (str))
+    free (str);
+}
+
 /* Destroys both the hash structure and the keys for a
  * string key - uint32_t value hash */
 static void
@@ -188,7 +353,7 @@ des_si32_free (khash_t (si32) * hash) {
 
   for (k = 0; k < kh_end (hash); ++k) {
     if (kh_exist (hash, k)) {
-      free ((char *) kh_key (hash, k));
+      free_str ((char *) kh_key (hash, k));
     }
   }
 
@@ -204,7 +369,7 @@ des_is32_free (khash_t (is32) * hash) {
 
   for (k = 0; k < kh_end (hash); ++k) {
     if (kh_exist (hash, k)) {
-      free ((char *) kh_value (hash, k));
+      free_str ((char *) kh_value (hash, k));
     }
   }
 
@@ -221,8 +386,8 @@ des_ss32_free (khash_t (ss32) * hash) {
 
   for (k = 0; k < kh_end (hash); ++k) {
     if (kh_exist (hash, k)) {
-      free ((char *) kh_key (hash, k));
-      free ((char *) kh_value (hash, k));
+      free_str ((char *) kh_key (hash, k));
+      free_str ((char *) kh_value (hash, k));
     }
   }
 
@@ -245,6 +410,36 @@ des_u648 (khash_t (u648) * hash) {
   kh_destroy (u648, hash);
 }
 
+/* Destroys both the hash structure and its sketches */
+static void
+des_ihll_free (khash_t (ihll) * hash) {
+  khint_t k;
+  if (!hash)
+    return;
+
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (kh_exist (hash, k))
+      hll_free (kh_value (hash, k));
+  }
+
+  kh_destroy (ihll, hash);
+}
+
+/* Destroys both the hash structure and its histograms */
+static void
+des_ihst_free (khash_t (ihst) * hash) {
+  khint_t k;
+  if (!hash)
+    return;
+
+  for (k = 0; k < kh_end (hash); ++k) {
+    if (kh_exist (hash, k))
+      hist_free (kh_value (hash, k));
+  }
+
+  kh_destroy (ihst, hash);
+}
+
 /* Destroys the hash structure */
 static void
 des_iui8 (khash_t (iui8) * hash) {
@@ -309,7 +504,7 @@ des_su64_free (khash_t (su64) * hash) {
 
   for (k = 0; k < kh_end (hash); ++k) {
     if (kh_exist (hash, k)) {
-      free ((char *) kh_key (hash, k));
+      free_str ((char *) kh_key (hash, k));
     }
   }
 
@@ -345,6 +540,9 @@ init_tables (GModule module) {
     {MTRC_PROTOCOLS , MTRC_TYPE_IS32 , {.is32 = new_is32_ht ()}, NULL} ,
     {MTRC_AGENTS    , MTRC_TYPE_IGSL , {.igsl = new_igsl_ht ()}, NULL} ,
     {MTRC_METADATA  , MTRC_TYPE_SU64 , {.su64 = new_su64_ht ()}, NULL} ,
+    {MTRC_UNIQHLL   , MTRC_TYPE_IHLL , {.ihll = new_ihll_ht ()}, NULL} ,
+    {MTRC_MISSED    , MTRC_TYPE_II32 , {.ii32 = new_ii32_ht ()}, NULL} ,
+    {MTRC_LATENCY   , MTRC_TYPE_IHST , {.ihst = new_ihst_ht ()}, NULL} ,
   };
   /* *INDENT-ON* */
 
@@ -388,6 +586,12 @@ free_metric_type (GKHashMetric mtrc) {
   case MTRC_TYPE_SU64:
     des_su64_free (mtrc.su64);
     break;
+  case MTRC_TYPE_IHLL:
+    des_ihll_free (mtrc.ihll);
+    break;
+  case MTRC_TYPE_IHST:
+    des_ihst_free (mtrc.ihst);
+    break;
   }
 }
 
@@ -403,6 +607,16 @@ free_metrics (GModule module) {
   }
 }
 
+/* Determine if the tables of a module are still to be restored. It's
+ * first checked without the restore lock, so it's read atomically,
+ * along with the tables restore_pending() filled in before clearing it.
+ *
+ * If restored already, 0 is returned. */
+static int
+is_pending (GModule module) {
+  return __atomic_load_n (&gkh_storage[module].pending, __ATOMIC_ACQUIRE);
+}
+
 /* Given a module and a metric, get the hash table
  *
  * On error, or if table is not found, NULL is returned.
@@ -413,6 +627,9 @@ get_hash (GModule module, GSMetric metric) {
   int i;
   GKHashMetric mtrc;
 
+  if (is_pending (module))
+    restore_pending (module);
+
   for (i = 0; i < GSMTRC_TOTAL; i++) {
     if (hash != NULL)
       break;
@@ -453,6 +670,12 @@ get_hash (GModule module, GSMetric metric) {
     case MTRC_TYPE_SU64:
       hash = mtrc.su64;
       break;
+    case MTRC_TYPE_IHLL:
+      hash = mtrc.ihll;
+      break;
+    case MTRC_TYPE_IHST:
+      hash = mtrc.ihst;
+      break;
     }
   }
 
@@ -877,9 +1100,10 @@ ins_sgsl (khash_t (sgsl) * hash, const char *key, uint32_t value) {
   return 0;
 }
 
-/* Get the on-disk databases path.
+/* Get the path of the given file within the on-disk databases path, or
+ * the databases path itself if no file is given.
  *
- * On success, the databases path string is returned. */
+ * On success, the malloc'd path string is returned. */
 static char *
 set_db_path (const char *fn) {
   struct stat info;
@@ -901,6 +1125,9 @@ set_db_path (const char *fn) {
   else if (!(info.st_mode & S_IFDIR))
     FATAL ("Database path is not a directory.");
 
+  if (fn == NULL)
+    return rpath;
+
   path = xmalloc (snprintf (NULL, 0, "%s/%s", rpath, fn) + 1);
   sprintf (path, "%s/%s", rpath, fn);
   free (rpath);
@@ -945,29 +1172,6 @@ restore_si32 (khash_t (si32) * hash, const char *fn) {
   tpl_free (tn);
 }
 
-static void
-persist_si32 (khash_t (si32) * hash, const char *fn) {
-  tpl_node *tn;
-  khint_t k;
-  const char *key = NULL;
-  char fmt[] = "A(su)";
-  uint32_t val;
-
-  if (!hash || kh_size (hash) == 0)
-    return;
-
-  tn = tpl_map (fmt, &key, &val);
-  for (k = 0; k < kh_end (hash); ++k) {
-    if (!kh_exist (hash, k) || (!(key = kh_key (hash, k))))
-      continue;
-    val = kh_value (hash, k);
-    tpl_pack (tn, 1);
-  }
-
-  tpl_dump (tn, TPL_FILE, fn);
-  tpl_free (tn);
-}
-
 static void
 restore_is32 (khash_t (is32) * hash, const char *fn) {
   tpl_node *tn;
@@ -984,30 +1188,6 @@ restore_is32 (khash_t (is32) * hash, const char *fn) {
   tpl_free (tn);
 }
 
-static void
-persist_is32 (khash_t (is32) * hash, const char *fn) {
-  tpl_node *tn;
-  khint_t k;
-  uint32_t key;
-  char *val = NULL;
-  char fmt[] = "A(us)";
-
-  if (!hash || kh_size (hash) == 0)
-    return;
-
-  tn = tpl_map (fmt, &key, &val);
-  for (k = 0; k < kh_end (hash); ++k) {
-    if (!kh_exist (hash, k))
-      continue;
-    key = kh_key (hash, k);
-    val = kh_value (hash, k);
-    tpl_pack (tn, 1);
-  }
-
-  tpl_dump (tn, TPL_FILE, fn);
-  tpl_free (tn);
-}
-
 static void
 restore_ii32 (khash_t (ii32) * hash, const char *fn) {
   tpl_node *tn;
@@ -1037,29 +1217,6 @@ restore_u648 (khash_t (u648) * hash, const char *fn) {
   tpl_free (tn);
 }
 
-static void
-persist_ii32 (khash_t (ii32) * hash, const char *fn) {
-  tpl_node *tn;
-  khint_t k;
-  uint32_t key, val;
-  char fmt[] = "A(uu)";
-
-  if (!hash || kh_size (hash) == 0)
-    return;
-
-  tn = tpl_map (fmt, &key, &val);
-  for (k = 0; k < kh_end (hash); ++k) {
-    if (!kh_exist (hash, k))
-      continue;
-    key = kh_key (hash, k);
-    val = kh_value (hash, k);
-    tpl_pack (tn, 1);
-  }
-
-  tpl_dump (tn, TPL_FILE, fn);
-  tpl_free (tn);
-}
-
 static void
 restore_iu64 (khash_t (iu64) * hash, const char *fn) {
   tpl_node *tn;
@@ -1075,54 +1232,6 @@ restore_iu64 (khash_t (iu64) * hash, const char *fn) {
   tpl_free (tn);
 }
 
-static void
-persist_iu64 (khash_t (iu64) * hash, const char *fn) {
-  tpl_node *tn;
-  khint_t k;
-  uint32_t key;
-  uint64_t val;
-  char fmt[] = "A(uU)";
-
-  if (!hash || kh_size (hash) == 0)
-    return;
-
-  tn = tpl_map (fmt, &key, &val);
-  for (k = 0; k < kh_end (hash); ++k) {
-    if (!kh_exist (hash, k))
-      continue;
-    key = kh_key (hash, k);
-    val = kh_value (hash, k);
-    tpl_pack (tn, 1);
-  }
-
-  tpl_dump (tn, TPL_FILE, fn);
-  tpl_free (tn);
-}
-
-static void
-persist_u648 (khash_t (u648) * hash, const char *fn) {
-  tpl_node *tn;
-  khint_t k;
-  uint64_t key;
-  uint16_t val;
-  char fmt[] = "A(Uv)";
-
-  if (!hash || kh_size (hash) == 0)
-    return;
-
-  tn = tpl_map (fmt, &key, &val);
-  for (k = 0; k < kh_end (hash); ++k) {
-    if (!kh_exist (hash, k))
-      continue;
-    key = kh_key (hash, k);
-    val = kh_value (hash, k);
-    tpl_pack (tn, 1);
-  }
-
-  tpl_dump (tn, TPL_FILE, fn);
-  tpl_free (tn);
-}
-
 static void
 restore_su64 (khash_t (su64) * hash, const char *fn) {
   tpl_node *tn;
@@ -1139,29 +1248,6 @@ restore_su64 (khash_t (su64) * hash, const char *fn) {
   tpl_free (tn);
 }
 
-static void
-persist_su64 (khash_t (su64) * hash, const char *fn) {
-  tpl_node *tn;
-  khint_t k;
-  const char *key = NULL;
-  char fmt[] = "A(sU)";
-  uint64_t val;
-
-  if (!hash || kh_size (hash) == 0)
-    return;
-
-  tn = tpl_map (fmt, &key, &val);
-  for (k = 0; k < kh_end (hash); ++k) {
-    if (!kh_exist (hash, k) || !(key = kh_key (hash, k)))
-      continue;
-    val = kh_value (hash, k);
-    tpl_pack (tn, 1);
-  }
-
-  tpl_dump (tn, TPL_FILE, fn);
-  tpl_free (tn);
-}
-
 static void
 restore_igsl (khash_t (igsl) * hash, const char *fn) {
   tpl_node *tn;
@@ -1177,35 +1263,6 @@ restore_igsl (khash_t (igsl) * hash, const char *fn) {
 }
 
 
-static void
-persist_igsl (khash_t (igsl) * hash, const char *fn) {
-  GSLList *node;
-  tpl_node *tn;
-  khint_t k;
-  uint32_t key, val;
-  char fmt[] = "A(uu)";
-
-  if (!hash || kh_size (hash) == 0)
-    return;
-
-  tn = tpl_map (fmt, &key, &val);
-  for (k = 0; k < kh_end (hash); ++k) {
-    if (!kh_exist (hash, k))
-      continue;
-
-    key = kh_key (hash, k);
-    node = kh_value (hash, k);
-    while (node) {
-      val = (*(uint32_t *) node->data);
-      node = node->next;
-    }
-    tpl_pack (tn, 1);
-  }
-
-  tpl_dump (tn, TPL_FILE, fn);
-  tpl_free (tn);
-}
-
 static char *
 check_restore_path (const char *fn) {
   char *path = set_db_path (fn);
@@ -1253,130 +1310,478 @@ clean:
   free (path);
 }
 
-static void
-restore_metric_type (GModule module, GKHashMetric mtrc) {
-  char *fn = NULL;
-
-  fn = get_filename (module, mtrc);
-  restore_by_type (mtrc, fn);
-  free (fn);
-}
-
-static void
-restore_data (void) {
+/* Collect every persisted hash table along with its file name, i.e.,
+ * the overall tables followed, if `modules` is set, by each module's
+ * metrics.
+ *
+ * The number of tables is returned. */
+static int
+get_persisted_tables (GKHashMetric ** out, int modules) {
+  GKHashMetric *mtrcs = NULL;
   GModule module;
-  int i, n = 0;
+  int i, n = 0, noverall = 0;
   size_t idx = 0;
 
   /* *INDENT-OFF* */
-  GKHashMetric metrics[] = {
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_unique_keys }, "SI32_UNIQUE_KEYS.db"} ,
-    {0 , MTRC_TYPE_IS32 , {.is32 = ht_agent_vals  }, "IS32_AGENT_VALS.db"} ,
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_agent_keys  }, "SI32_AGENT_KEYS.db"} ,
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_seqs        }, "SI32_SEQS.db"} ,
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_cnt_overall }, "SI32_CNT_OVERALL.db"} ,
-    {0 , MTRC_TYPE_II32 , {.ii32 = ht_last_parse  }, "II32_LAST_PARSE.db"} ,
-    {0 , MTRC_TYPE_II32 , {.ii32 = ht_cnt_valid   }, "II32_CNT_VALID.db"} ,
-    {0 , MTRC_TYPE_IU64 , {.iu64 = ht_cnt_bw      }, "IU64_CNT_BW.db"} ,
+  GKHashMetric overall[OVERALL_TOTAL] = {
+    [OVERALL_UNIQUE_KEYS] = {0 , MTRC_TYPE_SI32 , {.si32 = ht_unique_keys } , "SI32_UNIQUE_KEYS.db" } ,
+    [OVERALL_AGENT_VALS]  = {0 , MTRC_TYPE_IS32 , {.is32 = ht_agent_vals  } , "IS32_AGENT_VALS.db"  } ,
+    [OVERALL_AGENT_KEYS]  = {0 , MTRC_TYPE_SI32 , {.si32 = ht_agent_keys  } , "SI32_AGENT_KEYS.db"  } ,
+    [OVERALL_SEQS]        = {0 , MTRC_TYPE_SI32 , {.si32 = ht_seqs        } , "SI32_SEQS.db"        } ,
+    [OVERALL_CNT_OVERALL] = {0 , MTRC_TYPE_SI32 , {.si32 = ht_cnt_overall } , "SI32_CNT_OVERALL.db" } ,
+    [OVERALL_LAST_PARSE]  = {0 , MTRC_TYPE_II32 , {.ii32 = ht_last_parse  } , "II32_LAST_PARSE.db"  } ,
+    [OVERALL_CNT_VALID]   = {0 , MTRC_TYPE_II32 , {.ii32 = ht_cnt_valid   } , "II32_CNT_VALID.db"   } ,
+    [OVERALL_CNT_BW]      = {0 , MTRC_TYPE_IU64 , {.iu64 = ht_cnt_bw      } , "IU64_CNT_BW.db"      } ,
+    [OVERALL_GZ_PARSE]    = {0 , MTRC_TYPE_II32 , {.ii32 = ht_gz_parse    } , "II32_GZ_PARSE.db"    } ,
   };
   /* *INDENT-ON* */
 
-  n = ARRAY_SIZE (metrics);
-  for (i = 0; i < n; i++) {
-    restore_by_type (metrics[i], metrics[i].filename);
+  noverall = OVERALL_TOTAL;
+  mtrcs = xcalloc (noverall + TOTAL_MODULES * GSMTRC_TOTAL, sizeof (*mtrcs));
+  for (i = 0; i < noverall; i++) {
+    mtrcs[n] = overall[i];
+    mtrcs[n++].filename = xstrdup (overall[i].filename);
   }
 
   FOREACH_MODULE (idx, module_list) {
     module = module_list[idx];
+    if (!modules)
+      break;
+
+    for (i = 0; i < GSMTRC_TOTAL; i++, n++) {
+      mtrcs[n] = gkh_storage[module].metrics[i];
+      mtrcs[n].filename = get_filename (module, mtrcs[n]);
+    }
+  }
+  *out = mtrcs;
+
+  return n;
+}
+
+static void
+free_persisted_tables (GKHashMetric * mtrcs, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    free ((char *) mtrcs[i].filename);
+  free (mtrcs);
+}
+
+/* Restore the tables of a module whose restore was deferred until
+ * their first use. */
+static void
+restore_pending (GModule module) {
+  GKHashMetric mtrcs[GSMTRC_TOTAL];
+  int i;
 
+  pthread_mutex_lock (&restore_mutex);
+  if (gkh_storage[module].pending) {
     for (i = 0; i < GSMTRC_TOTAL; i++) {
-      restore_metric_type (module, gkh_storage[module].metrics[i]);
+      mtrcs[i] = gkh_storage[module].metrics[i];
+      mtrcs[i].filename = get_filename (module, mtrcs[i]);
     }
+    gkdb_restore_tables (gkh_db, mtrcs, GSMTRC_TOTAL);
+    for (i = 0; i < GSMTRC_TOTAL; i++)
+      free ((char *) mtrcs[i].filename);
+    __atomic_store_n (&gkh_storage[module].pending, 0, __ATOMIC_RELEASE);
   }
+  pthread_mutex_unlock (&restore_mutex);
 }
 
+/* Apply a change read back from the write-ahead log through the same
+ * entry point that made it. */
 static void
-persist_by_type (GKHashMetric mtrc, const char *fn) {
-  char *path = NULL;
-  path = set_db_path (fn);
+replay_change (const GWALRecord * rec) {
+  const char *str = rec->str ? rec->str : "";
 
-  switch (mtrc.type) {
-  case MTRC_TYPE_II32:
-    persist_ii32 (mtrc.ii32, path);
+  switch (rec->op) {
+  case WAL_LAST_PARSE:
+    ht_insert_last_parse (rec->key, rec->val);
     break;
-  case MTRC_TYPE_U648:
-    persist_u648 (mtrc.u648, path);
+  case WAL_GZ_PARSE:
+    ht_insert_gz_parse (rec->key, rec->val);
     break;
-  case MTRC_TYPE_IS32:
-    persist_is32 (mtrc.is32, path);
+  case WAL_DATE:
+    ht_insert_date (rec->key);
     break;
-  case MTRC_TYPE_IU64:
-    persist_iu64 (mtrc.iu64, path);
+  case WAL_CNT_OVERALL:
+    inc_cnt_overall_key (str, rec->val);
     break;
-  case MTRC_TYPE_IGSL:
-    persist_igsl (mtrc.igsl, path);
+  case WAL_CNT_VALID:
+    ht_inc_cnt_valid (rec->key, rec->val);
     break;
-  case MTRC_TYPE_SU64:
-    persist_su64 (mtrc.su64, path);
+  case WAL_CNT_BW:
+    ht_inc_cnt_bw (rec->key, rec->val);
     break;
-  case MTRC_TYPE_SI32:
-    persist_si32 (mtrc.si32, path);
+  case WAL_AGENT_SEQ:
+    ht_insert_agent_seq (str);
     break;
-  default:
+  case WAL_UNIQUE_KEY:
+    ht_insert_unique_key (str);
+    break;
+  case WAL_AGENT_KEY:
+    ht_insert_agent_key (str);
+    break;
+  case WAL_AGENT_VALUE:
+    ht_insert_agent_value (rec->key, str);
+    break;
+  case WAL_KEYMAP:
+    ht_insert_keymap (rec->module, str);
+    break;
+  case WAL_DATAMAP:
+    ht_insert_datamap (rec->module, rec->key, str);
+    break;
+  case WAL_ROOTMAP:
+    ht_insert_rootmap (rec->module, rec->key, str);
+    break;
+  case WAL_UNIQMAP:
+    ht_insert_uniqmap (rec->module, rec->key, rec->val);
+    break;
+  case WAL_ROOT:
+    ht_insert_root (rec->module, rec->key, rec->val);
+    break;
+  case WAL_META_DATA:
+    ht_insert_meta_data (rec->module, str, rec->val);
+    break;
+  case WAL_HITS:
+    ht_insert_hits (rec->module, rec->key, rec->val);
+    break;
+  case WAL_VISITOR:
+    ht_insert_visitor (rec->module, rec->key, rec->val);
+    break;
+  case WAL_BW:
+    ht_insert_bw (rec->module, rec->key, rec->val);
+    break;
+  case WAL_CUMTS:
+    ht_insert_cumts (rec->module, rec->key, rec->val);
+    break;
+  case WAL_MAXTS:
+    ht_insert_maxts (rec->module, rec->key, rec->val);
+    break;
+  case WAL_METHOD:
+    ht_insert_method (rec->module, rec->key, str);
+    break;
+  case WAL_PROTOCOL:
+    ht_insert_protocol (rec->module, rec->key, str);
+    break;
+  case WAL_AGENT:
+    ht_insert_agent (rec->module, rec->key, rec->val);
+    break;
+  case WAL_INVALIDATE_DATE:
+    invalidate_date (rec->key);
+    break;
+  case WAL_CLEAN_PARTIAL:
+    clean_partial_match_hashes (rec->key);
+    break;
+  case WAL_CLEAN_FULL:
+    clean_full_match_hashes (rec->key);
+    break;
+  case WAL_UNIQHLL:
+    ht_insert_uniq_hll (rec->module, rec->key, rec->val);
+    break;
+  case WAL_LATENCY:
+    ht_insert_latency (rec->module, rec->key, rec->val);
     break;
   }
-  free (path);
 }
 
+/* Set the overall counters from the tables just restored. */
 static void
-persist_metric_type (GModule module, GKHashMetric mtrc) {
-  char *fn = NULL;
-  fn = get_filename (module, mtrc);
-  persist_by_type (mtrc, fn);
-  free (fn);
-}
+load_cnt_overall (void) {
+  khint_t k;
+  int i;
 
-static void
-persist_overall (void) {
-  int n = 0, i;
-  /* *INDENT-OFF* */
-  GKHashMetric metrics[] = {
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_unique_keys } , "SI32_UNIQUE_KEYS.db" } ,
-    {0 , MTRC_TYPE_IS32 , {.is32 = ht_agent_vals  } , "IS32_AGENT_VALS.db"  } ,
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_agent_keys  } , "SI32_AGENT_KEYS.db"  } ,
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_seqs        } , "SI32_SEQS.db"        } ,
-    {0 , MTRC_TYPE_SI32 , {.si32 = ht_cnt_overall } , "SI32_CNT_OVERALL.db" } ,
-    {0 , MTRC_TYPE_II32 , {.ii32 = ht_last_parse  } , "II32_LAST_PARSE.db"  } ,
-    {0 , MTRC_TYPE_II32 , {.ii32 = ht_cnt_valid   } , "II32_CNT_VALID.db"   } ,
-    {0 , MTRC_TYPE_IU64 , {.iu64 = ht_cnt_bw      } , "IU64_CNT_BW.db"      } ,
-  };
-  /* *INDENT-ON* */
-
-  n = ARRAY_SIZE (metrics);
-  for (i = 0; i < n; i++) {
-    persist_by_type (metrics[i], metrics[i].filename);
+  for (i = 0; i < CNT_OVERALL_TOTAL; i++) {
+    k = kh_get (si32, ht_cnt_overall, cnt_overall_keys[i]);
+    cnt_overall[i] = k != kh_end (ht_cnt_overall) ? kh_val (ht_cnt_overall, k) : 0;
   }
+
+  cnt_valid = cnt_bw = 0;
+  for (k = kh_begin (ht_cnt_valid); k != kh_end (ht_cnt_valid); ++k)
+    if (kh_exist (ht_cnt_valid, k))
+      cnt_valid += kh_val (ht_cnt_valid, k);
+  for (k = kh_begin (ht_cnt_bw); k != kh_end (ht_cnt_bw); ++k)
+    if (kh_exist (ht_cnt_bw, k))
+      cnt_bw += kh_val (ht_cnt_bw, k);
 }
 
-/* Destroys the hash structure allocated metrics */
+/* Fill in ht_cnt_overall from the overall counters, to be persisted. */
 static void
-persist_data (void) {
-  GModule module;
+store_cnt_overall (void) {
+  uint32_t val;
+  khint_t k;
   int i;
+
+  for (i = 0; i < CNT_OVERALL_TOTAL; i++) {
+    val = __atomic_load_n (&cnt_overall[i], __ATOMIC_RELAXED);
+    k = kh_get (si32, ht_cnt_overall, cnt_overall_keys[i]);
+    if (k != kh_end (ht_cnt_overall))
+      kh_val (ht_cnt_overall, k) = val;
+    else if (val != 0)
+      ins_si32 (ht_cnt_overall, cnt_overall_keys[i], val);
+  }
+}
+
+/* Determine if a hostname resolved at the given time is still fresh
+ * enough to be kept, as per --dns-cache-ttl. */
+static int
+hostname_fresh (uint32_t ts, time_t now) {
+  return ts <= now && (uint64_t) (now - ts) < conf.dns_cache_ttl;
+}
+
+/* Load the hostnames resolved by previous runs, dropping those resolved
+ * longer than --dns-cache-ttl ago. */
+static void
+load_hostnames (void) {
+  tpl_node *tn;
+  char *path = NULL, *ip = NULL, *host = NULL;
+  char fmt[] = "A(ssu)";
+  time_t now = time (NULL);
+  uint32_t ts;
+
+  if (!(path = check_restore_path (HOSTNAMES_FILENAME)))
+    return;
+
+  tn = tpl_map (fmt, &ip, &host, &ts);
+  if (tpl_load (tn, TPL_FILE, path) == 0) {
+    while (tpl_unpack (tn, 1) > 0) {
+      if (hostname_fresh (ts, now) && ins_ss32 (ht_hostnames, ip, host) == 0)
+        ins_si32 (ht_hostname_ts, ip, ts);
+      free (ip);
+      free (host);
+    }
+  }
+  tpl_free (tn);
+  free (path);
+}
+
+/* Write the hostnames still fresh next to the on-disk database, to be
+ * loaded by the next run. The file is replaced atomically. */
+static void
+store_hostnames (void) {
+  tpl_node *tn;
+  khint_t k, t;
+  char *path = NULL, *tmp = NULL, *ip = NULL, *host = NULL;
+  char fmt[] = "A(ssu)";
+  time_t now = time (NULL);
+  uint32_t ts;
+
+  path = set_db_path (HOSTNAMES_FILENAME);
+  tmp = xmalloc (snprintf (NULL, 0, "%s.tmp", path) + 1);
+  sprintf (tmp, "%s.tmp", path);
+
+  tn = tpl_map (fmt, &ip, &host, &ts);
+  for (k = kh_begin (ht_hostnames); k != kh_end (ht_hostnames); ++k) {
+    if (!kh_exist (ht_hostnames, k))
+      continue;
+
+    ip = (char *) kh_key (ht_hostnames, k);
+    host = kh_val (ht_hostnames, k);
+    t = kh_get (si32, ht_hostname_ts, ip);
+    ts = t != kh_end (ht_hostname_ts) ? kh_val (ht_hostname_ts, t) : 0;
+    if (hostname_fresh (ts, now))
+      tpl_pack (tn, 1);
+  }
+
+  if (tpl_dump (tn, TPL_FILE, tmp) != 0 || rename (tmp, path) != 0) {
+    LOG_DEBUG (("Unable to write %s: %s\n", path, strerror (errno)));
+    unlink (tmp);
+  }
+  tpl_free (tn);
+  free (tmp);
+  free (path);
+}
+
+/* Restore all tables from the on-disk database, in parallel, and replay
+ * the write-ahead log on top of them. If there is no database, tables
+ * are imported from the per-table files written by previous versions,
+ * and their uniqmap keys brought to the current encoding.
+ * With --lazy-restore, each module's tables are restored the first time
+ * they are used instead. */
+static void
+restore_data (void) {
+  GKHashMetric *mtrcs = NULL;
+  char *path = NULL;
+  int i, n = 0, imported = 0, lazy = 0;
   size_t idx = 0;
 
-  persist_overall ();
+  path = set_db_path (GKDB_FILENAME);
+  imported = (gkh_db = gkdb_open (path)) == NULL;
+  free (path);
+
+  lazy = conf.lazy_restore && !imported;
+  n = get_persisted_tables (&mtrcs, !lazy);
+  if (imported) {
+    for (i = 0; i < n; i++)
+      restore_by_type (mtrcs[i], mtrcs[i].filename);
+    FOREACH_MODULE (idx, module_list)
+      migrate_uniqmap (module_list[idx]);
+  } else {
+    gkdb_restore_tables (gkh_db, mtrcs, n);
+  }
+  free_persisted_tables (mtrcs, n);
+  load_cnt_overall ();
+
+  if (lazy) {
+    FOREACH_MODULE (idx, module_list) {
+      __atomic_store_n (&gkh_storage[module_list[idx]].pending, 1,
+                        __ATOMIC_RELEASE);
+    }
+  }
+
+  /* changes logged since the database was written */
+  path = set_db_path (NULL);
+  wal_replay (path, gkdb_lsn (gkh_db), replay_change);
+  free (path);
+}
+
+/* Write all tables into the on-disk database, along with the last
+ * write-ahead log batch they hold.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+persist_data (void) {
+  GKHashMetric *mtrcs = NULL;
+  char *path = NULL;
+  int n = 0, ret = 0;
+  size_t idx = 0;
 
   if (!gkh_storage)
+    return 1;
+
+  /* tables never used since a lazy restore still hold data to keep */
+  FOREACH_MODULE (idx, module_list) {
+    if (is_pending (module_list[idx]))
+      restore_pending (module_list[idx]);
+  }
+
+  store_cnt_overall ();
+  path = set_db_path (GKDB_FILENAME);
+  n = get_persisted_tables (&mtrcs, 1);
+  if ((ret = gkdb_persist (path, mtrcs, n, wal_lsn ())) != 0)
+    LOG_DEBUG (("Unable to persist data to %s\n", path));
+  free_persisted_tables (mtrcs, n);
+  free (path);
+
+  return ret;
+}
+
+/* Drop the write-ahead log segments held by the on-disk database. */
+static void
+purge_wal (uint64_t lsn) {
+  char *path = set_db_path (NULL);
+
+  wal_purge (path, lsn);
+  free (path);
+}
+
+/* Determine if a background snapshot of the storage is due, i.e.,
+ * --persist-interval seconds went by since the last one and it was
+ * fully written. */
+int
+snapshot_due (void) {
+  int status = 0;
+
+  if (!conf.persist || !conf.persist_interval || !gkh_storage)
+    return 0;
+
+  /* still writing the previous snapshot, else drop the log it holds */
+  if (snapshot_pid > 0) {
+    if (!snapshot_exited)
+      return 0;
+    snapshot_exited = 0;
+    if (waitpid (snapshot_pid, &status, WNOHANG) == 0)
+      return 0;
+    if (WIFEXITED (status) && WEXITSTATUS (status) == EXIT_SUCCESS)
+      purge_wal (snapshot_lsn);
+    snapshot_pid = 0;
+  }
+
+  return time (NULL) - snapshot_time >= conf.persist_interval;
+}
+
+/* Flag the snapshot child as done, it is reaped by snapshot_due(). */
+static void
+snapshot_sigchld (GO_UNUSED int sig) {
+  snapshot_exited = 1;
+}
+
+/* Have SIGCHLD flag the end of a snapshot so that the parser does not
+ * need to poll the child on every line. */
+static void
+watch_snapshot (void) {
+  static int installed = 0;
+  struct sigaction act;
+
+  if (installed)
     return;
+  installed = 1;
+
+  sigemptyset (&act.sa_mask);
+  act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  act.sa_handler = snapshot_sigchld;
+  sigaction (SIGCHLD, &act, NULL);
+}
+
+/* Persist a consistent snapshot of the storage without pausing the
+ * caller. The process is forked and the child writes its copy-on-write
+ * image of the tables while the parent carries on parsing. */
+void
+snapshot_storage (void) {
+  size_t idx = 0;
+  pid_t pid;
 
+  snapshot_time = time (NULL);
+  watch_snapshot ();
+
+  /* the child must not restore tables, it shares the restore lock */
   FOREACH_MODULE (idx, module_list) {
-    module = module_list[idx];
+    if (is_pending (module_list[idx]))
+      restore_pending (module_list[idx]);
+  }
 
-    for (i = 0; i < GSMTRC_TOTAL; i++) {
-      persist_metric_type (module, gkh_storage[module].metrics[i]);
-    }
+  /* changes from here on go to a new log segment */
+  wal_rotate ();
+  snapshot_lsn = wal_lsn ();
+
+  /* no writer may be halfway through a change as the child copies the
+   * tables */
+  lock_all_shards ();
+  pthread_mutex_lock (&seqs_mutex);
+  pid = fork ();
+  pthread_mutex_unlock (&seqs_mutex);
+  unlock_all_shards ();
+
+  if (pid == -1) {
+    LOG_DEBUG (("Unable to fork snapshot: %s\n", strerror (errno)));
+    return;
   }
+  if (pid == 0)
+    _exit (persist_data ()? EXIT_FAILURE : EXIT_SUCCESS);
+  snapshot_pid = pid;
+}
+
+/* Start logging changes to the storage next to the on-disk database. */
+static void
+open_wal (void) {
+  char *path = set_db_path (NULL);
+
+  wal_open (path);
+  free (path);
+}
+
+/* Stop a snapshot still being written, it is superseded by the
+ * caller's. */
+static void
+stop_snapshot (void) {
+  if (snapshot_pid <= 0)
+    return;
+
+  kill (snapshot_pid, SIGTERM);
+  waitpid (snapshot_pid, NULL, 0);
+  snapshot_pid = 0;
+  snapshot_exited = 0;
 }
 
 /* Get the uint32_t value of a given string key.
@@ -1598,7 +2003,16 @@ get_iui8 (khash_t (iui8) * hash, uint32_t key) {
 
 uint32_t
 ht_get_date (uint32_t date) {
-  return get_iui8 (ht_dates, date);
+  uint32_t ret = 0;
+
+  if (!ht_dates)
+    return 0;
+
+  lock_shard (OVERALL_SHARD);
+  ret = get_iui8 (ht_dates, date);
+  unlock_shard (OVERALL_SHARD);
+
+  return ret;
 }
 
 /* Get the number of elements in a dates hash.
@@ -1606,84 +2020,73 @@ ht_get_date (uint32_t date) {
  * Return 0 if the operation fails, else number of elements. */
 uint32_t
 ht_get_size_dates (void) {
+  uint32_t ret = 0;
   khash_t (iui8) * hash = ht_dates;
 
   if (!hash)
     return 0;
 
-  return kh_size (hash);
+  lock_shard (OVERALL_SHARD);
+  ret = kh_size (hash);
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 uint32_t
 ht_get_excluded_ips (void) {
-  khash_t (si32) * hash = ht_cnt_overall;
-
-  if (!hash)
-    return 0;
-
-  return get_si32 (hash, "excluded_ip");
+  return __atomic_load_n (&cnt_overall[CNT_EXCLUDED_IP], __ATOMIC_RELAXED);
 }
 
 uint32_t
 ht_get_invalid (void) {
-  khash_t (si32) * hash = ht_cnt_overall;
-
-  if (!hash)
-    return 0;
-
-  return get_si32 (hash, "failed_requests");
+  return __atomic_load_n (&cnt_overall[CNT_INVALID], __ATOMIC_RELAXED);
 }
 
 uint32_t
 ht_get_processed (void) {
-  khash_t (si32) * hash = ht_cnt_overall;
-
-  if (!hash)
-    return 0;
-
-  return get_si32 (hash, "total_requests");
+  return __atomic_load_n (&cnt_overall[CNT_PROCESSED], __ATOMIC_RELAXED);
 }
 
 uint32_t
 ht_sum_valid (void) {
-  khash_t (ii32) * hash = ht_cnt_valid;
-  khint_t k;
-  uint32_t val = 0;
-
-  if (!hash)
-    return 0;
-
-  for (k = 0; k < kh_end (hash); ++k)
-    if (kh_exist (hash, k))
-      val += kh_value (hash, k);
-
-  return val;
+  return __atomic_load_n (&cnt_valid, __ATOMIC_RELAXED);
 }
 
 uint64_t
 ht_sum_bw (void) {
-  khash_t (iu64) * hash = ht_cnt_bw;
-  khint_t k;
-  uint64_t val = 0;
+  return __atomic_load_n (&cnt_bw, __ATOMIC_RELAXED);
+}
+
+int
+ht_insert_last_parse (uint32_t key, uint32_t value) {
+  int ret = 0;
+  khash_t (ii32) * hash = ht_last_parse;
 
   if (!hash)
     return 0;
 
-  for (k = 0; k < kh_end (hash); ++k)
-    if (kh_exist (hash, k))
-      val += kh_value (hash, k);
-
-  return val;
+  lock_shard (OVERALL_SHARD);
+  wal_log (WAL_LAST_PARSE, 0, key, value, NULL);
+  ret = ins_ii32 (hash, key, value);
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
+/* Checkpoints of compressed logs are kept apart from those of live logs,
+ * as their keys are hashes that could clash with an inode. */
 int
-ht_insert_last_parse (uint32_t key, uint32_t value) {
-  khash_t (ii32) * hash = ht_last_parse;
+ht_insert_gz_parse (uint32_t key, uint32_t value) {
+  int ret = 0;
+  khash_t (ii32) * hash = ht_gz_parse;
 
   if (!hash)
     return 0;
 
-  return ins_ii32 (hash, key, value);
+  lock_shard (OVERALL_SHARD);
+  wal_log (WAL_GZ_PARSE, 0, key, value, NULL);
+  ret = ins_ii32 (hash, key, value);
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 uint32_t
@@ -1693,41 +2096,70 @@ ht_insert_date (uint32_t key) {
   if (!hash)
     return 0;
 
-  if (ins_iui8 (hash, key, 1) == -1)
+  lock_shard (OVERALL_SHARD);
+  if (ins_iui8 (hash, key, 1) == -1) {
+    unlock_shard (OVERALL_SHARD);
     return 0;
+  }
+  wal_log (WAL_DATE, 0, key, 0, NULL);
+  unlock_shard (OVERALL_SHARD);
   return key;
 }
 
+/* Increase an overall counter.
+ *
+ * The new value of the counter is returned. */
 uint32_t
-ht_inc_cnt_overall (const char *key, uint32_t val) {
-  khash_t (si32) * hash = ht_cnt_overall;
+ht_inc_cnt_overall (GCntOverall cnt, uint32_t val) {
+  wal_log (WAL_CNT_OVERALL, 0, 0, val, cnt_overall_keys[cnt]);
+  return __atomic_add_fetch (&cnt_overall[cnt], val, __ATOMIC_RELAXED);
+}
 
-  if (!hash)
-    return 0;
+/* Increase an overall counter given its key within ht_cnt_overall, as
+ * read from a database or the write-ahead log. Unknown keys are
+ * ignored. */
+static void
+inc_cnt_overall_key (const char *key, uint32_t val) {
+  int i;
 
-  if (get_si32 (hash, key) != 0)
-    return inc_si32 (hash, key, val);
-  return inc_si32 (hash, xstrdup (key), val);
+  for (i = 0; i < CNT_OVERALL_TOTAL; i++) {
+    if (strcmp (key, cnt_overall_keys[i]) == 0) {
+      ht_inc_cnt_overall (i, val);
+      return;
+    }
+  }
 }
 
 uint32_t
 ht_inc_cnt_valid (uint32_t key, uint32_t inc) {
+  uint32_t ret = 0;
   khash_t (ii32) * hash = ht_cnt_valid;
 
   if (!hash)
     return 0;
 
-  return inc_ii32 (hash, key, inc);
+  lock_shard (OVERALL_SHARD);
+  wal_log (WAL_CNT_VALID, 0, key, inc, NULL);
+  ret = inc_ii32 (hash, key, inc);
+  unlock_shard (OVERALL_SHARD);
+  __atomic_add_fetch (&cnt_valid, inc, __ATOMIC_RELAXED);
+  return ret;
 }
 
 uint32_t
 ht_inc_cnt_bw (uint32_t key, uint64_t inc) {
+  uint32_t ret = 0;
   khash_t (iu64) * hash = ht_cnt_bw;
 
   if (!hash)
     return 0;
 
-  return inc_iu64 (hash, key, inc);
+  lock_shard (OVERALL_SHARD);
+  wal_log (WAL_CNT_BW, 0, key, inc, NULL);
+  ret = inc_iu64 (hash, key, inc);
+  unlock_shard (OVERALL_SHARD);
+  __atomic_add_fetch (&cnt_bw, inc, __ATOMIC_RELAXED);
+  return ret;
 }
 
 /* Increases the unique key counter from a uint32_t key.
@@ -1737,13 +2169,19 @@ ht_inc_cnt_bw (uint32_t key, uint64_t inc) {
 static uint32_t
 ht_ins_seq (const char *key) {
   khash_t (si32) * hash = ht_seqs;
+  uint32_t ret = 0;
 
   if (!hash)
     return 0;
 
+  pthread_mutex_lock (&seqs_mutex);
   if (get_si32 (hash, key) != 0)
-    return inc_si32 (hash, key, 1);
-  return inc_si32 (hash, xstrdup (key), 1);
+    ret = inc_si32 (hash, key, 1);
+  else
+    ret = inc_si32 (hash, xstrdup (key), 1);
+  pthread_mutex_unlock (&seqs_mutex);
+
+  return ret;
 }
 
 /* Increases the unique agent counter from a uint32_t key.
@@ -1753,12 +2191,20 @@ ht_ins_seq (const char *key) {
 uint32_t
 ht_insert_agent_seq (const char *key) {
   khash_t (si32) * hash = ht_seqs;
+  uint32_t ret = 0;
+
   if (!hash)
     return 0;
 
+  pthread_mutex_lock (&seqs_mutex);
+  wal_log (WAL_AGENT_SEQ, 0, 0, 0, key);
   if (get_si32 (hash, key) != 0)
-    return inc_si32 (hash, key, 1);
-  return inc_si32 (hash, xstrdup (key), 1);
+    ret = inc_si32 (hash, key, 1);
+  else
+    ret = inc_si32 (hash, xstrdup (key), 1);
+  pthread_mutex_unlock (&seqs_mutex);
+
+  return ret;
 }
 
 /* Insert a unique visitor key string (IP/DATE/UA), mapped to an auto
@@ -1769,16 +2215,23 @@ ht_insert_agent_seq (const char *key) {
  * On success the value of the key inserted is returned */
 uint32_t
 ht_insert_unique_key (const char *key) {
+  uint32_t ret = 0;
   uint32_t val = 0;
   khash_t (si32) * hash = ht_unique_keys;
 
   if (!hash)
     return 0;
 
-  if ((val = get_si32 (hash, key)) != 0)
+  lock_shard (OVERALL_SHARD);
+  if ((val = get_si32 (hash, key)) != 0) {
+    unlock_shard (OVERALL_SHARD);
     return val;
+  }
 
-  return ins_si32_inc (hash, key, ht_ins_seq, "ht_unique_keys");
+  wal_log (WAL_UNIQUE_KEY, 0, 0, 0, key);
+  ret = ins_si32_inc (hash, key, ht_ins_seq, "ht_unique_keys");
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 /* Insert a user agent key string, mapped to an auto incremented value.
@@ -1788,16 +2241,23 @@ ht_insert_unique_key (const char *key) {
  * On success the value of the key inserted is returned */
 uint32_t
 ht_insert_agent_key (const char *key) {
+  uint32_t ret = 0;
   uint32_t val = 0;
   khash_t (si32) * hash = ht_agent_keys;
 
   if (!hash)
     return 0;
 
-  if ((val = get_si32 (hash, key)) != 0)
+  lock_shard (OVERALL_SHARD);
+  if ((val = get_si32 (hash, key)) != 0) {
+    unlock_shard (OVERALL_SHARD);
     return val;
+  }
 
-  return ins_si32_inc (hash, key, ht_ins_seq, "ht_agent_keys");
+  wal_log (WAL_AGENT_KEY, 0, 0, 0, key);
+  ret = ins_si32_inc (hash, key, ht_ins_seq, "ht_agent_keys");
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 /* Insert a user agent uint32_t key, mapped to a user agent string value.
@@ -1811,7 +2271,15 @@ ht_insert_agent_value (uint32_t key, const char *value) {
   if (!hash)
     return -1;
 
-  return ins_is32 (hash, key, value);
+  lock_shard (OVERALL_SHARD);
+  if (ins_is32 (hash, key, value) != 0) {
+    unlock_shard (OVERALL_SHARD);
+    return -1;
+  }
+  wal_log (WAL_AGENT_VALUE, 0, key, 0, value);
+
+  unlock_shard (OVERALL_SHARD);
+  return 0;
 }
 
 /* Insert a keymap string key.
@@ -1828,12 +2296,18 @@ ht_insert_keymap (GModule module, const char *key) {
   if (!hash)
     return 0;
 
-  if ((value = get_si32 (hash, key)) != 0)
+  lock_shard (module);
+  if ((value = get_si32 (hash, key)) != 0) {
+    unlock_shard (module);
     return value;
+  }
 
+  wal_log (WAL_KEYMAP, module, 0, 0, key);
   modstr = get_module_str (module);
   value = ins_si32_inc (hash, key, ht_ins_seq, modstr);
   free (modstr);
+  note_top_key (module, hash, key, value);
+  unlock_shard (module);
   return value;
 }
 
@@ -1848,7 +2322,15 @@ ht_insert_datamap (GModule module, uint32_t key, const char *value) {
   if (!hash)
     return -1;
 
-  return ins_is32 (hash, key, value);
+  lock_shard (module);
+  if (ins_is32 (hash, key, value) != 0) {
+    unlock_shard (module);
+    return -1;
+  }
+  wal_log (WAL_DATAMAP, module, key, 0, value);
+
+  unlock_shard (module);
+  return 0;
 }
 
 /* Insert a rootmap uint32_t key from the keymap store mapped to its string
@@ -1863,7 +2345,15 @@ ht_insert_rootmap (GModule module, uint32_t key, const char *value) {
   if (!hash)
     return -1;
 
-  return ins_is32 (hash, key, value);
+  lock_shard (module);
+  if (ins_is32 (hash, key, value) != 0) {
+    unlock_shard (module);
+    return -1;
+  }
+  wal_log (WAL_ROOTMAP, module, key, 0, value);
+
+  unlock_shard (module);
+  return 0;
 }
 
 /* Encode a data key and a unique visitor's key to a new uint64_t key
@@ -1873,9 +2363,7 @@ ht_insert_rootmap (GModule module, uint32_t key, const char *value) {
   */
 static uint64_t
 u64encode (uint32_t x, uint32_t y) {
-  return x >
-    y ? (uint32_t) y | ((uint64_t) x << 32) : (uint32_t) x | ((uint64_t) y <<
-                                                              32);
+  return ((uint64_t) x << 32) | y;
 }
 
 static void
@@ -1897,8 +2385,76 @@ ht_insert_uniqmap (GModule module, uint32_t key, uint32_t value) {
   if (!hash)
     return 0;
 
+  lock_shard (module);
   k = u64encode (key, value);
-  return ins_u648 (hash, k, 1) == 0 ? 1 : 0;
+  if (ins_u648 (hash, k, 1) != 0) {
+    unlock_shard (module);
+    return 0;
+  }
+  wal_log (WAL_UNIQMAP, module, key, value, NULL);
+
+  unlock_shard (module);
+  return 1;
+}
+
+/* Add a unique visitor's hashed key to the sketch of the given data
+ * key, see --approx-visitors. The data key's visitors counter is set to
+ * the sketch's estimate whenever the sketch changes.
+ *
+ * On error, or if the sketch is unchanged, 0 is returned.
+ * On success 1 is returned */
+int
+ht_insert_uniq_hll (GModule module, uint32_t key, uint64_t value) {
+  khash_t (ihll) * hash = get_hash (module, MTRC_UNIQHLL);
+  khash_t (ii32) * visitors = get_hash (module, MTRC_VISITORS);
+  GHLL *hll = NULL;
+  khint_t k;
+  int ret;
+
+  if (!hash || !visitors)
+    return 0;
+
+  lock_shard (module);
+  k = kh_put (ihll, hash, key, &ret);
+  if (ret == -1) {
+    unlock_shard (module);
+    return 0;
+  }
+  if (ret != 0)
+    kh_val (hash, k) = hll_new (conf.hll_precision ?
+                                conf.hll_precision : HLL_DEF_PRECISION);
+
+  hll = kh_val (hash, k);
+  if (hll_add (hll, value) == 0) {
+    unlock_shard (module);
+    return 0;
+  }
+  wal_log (WAL_UNIQHLL, module, key, value, NULL);
+  ins_ii32 (visitors, key, hll_count (hll));
+
+  unlock_shard (module);
+  return 1;
+}
+
+/* Merge a sketch of unique visitors into the one of the given data
+ * key, and set its visitors counter to the estimate of their union. */
+static void
+merge_uniq_hll (GModule module, uint32_t key, const GHLL * src) {
+  khash_t (ihll) * hash = get_hash (module, MTRC_UNIQHLL);
+  khint_t k;
+  int ret;
+
+  if (!hash)
+    return;
+
+  k = kh_put (ihll, hash, key, &ret);
+  if (ret == -1)
+    return;
+  if (ret != 0)
+    kh_val (hash, k) = hll_new (src->precision);
+
+  hll_merge (kh_val (hash, k), src);
+  ins_ii32 (get_hash (module, MTRC_VISITORS), key, hll_count (kh_val (hash, k)));
 }
 
 /* Insert a data uint32_t key mapped to the corresponding uint32_t root key.
@@ -1907,12 +2463,17 @@ ht_insert_uniqmap (GModule module, uint32_t key, uint32_t value) {
  * On success 0 is returned */
 int
 ht_insert_root (GModule module, uint32_t key, uint32_t value) {
+  int ret = 0;
   khash_t (ii32) * hash = get_hash (module, MTRC_ROOT);
 
   if (!hash)
     return -1;
 
-  return ins_ii32 (hash, key, value);
+  lock_shard (module);
+  wal_log (WAL_ROOT, module, key, value, NULL);
+  ret = ins_ii32 (hash, key, value);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Insert meta data counters from a string key.
@@ -1921,26 +2482,40 @@ ht_insert_root (GModule module, uint32_t key, uint32_t value) {
  * On success 0 is returned */
 int
 ht_insert_meta_data (GModule module, const char *key, uint64_t value) {
+  int ret = 0;
   khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
 
   if (!hash)
     return -1;
 
-  return inc_su64 (hash, key, value);
+  lock_shard (module);
+  wal_log (WAL_META_DATA, module, 0, value, key);
+  ret = inc_su64 (hash, key, value);
+  unlock_shard (module);
+  return ret;
 }
 
-/* Increases hits counter from a uint32_t key.
+/* Increases hits counter from a uint32_t key. A panel over its
+ * --max-keys cap, or in heavy-hitter mode with a key not yet monitored,
+ * may evict other keys first.
  *
  * On error, 0 is returned.
  * On success the inserted value is returned */
 uint32_t
 ht_insert_hits (GModule module, uint32_t key, uint32_t inc) {
+  uint32_t ret = 0;
   khash_t (ii32) * hash = get_hash (module, MTRC_HITS);
 
   if (!hash)
     return 0;
 
-  return inc_ii32 (hash, key, inc);
+  lock_shard (module);
+  wal_log (WAL_HITS, module, key, inc, NULL);
+  cap_keys (module, key);
+  count_top_key (module, key, inc);
+  ret = inc_ii32 (hash, key, inc);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Increases visitors counter from a uint32_t key.
@@ -1949,12 +2524,17 @@ ht_insert_hits (GModule module, uint32_t key, uint32_t inc) {
  * On success the inserted value is returned */
 uint32_t
 ht_insert_visitor (GModule module, uint32_t key, uint32_t inc) {
+  uint32_t ret = 0;
   khash_t (ii32) * hash = get_hash (module, MTRC_VISITORS);
 
   if (!hash)
     return 0;
 
-  return inc_ii32 (hash, key, inc);
+  lock_shard (module);
+  wal_log (WAL_VISITOR, module, key, inc, NULL);
+  ret = inc_ii32 (hash, key, inc);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Increases bandwidth counter from a uint32_t key.
@@ -1963,12 +2543,17 @@ ht_insert_visitor (GModule module, uint32_t key, uint32_t inc) {
  * On success 0 is returned */
 int
 ht_insert_bw (GModule module, uint32_t key, uint64_t inc) {
+  int ret = 0;
   khash_t (iu64) * hash = get_hash (module, MTRC_BW);
 
   if (!hash)
     return -1;
 
-  return inc_iu64 (hash, key, inc);
+  lock_shard (module);
+  wal_log (WAL_BW, module, key, inc, NULL);
+  ret = inc_iu64 (hash, key, inc);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Increases cumulative time served counter from a uint32_t key.
@@ -1977,12 +2562,17 @@ ht_insert_bw (GModule module, uint32_t key, uint64_t inc) {
  * On success 0 is returned */
 int
 ht_insert_cumts (GModule module, uint32_t key, uint64_t inc) {
+  int ret = 0;
   khash_t (iu64) * hash = get_hash (module, MTRC_CUMTS);
 
   if (!hash)
     return -1;
 
-  return inc_iu64 (hash, key, inc);
+  lock_shard (module);
+  wal_log (WAL_CUMTS, module, key, inc, NULL);
+  ret = inc_iu64 (hash, key, inc);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Insert the maximum time served counter from a uint32_t key.
@@ -1998,12 +2588,66 @@ ht_insert_maxts (GModule module, uint32_t key, uint64_t value) {
   if (!hash)
     return -1;
 
-  if ((curvalue = get_iu64 (hash, key)) < value)
+  lock_shard (module);
+  if ((curvalue = get_iu64 (hash, key)) < value) {
+    wal_log (WAL_MAXTS, module, key, value, NULL);
     ins_iu64 (hash, key, value);
+  }
+
+  unlock_shard (module);
+  return 0;
+}
+
+/* Add a time served to the histogram of the given data key, see
+ * --latency-percentiles.
+ *
+ * On error, -1 is returned.
+ * On success 0 is returned */
+int
+ht_insert_latency (GModule module, uint32_t key, uint64_t value) {
+  khash_t (ihst) * hash = get_hash (module, MTRC_LATENCY);
+  khint_t k;
+  int ret;
+
+  if (!hash)
+    return -1;
+
+  lock_shard (module);
+  k = kh_put (ihst, hash, key, &ret);
+  if (ret == -1) {
+    unlock_shard (module);
+    return -1;
+  }
+  if (ret != 0)
+    kh_val (hash, k) = hist_new ();
 
+  wal_log (WAL_LATENCY, module, key, value, NULL);
+  hist_add (kh_val (hash, k), value, 1);
+
+  unlock_shard (module);
   return 0;
 }
 
+/* Merge a histogram of times served into the one of the given data
+ * key. */
+static void
+merge_latency (GModule module, uint32_t key, const GHist * src) {
+  khash_t (ihst) * hash = get_hash (module, MTRC_LATENCY);
+  khint_t k;
+  int ret;
+
+  if (!hash)
+    return;
+
+  k = kh_put (ihst, hash, key, &ret);
+  if (ret == -1)
+    return;
+  if (ret != 0)
+    kh_val (hash, k) = hist_new ();
+
+  hist_merge (kh_val (hash, k), src);
+}
+
 /* Insert a method given an uint32_t key and string value.
  *
  * On error, or if key exists, -1 is returned.
@@ -2015,7 +2659,15 @@ ht_insert_method (GModule module, uint32_t key, const char *value) {
   if (!hash)
     return -1;
 
-  return ins_is32 (hash, key, value);
+  lock_shard (module);
+  if (ins_is32 (hash, key, value) != 0) {
+    unlock_shard (module);
+    return -1;
+  }
+  wal_log (WAL_METHOD, module, key, 0, value);
+
+  unlock_shard (module);
+  return 0;
 }
 
 /* Insert a protocol given an uint32_t key and string value.
@@ -2029,7 +2681,15 @@ ht_insert_protocol (GModule module, uint32_t key, const char *value) {
   if (!hash)
     return -1;
 
-  return ins_is32 (hash, key, value);
+  lock_shard (module);
+  if (ins_is32 (hash, key, value) != 0) {
+    unlock_shard (module);
+    return -1;
+  }
+  wal_log (WAL_PROTOCOL, module, key, 0, value);
+
+  unlock_shard (module);
+  return 0;
 }
 
 /* Insert an agent for a hostname given an uint32_t key and uint32_t value.
@@ -2038,12 +2698,17 @@ ht_insert_protocol (GModule module, uint32_t key, const char *value) {
  * On success 0 is returned */
 int
 ht_insert_agent (GModule module, uint32_t key, uint32_t value) {
+  int ret = 0;
   khash_t (igsl) * hash = get_hash (module, MTRC_AGENTS);
 
   if (!hash)
     return -1;
 
-  return ins_igsl (hash, key, value);
+  lock_shard (module);
+  wal_log (WAL_AGENT, module, key, value, NULL);
+  ret = ins_igsl (hash, key, value);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Insert a keymap string key mapped to the corresponding uint32_t value.
@@ -2052,12 +2717,16 @@ ht_insert_agent (GModule module, uint32_t key, uint32_t value) {
  * On success 0 is returned */
 static int
 ht_insert_keymap_list (GModule module, const char *key, uint32_t value) {
+  int ret = 0;
   khash_t (sgsl) * hash = get_hash (module, MTRC_KEYMAPUQ);
 
   if (!hash)
     return -1;
 
-  return ins_sgsl (hash, key, value);
+  lock_shard (module);
+  ret = ins_sgsl (hash, key, value);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Insert an IP hostname mapped to the corresponding hostname.
@@ -2066,22 +2735,45 @@ ht_insert_keymap_list (GModule module, const char *key, uint32_t value) {
  * On success 0 is returned */
 int
 ht_insert_hostname (const char *ip, const char *host) {
+  int ret = 0;
   khash_t (ss32) * hash = ht_hostnames;
 
   if (!hash)
     return -1;
 
-  return ins_ss32 (hash, ip, host);
+  lock_shard (OVERALL_SHARD);
+  if ((ret = ins_ss32 (hash, ip, host)) == 0)
+    ins_si32 (ht_hostname_ts, ip, time (NULL));
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 uint32_t
 ht_get_last_parse (uint32_t key) {
+  uint32_t ret = 0;
   khash_t (ii32) * hash = ht_last_parse;
 
   if (!hash)
     return 0;
 
-  return get_ii32 (hash, key);
+  lock_shard (OVERALL_SHARD);
+  ret = get_ii32 (hash, key);
+  unlock_shard (OVERALL_SHARD);
+  return ret;
+}
+
+uint32_t
+ht_get_gz_parse (uint32_t key) {
+  uint32_t ret = 0;
+  khash_t (ii32) * hash = ht_gz_parse;
+
+  if (!hash)
+    return 0;
+
+  lock_shard (OVERALL_SHARD);
+  ret = get_ii32 (hash, key);
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 /* Get the number of elements in a datamap.
@@ -2089,12 +2781,44 @@ ht_get_last_parse (uint32_t key) {
  * Return -1 if the operation fails, else number of elements. */
 uint32_t
 ht_get_size_datamap (GModule module) {
+  uint32_t ret = 0;
   khash_t (is32) * hash = get_hash (module, MTRC_DATAMAP);
 
   if (!hash)
     return 0;
 
-  return kh_size (hash);
+  lock_shard (module);
+  ret = kh_size (hash);
+  unlock_shard (module);
+  return ret;
+}
+
+/* Estimate the number of unique visitors of a module from the union
+ * of the sketches of all its data keys.
+ *
+ * The estimate is returned. */
+static uint32_t
+count_uniq_hll (GModule module) {
+  khash_t (ihll) * hash = get_hash (module, MTRC_UNIQHLL);
+  GHLL *all = NULL;
+  uint32_t count = 0;
+  khint_t k;
+
+  if (!hash)
+    return 0;
+
+  for (k = kh_begin (hash); k != kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    if (all == NULL)
+      all = hll_new (kh_val (hash, k)->precision);
+    hll_merge (all, kh_val (hash, k));
+  }
+  if (all != NULL)
+    count = hll_count (all);
+  hll_free (all);
+
+  return count;
 }
 
 /* Get the number of elements in a uniqmap.
@@ -2103,12 +2827,16 @@ ht_get_size_datamap (GModule module) {
  * On success the number of elements in MTRC_UNIQMAP is returned */
 uint32_t
 ht_get_size_uniqmap (GModule module) {
+  uint32_t ret = 0;
   khash_t (u648) * hash = get_hash (module, MTRC_UNIQMAP);
 
   if (!hash)
     return 0;
 
-  return kh_size (hash);
+  lock_shard (module);
+  ret = conf.approx_visitors ? count_uniq_hll (module) : kh_size (hash);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the string data value of a given uint32_t key.
@@ -2117,12 +2845,16 @@ ht_get_size_uniqmap (GModule module) {
  * On success the string value for the given key is returned */
 char *
 ht_get_datamap (GModule module, uint32_t key) {
+  char *ret = NULL;
   khash_t (is32) * hash = get_hash (module, MTRC_DATAMAP);
 
   if (!hash)
     return NULL;
 
-  return get_is32 (hash, key);
+  lock_shard (module);
+  ret = get_is32 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the uint32_t value from MTRC_KEYMAP given a string key.
@@ -2131,12 +2863,16 @@ ht_get_datamap (GModule module, uint32_t key) {
  * On success the uint32_t value for the given key is returned */
 uint32_t
 ht_get_keymap (GModule module, const char *key) {
+  uint32_t ret = 0;
   khash_t (si32) * hash = get_hash (module, MTRC_KEYMAP);
 
   if (!hash)
     return 0;
 
-  return get_si32 (hash, key);
+  lock_shard (module);
+  ret = get_si32 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the uint32_t value from MTRC_UNIQMAP given a string key.
@@ -2145,12 +2881,16 @@ ht_get_keymap (GModule module, const char *key) {
  * On success the uint32_t value for the given key is returned */
 uint32_t
 ht_get_uniqmap (GModule module, const char *key) {
+  uint32_t ret = 0;
   khash_t (si32) * hash = get_hash (module, MTRC_UNIQMAP);
 
   if (!hash)
     return 0;
 
-  return get_si32 (hash, key);
+  lock_shard (module);
+  ret = get_si32 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the string root from MTRC_ROOTMAP given an uint32_t data key.
@@ -2159,6 +2899,7 @@ ht_get_uniqmap (GModule module, const char *key) {
  * On success the string value for the given key is returned */
 char *
 ht_get_root (GModule module, uint32_t key) {
+  char *ret = NULL;
   uint32_t root_key = 0;
   khash_t (ii32) * hashroot = get_hash (module, MTRC_ROOT);
   khash_t (is32) * hashrootmap = get_hash (module, MTRC_ROOTMAP);
@@ -2166,11 +2907,16 @@ ht_get_root (GModule module, uint32_t key) {
   if (!hashroot || !hashrootmap)
     return NULL;
 
+  lock_shard (module);
   /* not found */
-  if ((root_key = get_ii32 (hashroot, key)) == 0)
+  if ((root_key = get_ii32 (hashroot, key)) == 0) {
+    unlock_shard (module);
     return NULL;
+  }
 
-  return get_is32 (hashrootmap, root_key);
+  ret = get_is32 (hashrootmap, root_key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the uint32_t visitors value from MTRC_VISITORS given an uint32_t key.
@@ -2180,12 +2926,16 @@ ht_get_root (GModule module, uint32_t key) {
  * On success the uint32_t value for the given key is returned */
 uint32_t
 ht_get_visitors (GModule module, uint32_t key) {
+  uint32_t ret = 0;
   khash_t (ii32) * hash = get_hash (module, MTRC_VISITORS);
 
   if (!hash)
     return 0;
 
-  return get_ii32 (hash, key);
+  lock_shard (module);
+  ret = get_ii32 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the uint32_t visitors value from MTRC_VISITORS given an uint32_t key.
@@ -2195,12 +2945,16 @@ ht_get_visitors (GModule module, uint32_t key) {
  * On success the uint32_t value for the given key is returned */
 uint32_t
 ht_get_hits (GModule module, uint32_t key) {
+  uint32_t ret = 0;
   khash_t (ii32) * hash = get_hash (module, MTRC_HITS);
 
   if (!hash)
     return 0;
 
-  return get_ii32 (hash, key);
+  lock_shard (module);
+  ret = get_ii32 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the uint64_t value from MTRC_BW given an uint32_t key.
@@ -2209,12 +2963,16 @@ ht_get_hits (GModule module, uint32_t key) {
  * On success the uint64_t value for the given key is returned */
 uint64_t
 ht_get_bw (GModule module, uint32_t key) {
+  uint64_t ret = 0;
   khash_t (iu64) * hash = get_hash (module, MTRC_BW);
 
   if (!hash)
     return 0;
 
-  return get_iu64 (hash, key);
+  lock_shard (module);
+  ret = get_iu64 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the uint64_t value from MTRC_CUMTS given an uint32_t key.
@@ -2223,12 +2981,16 @@ ht_get_bw (GModule module, uint32_t key) {
  * On success the uint64_t value for the given key is returned */
 uint64_t
 ht_get_cumts (GModule module, uint32_t key) {
+  uint64_t ret = 0;
   khash_t (iu64) * hash = get_hash (module, MTRC_CUMTS);
 
   if (!hash)
     return 0;
 
-  return get_iu64 (hash, key);
+  lock_shard (module);
+  ret = get_iu64 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the uint64_t value from MTRC_MAXTS given an uint32_t key.
@@ -2237,12 +2999,42 @@ ht_get_cumts (GModule module, uint32_t key) {
  * On success the uint64_t value for the given key is returned */
 uint64_t
 ht_get_maxts (GModule module, uint32_t key) {
+  uint64_t ret = 0;
   khash_t (iu64) * hash = get_hash (module, MTRC_MAXTS);
 
   if (!hash)
     return 0;
 
-  return get_iu64 (hash, key);
+  lock_shard (module);
+  ret = get_iu64 (hash, key);
+  unlock_shard (module);
+  return ret;
+}
+
+/* Get the histogram of times served from MTRC_LATENCY given an
+ * uint32_t key.
+ *
+ * On error, or if key is not found, NULL is returned.
+ * On success the histogram for the given key is returned */
+GHist *
+ht_get_latency (GModule module, uint32_t key) {
+  GHist *ret = NULL;
+  khash_t (ihst) * hash = get_hash (module, MTRC_LATENCY);
+  khint_t k;
+
+  if (!hash)
+    return NULL;
+
+  lock_shard (module);
+  k = kh_get (ihst, hash, key);
+  if (k == kh_end (hash)) {
+    unlock_shard (module);
+    return NULL;
+  }
+
+  ret = kh_val (hash, k);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the string value from MTRC_METHODS given an uint32_t key.
@@ -2251,12 +3043,16 @@ ht_get_maxts (GModule module, uint32_t key) {
  * On success the string value for the given key is returned */
 char *
 ht_get_method (GModule module, uint32_t key) {
+  char *ret = NULL;
   khash_t (is32) * hash = get_hash (module, MTRC_METHODS);
 
   if (!hash)
     return NULL;
 
-  return get_is32 (hash, key);
+  lock_shard (module);
+  ret = get_is32 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the string value from MTRC_PROTOCOLS given an uint32_t key.
@@ -2265,12 +3061,16 @@ ht_get_method (GModule module, uint32_t key) {
  * On success the string value for the given key is returned */
 char *
 ht_get_protocol (GModule module, uint32_t key) {
+  char *ret = NULL;
   khash_t (is32) * hash = get_hash (module, MTRC_PROTOCOLS);
 
   if (!hash)
     return NULL;
 
-  return get_is32 (hash, key);
+  lock_shard (module);
+  ret = get_is32 (hash, key);
+  unlock_shard (module);
+  return ret;
 }
 
 /* Get the string value from ht_hostnames given a string key (IP).
@@ -2279,12 +3079,16 @@ ht_get_protocol (GModule module, uint32_t key) {
  * On success the string value for the given key is returned */
 char *
 ht_get_hostname (const char *host) {
+  char *ret = NULL;
   khash_t (ss32) * hash = ht_hostnames;
 
   if (!hash)
     return NULL;
 
-  return get_ss32 (hash, host);
+  lock_shard (OVERALL_SHARD);
+  ret = get_ss32 (hash, host);
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 /* Get the string value from ht_agent_vals (user agent) given an uint32_t key.
@@ -2293,12 +3097,16 @@ ht_get_hostname (const char *host) {
  * On success the string value for the given key is returned */
 char *
 ht_get_host_agent_val (uint32_t key) {
+  char *ret = NULL;
   khash_t (is32) * hash = ht_agent_vals;
 
   if (!hash)
     return NULL;
 
-  return get_is32 (hash, key);
+  lock_shard (OVERALL_SHARD);
+  ret = get_is32 (hash, key);
+  unlock_shard (OVERALL_SHARD);
+  return ret;
 }
 
 /* Get the list value from MTRC_AGENTS given an uint32_t key.
@@ -2310,9 +3118,11 @@ ht_get_host_agent_list (GModule module, uint32_t key) {
   khash_t (igsl) * hash = get_hash (module, MTRC_AGENTS);
   GSLList *list;
 
-  if ((list = get_igsl (hash, key)))
-    return list;
-  return NULL;
+  lock_shard (module);
+  list = get_igsl (hash, key);
+  unlock_shard (module);
+
+  return list;
 }
 
 /* Get the meta data uint64_t from MTRC_METADATA given a string key.
@@ -2322,8 +3132,13 @@ ht_get_host_agent_list (GModule module, uint32_t key) {
 uint64_t
 ht_get_meta_data (GModule module, const char *key) {
   khash_t (su64) * hash = get_hash (module, MTRC_METADATA);
+  uint64_t ret = 0;
+
+  lock_shard (module);
+  ret = get_su64 (hash, key);
+  unlock_shard (module);
 
-  return get_su64 (hash, key);
+  return ret;
 }
 
 /* Set the maximum and minimum values found on an integer key and
@@ -2338,7 +3153,9 @@ ht_get_hits_min_max (GModule module, uint32_t * min, uint32_t * max) {
   if (!hash)
     return;
 
+  lock_shard (module);
   get_ii32_min_max (hash, min, max);
+  unlock_shard (module);
 }
 
 /* Set the maximum and minimum values found on an integer key and
@@ -2353,7 +3170,9 @@ ht_get_visitors_min_max (GModule module, uint32_t * min, uint32_t * max) {
   if (!hash)
     return;
 
+  lock_shard (module);
   get_ii32_min_max (hash, min, max);
+  unlock_shard (module);
 }
 
 /* Set the maximum and minimum values found on an integer key and
@@ -2368,7 +3187,9 @@ ht_get_bw_min_max (GModule module, uint64_t * min, uint64_t * max) {
   if (!hash)
     return;
 
+  lock_shard (module);
   get_iu64_min_max (hash, min, max);
+  unlock_shard (module);
 }
 
 /* Set the maximum and minimum values found on an integer key and
@@ -2383,7 +3204,9 @@ ht_get_cumts_min_max (GModule module, uint64_t * min, uint64_t * max) {
   if (!hash)
     return;
 
+  lock_shard (module);
   get_iu64_min_max (hash, min, max);
+  unlock_shard (module);
 }
 
 /* Set the maximum and minimum values found on an integer key and
@@ -2398,7 +3221,9 @@ ht_get_maxts_min_max (GModule module, uint64_t * min, uint64_t * max) {
   if (!hash)
     return;
 
+  lock_shard (module);
   get_iu64_min_max (hash, min, max);
+  unlock_shard (module);
 }
 
 uint32_t *
@@ -2412,6 +3237,7 @@ get_sorted_dates (void) {
   if (!hash)
     return NULL;
 
+  lock_shard (OVERALL_SHARD);
   size = kh_size (hash);
   dates = xcalloc (size, sizeof (uint32_t));
   for (key = kh_begin (hash); key != kh_end (hash); ++key) {
@@ -2419,6 +3245,7 @@ get_sorted_dates (void) {
       continue;
     dates[i++] = kh_key (hash, key);
   }
+  unlock_shard (OVERALL_SHARD);
   qsort (dates, i, sizeof (uint32_t), cmp_ui32_asc);
 
   return dates;
@@ -2438,18 +3265,20 @@ free_agent_list (uint32_t agent_nkey) {
   if (!hash || !hval)
     return -1;
 
+  lock_shard (OVERALL_SHARD);
   for (k = kh_begin (hash); k != kh_end (hash); ++k) {
     if (!kh_exist (hash, k) || kh_val (hash, k) != agent_nkey)
       continue;
 
-    free ((char *) kh_key (hash, k));
+    free_str ((char *) kh_key (hash, k));
     kh_del (si32, hash, k);
   }
 
   if ((kv = kh_get (is32, hval, agent_nkey))) {
-    free ((char *) kh_val (hval, kv));
+    free_str ((char *) kh_val (hval, kv));
     kh_del (is32, hval, kv);
   }
+  unlock_shard (OVERALL_SHARD);
 
   return 0;
 }
@@ -2493,7 +3322,7 @@ free_key_by_type (GKHashMetric mtrc, uint32_t key) {
   case MTRC_TYPE_IS32:
     k = kh_get (is32, mtrc.is32, key);
     if (k != kh_end (mtrc.is32) && (value = kh_val (mtrc.is32, k))) {
-      free (value);
+      free_str (value);
       kh_del (is32, mtrc.is32, k);
     }
     break;
@@ -2501,6 +3330,20 @@ free_key_by_type (GKHashMetric mtrc, uint32_t key) {
     k = kh_get (iu64, mtrc.iu64, key);
     kh_del (iu64, mtrc.iu64, k);
     break;
+  case MTRC_TYPE_IHLL:
+    k = kh_get (ihll, mtrc.ihll, key);
+    if (k == kh_end (mtrc.ihll))
+      break;
+    hll_free (kh_val (mtrc.ihll, k));
+    kh_del (ihll, mtrc.ihll, k);
+    break;
+  case MTRC_TYPE_IHST:
+    k = kh_get (ihst, mtrc.ihst, key);
+    if (k == kh_end (mtrc.ihst))
+      break;
+    hist_free (kh_val (mtrc.ihst, k));
+    kh_del (ihst, mtrc.ihst, k);
+    break;
   case MTRC_TYPE_IGSL:
     k = kh_get (igsl, mtrc.igsl, key);
     if (k == kh_end (mtrc.igsl) || !(list = kh_val (mtrc.igsl, k)))
@@ -2528,6 +3371,418 @@ free_by_num_key (GModule module, uint32_t key) {
   }
 }
 
+/* Heavy hitters, see --heavy-hitters.
+ *
+ * A panel in heavy-hitter mode monitors up to N data keys following the
+ * Space-Saving algorithm. Each key is counted by its hits plus the hits
+ * it may have missed before being monitored (MTRC_MISSED). Once N keys
+ * are monitored, a new key evicts the one with the lowest count and
+ * inherits it as its missed hits, while the evicted key is folded into
+ * the panel's Others item. Any key with over 1/N of the panel's hits is
+ * thus monitored, and its hits are short by at most its missed hits.
+ *
+ * Evictions are made by ht_insert_hits() alone and ties are broken by
+ * key, so replaying the write-ahead log evicts the same keys. */
+static GTopKeys *
+new_top_keys (uint32_t size) {
+  GTopKeys *top = xcalloc (1, sizeof (GTopKeys));
+
+  top->size = size;
+  top->pos = new_ii32_ht ();
+  top->strs = new_is32_ht ();
+  top->others = new_ii32_ht ();
+
+  return top;
+}
+
+/* Drop the heap of monitored keys, e.g., after keys were removed from
+ * the tables, so it is rebuilt from them on the next hit. */
+static void
+reset_top_keys (GTopKeys * top) {
+  free (top->heap);
+  top->heap = NULL;
+  top->n = top->evicted = 0;
+  top->built = 0;
+  kh_clear (ii32, top->pos);
+  kh_clear (is32, top->strs);
+  kh_clear (ii32, top->others);
+}
+
+static void
+free_top_keys (GTopKeys * top) {
+  free (top->heap);
+  kh_destroy (ii32, top->pos);
+  kh_destroy (is32, top->strs);
+  kh_destroy (ii32, top->others);
+  free (top);
+}
+
+static int
+top_key_lt (const GTopKey * a, const GTopKey * b) {
+  return a->count < b->count || (a->count == b->count && a->key < b->key);
+}
+
+static void
+set_top_key (GTopKeys * top, uint32_t i, GTopKey item) {
+  top->heap[i] = item;
+  ins_ii32 (top->pos, item.key, i + 1);
+}
+
+static void
+sift_top_key_up (GTopKeys * top, uint32_t i) {
+  GTopKey item = top->heap[i];
+  uint32_t parent;
+
+  for (; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if (!top_key_lt (&item, &top->heap[parent]))
+      break;
+    set_top_key (top, i, top->heap[parent]);
+  }
+  set_top_key (top, i, item);
+}
+
+static void
+sift_top_key_down (GTopKeys * top, uint32_t i) {
+  GTopKey item = top->heap[i];
+  uint32_t child, start = i;
+
+  while ((child = 2 * i + 1) < top->n) {
+    if (child + 1 < top->n &&
+        top_key_lt (&top->heap[child + 1], &top->heap[child]))
+      child++;
+    if (!top_key_lt (&top->heap[child], &item))
+      break;
+    set_top_key (top, i, top->heap[child]);
+    i = child;
+  }
+
+  /* a key that stays put keeps its index */
+  if (i == start)
+    top->heap[i] = item;
+  else
+    set_top_key (top, i, item);
+}
+
+/* Keep track of the keymap key of a new numeric key, so it can be
+ * removed from the keymap if evicted. */
+static void
+note_top_key (GModule module, khash_t (si32) * hash, const char *key,
+              uint32_t value) {
+  GTopKeys *top = top_keys[module];
+  khint_t k;
+  int ret;
+
+  if (top == NULL || !top->built || value == 0)
+    return;
+  if ((k = kh_get (si32, hash, key)) == kh_end (hash))
+    return;
+
+  key = kh_key (hash, k);
+  k = kh_put (is32, top->strs, value, &ret);
+  if (ret != -1)
+    kh_val (top->strs, k) = (char *) key;
+}
+
+/* Determine if the given keymap key is the one of an Others item. */
+static int
+is_others_key (const char *key) {
+  const char *pch = strchr (key, '|');
+  return pch != NULL && strcmp (pch + 1, OTHERS_KEY) == 0;
+}
+
+/* Get the data key of the Others item on the date of the given keymap
+ * key, adding it if needed.
+ *
+ * On success the numeric key is returned */
+static uint32_t
+get_others_key (GModule module, GTopKeys * top, const char *key) {
+  khash_t (si32) * keymap = get_hash (module, MTRC_KEYMAP);
+  const char *pch = key ? strchr (key, '|') : NULL;
+  char *okey = NULL, *modstr = NULL;
+  size_t len = pch ? (size_t) (pch - key) : 0;
+  uint32_t others = 0;
+
+  okey = xmalloc (len + strlen (OTHERS_KEY) + 2);
+  if (len > 0)
+    memcpy (okey, key, len);
+  okey[len] = '|';
+  strcpy (okey + len + 1, OTHERS_KEY);
+
+  if ((others = get_si32 (keymap, okey)) == 0) {
+    modstr = get_module_str (module);
+    others = ins_si32_inc (keymap, okey, ht_ins_seq, modstr);
+    free (modstr);
+    ins_is32 (get_hash (module, MTRC_DATAMAP), others, OTHERS_DATA);
+    ins_ii32 (top->others, others, 1);
+  }
+  free (okey);
+
+  return others;
+}
+
+/* Remove the entries of data keys no longer in the panel from its
+ * uniqmap, these are left behind by evictions. */
+static void
+sweep_uniqmap (GModule module) {
+  khash_t (u648) * hash = get_hash (module, MTRC_UNIQMAP);
+  khash_t (is32) * datamap = get_hash (module, MTRC_DATAMAP);
+  uint32_t dk = 0, uk = 0;
+  khint_t k;
+
+  if (!hash || !datamap)
+    return;
+
+  for (k = kh_begin (hash); k != kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    u64decode (kh_key (hash, k), &dk, &uk);
+    if (kh_get (is32, datamap, dk) == kh_end (datamap))
+      kh_del (u648, hash, k);
+  }
+}
+
+/* Bring the uniqmap keys imported from the per-table files of previous
+ * versions to the (data << 32) | uniq encoding. These stored the
+ * greater key of a pair first, so the data key of each is told by the
+ * panel's datamap. A pair of two data keys is kept in both orders, an
+ * entry too many rather than a returning visitor counted again. */
+static void
+migrate_uniqmap (GModule module) {
+  khash_t (u648) * hash = get_hash (module, MTRC_UNIQMAP);
+  khash_t (is32) * datamap = get_hash (module, MTRC_DATAMAP);
+  uint64_t *swapped = NULL;
+  uint32_t hi = 0, lo = 0;
+  size_t n = 0, i;
+  khint_t k;
+
+  if (!hash || !datamap || kh_size (hash) == 0)
+    return;
+
+  swapped = xcalloc (kh_size (hash), sizeof (*swapped));
+  for (k = kh_begin (hash); k != kh_end (hash); ++k) {
+    if (!kh_exist (hash, k))
+      continue;
+    u64decode (kh_key (hash, k), &hi, &lo);
+    if (hi == lo || kh_get (is32, datamap, lo) == kh_end (datamap))
+      continue;
+    swapped[n++] = u64encode (lo, hi);
+    if (kh_get (is32, datamap, hi) == kh_end (datamap))
+      kh_del (u648, hash, k);
+  }
+
+  for (i = 0; i < n; ++i)
+    ins_u648 (hash, swapped[i], 1);
+  free (swapped);
+}
+
+/* Fold the metrics of an evicted data key into the Others item and
+ * remove the key from the panel. Changes are not logged as replaying
+ * the log evicts the key again. */
+static void
+fold_top_key (GModule module, GTopKeys * top, uint32_t key) {
+  khash_t (ii32) * hits = get_hash (module, MTRC_HITS);
+  khash_t (ii32) * visitors = get_hash (module, MTRC_VISITORS);
+  khash_t (ii32) * root = get_hash (module, MTRC_ROOT);
+  khash_t (iu64) * maxts = get_hash (module, MTRC_MAXTS);
+  khash_t (ihll) * ihll = get_hash (module, MTRC_UNIQHLL);
+  khash_t (ihst) * ihst = get_hash (module, MTRC_LATENCY);
+  khash_t (si32) * keymap = get_hash (module, MTRC_KEYMAP);
+  khash_t (igsl) * agents = get_hash (module, MTRC_AGENTS);
+  GKHashMetric mtrc;
+  uint32_t others = 0;
+  char *str = NULL;
+  khint_t k;
+  int i;
+
+  if ((k = kh_get (is32, top->strs, key)) != kh_end (top->strs)) {
+    str = kh_val (top->strs, k);
+    kh_del (is32, top->strs, k);
+  }
+  others = get_others_key (module, top, str);
+
+  inc_ii32 (hits, others, get_ii32 (hits, key));
+  if ((k = kh_get (ihll, ihll, key)) != kh_end (ihll))
+    merge_uniq_hll (module, others, kh_val (ihll, k));
+  else
+    inc_ii32 (visitors, others, get_ii32 (visitors, key));
+  inc_iu64 (get_hash (module, MTRC_BW), others,
+            get_iu64 (get_hash (module, MTRC_BW), key));
+  inc_iu64 (get_hash (module, MTRC_CUMTS), others,
+            get_iu64 (get_hash (module, MTRC_CUMTS), key));
+  if (get_iu64 (maxts, key) > get_iu64 (maxts, others))
+    ins_iu64 (maxts, others, get_iu64 (maxts, key));
+  if ((k = kh_get (ihst, ihst, key)) != kh_end (ihst))
+    merge_latency (module, others, kh_val (ihst, k));
+
+  /* panels listing items under a root list Others under its own */
+  if (get_ii32 (root, key) && !get_ii32 (root, others)) {
+    ins_ii32 (root, others, others);
+    ins_is32 (get_hash (module, MTRC_ROOTMAP), others, OTHERS_DATA);
+  }
+
+  /* agents are shared across hosts, only the host's list goes */
+  if ((k = kh_get (igsl, agents, key)) != kh_end (agents)) {
+    list_remove_nodes (kh_val (agents, k));
+    kh_del (igsl, agents, k);
+  }
+  for (i = 0; i < GSMTRC_TOTAL; ++i) {
+    mtrc = gkh_storage[module].metrics[i];
+    if (mtrc.metric != MTRC_AGENTS)
+      free_key_by_type (mtrc, key);
+  }
+
+  if (str && (k = kh_get (si32, keymap, str)) != kh_end (keymap)) {
+    free_str ((char *) kh_key (keymap, k));
+    kh_del (si32, keymap, k);
+  }
+
+  if (++top->evicted >= top->size) {
+    sweep_uniqmap (module);
+    top->evicted = 0;
+  }
+}
+
+/* Evict the monitored key with the lowest count.
+ *
+ * On success its count is returned */
+static uint32_t
+evict_top_key (GModule module, GTopKeys * top) {
+  GTopKey item = top->heap[0];
+  khint_t k;
+
+  if ((k = kh_get (ii32, top->pos, item.key)) != kh_end (top->pos))
+    kh_del (ii32, top->pos, k);
+  if (--top->n > 0) {
+    set_top_key (top, 0, top->heap[top->n]);
+    sift_top_key_down (top, 0);
+  }
+  fold_top_key (module, top, item.key);
+
+  return item.count;
+}
+
+/* Build the heap of monitored keys out of every data key with hits, and
+ * evict keys over the panel's limit, e.g., after merging databases. */
+static void
+build_top_keys (GModule module, GTopKeys * top) {
+  khash_t (si32) * keymap = get_hash (module, MTRC_KEYMAP);
+  khash_t (ii32) * hits = get_hash (module, MTRC_HITS);
+  khash_t (ii32) * missed = get_hash (module, MTRC_MISSED);
+  uint32_t i, key, n;
+  khint_t k, s;
+  int ret;
+
+  reset_top_keys (top);
+  if (!keymap || !hits || !missed)
+    return;
+
+  for (k = kh_begin (keymap); k != kh_end (keymap); ++k) {
+    if (!kh_exist (keymap, k))
+      continue;
+    if (is_others_key (kh_key (keymap, k)))
+      ins_ii32 (top->others, kh_val (keymap, k), 1);
+    s = kh_put (is32, top->strs, kh_val (keymap, k), &ret);
+    if (ret != -1)
+      kh_val (top->strs, s) = (char *) kh_key (keymap, k);
+  }
+
+  n = kh_size (hits) > top->size ? kh_size (hits) : top->size;
+  top->heap = xcalloc (n, sizeof (GTopKey));
+  for (k = kh_begin (hits); k != kh_end (hits); ++k) {
+    if (!kh_exist (hits, k) || get_ii32 (top->others, kh_key (hits, k)))
+      continue;
+    key = kh_key (hits, k);
+    top->heap[top->n].key = key;
+    top->heap[top->n++].count = kh_val (hits, k) + get_ii32 (missed, key);
+  }
+  for (i = top->n / 2; i-- > 0;)
+    sift_top_key_down (top, i);
+  for (i = 0; i < top->n; ++i)
+    ins_ii32 (top->pos, top->heap[i].key, i + 1);
+  top->built = 1;
+
+  while (top->n > top->size)
+    evict_top_key (module, top);
+}
+
+/* Count the given hits of a data key in heavy-hitter mode, monitoring
+ * the key if not already, which may evict the key with the lowest
+ * count. */
+static void
+count_top_key (GModule module, uint32_t key, uint32_t inc) {
+  GTopKeys *top = top_keys[module];
+  GTopKey item;
+  uint32_t i, missed = 0;
+
+  if (top == NULL || top_keys_paused)
+    return;
+  if (!top->built)
+    build_top_keys (module, top);
+
+  if ((i = get_ii32 (top->pos, key)) != 0) {
+    top->heap[i - 1].count += inc;
+    sift_top_key_down (top, i - 1);
+    return;
+  }
+  if (get_ii32 (top->others, key))
+    return;
+
+  if (top->n == top->size) {
+    missed = evict_top_key (module, top);
+    ins_ii32 (get_hash (module, MTRC_MISSED), key, missed);
+  }
+  item.key = key;
+  item.count = missed + inc;
+  top->heap[top->n++] = item;
+  sift_top_key_up (top, top->n - 1);
+}
+
+/* Cardinality caps, see --max-keys.
+ *
+ * Once a panel holds over N data keys, its least hit ones are folded
+ * into the Others item of their date until it holds N - N/10, so the
+ * long tail of a burst of new keys, e.g., a crawler storm, ends up in
+ * Others. The Others items and the roots cannot be evicted and are not
+ * counted. Their number as of the last round is kept, and reset as keys
+ * are removed, so that a panel is only rebuilt once it may be over N.
+ * Rounds are run by ht_insert_hits() and spare the key being hit, the
+ * only one of the current line with hits, so replaying the write-ahead
+ * log evicts the same keys. */
+static void
+cap_keys (GModule module, uint32_t hit) {
+  khash_t (si32) * keymap = get_hash (module, MTRC_KEYMAP);
+  uint32_t max = conf.max_keys[module], keep = max - max / 10, i;
+  GTopKeys *top = NULL;
+
+  if (max == 0 || top_keys_paused || !keymap ||
+      kh_size (keymap) - cap_fixed[module] <= max)
+    return;
+
+  top = new_top_keys (kh_size (keymap));
+  build_top_keys (module, top);
+  cap_fixed[module] = kh_size (keymap) - top->n;
+  /* only the keys that cannot be evicted went up */
+  if (top->n <= max) {
+    free_top_keys (top);
+    return;
+  }
+
+  if ((i = get_ii32 (top->pos, hit)) != 0) {
+    top->heap[i - 1].count = UINT32_MAX;
+    sift_top_key_down (top, i - 1);
+  }
+
+  while (top->n > keep && top->heap[0].key != hit)
+    evict_top_key (module, top);
+  cap_fixed[module] = kh_size (keymap) - top->n;
+  free_top_keys (top);
+
+  sweep_uniqmap (module);
+  if (top_keys[module])
+    reset_top_keys (top_keys[module]);
+}
+
 static int
 free_record_from_partial_uniq (GModule module, uint32_t datakey) {
   khiter_t k;
@@ -2569,7 +3824,7 @@ free_record_from_partial_key (GModule module, const char *key) {
 
     free_record_from_partial_uniq (module, kh_value (hash, k));
     free_by_num_key (module, kh_value (hash, k));
-    free ((char *) kh_key (hash, k));
+    free_str ((char *) kh_key (hash, k));
     kh_del (si32, hash, k);
   }
 
@@ -2587,14 +3842,20 @@ invalidate_date (int date) {
   if (!hash)
     return -1;
 
+  lock_all_shards ();
+  wal_log (WAL_INVALIDATE_DATE, 0, date, 0, NULL);
   key = int2str (date, 0);
   FOREACH_MODULE (idx, module_list) {
     module = module_list[idx];
     free_record_from_partial_key (module, key);
+    cap_fixed[module] = 0;
+    if (top_keys[module])
+      reset_top_keys (top_keys[module]);
   }
 
   k = kh_get (iui8, hash, date);
   kh_del (iui8, hash, k);
+  unlock_all_shards ();
 
   free (key);
 
@@ -2611,6 +3872,8 @@ clean_partial_match_hashes (int date) {
   if (!hash)
     return -1;
 
+  lock_shard (OVERALL_SHARD);
+  wal_log (WAL_CLEAN_PARTIAL, 0, date, 0, NULL);
   key = int2str (date, 0);
   len = strlen (key);
   for (k = kh_begin (hash); k != kh_end (hash); ++k) {
@@ -2620,9 +3883,10 @@ clean_partial_match_hashes (int date) {
     if (*p != '|')
       continue;
 
-    free ((char *) kh_key (hash, k));
+    free_str ((char *) kh_key (hash, k));
     kh_del (si32, hash, k);
   }
+  unlock_shard (OVERALL_SHARD);
   free (key);
 
   return 0;
@@ -2632,11 +3896,20 @@ int
 clean_full_match_hashes (int date) {
   khiter_t k;
 
+  lock_shard (OVERALL_SHARD);
+  wal_log (WAL_CLEAN_FULL, 0, date, 0, NULL);
   k = kh_get (ii32, ht_cnt_valid, date);
-  kh_del (ii32, ht_cnt_valid, k);
+  if (k != kh_end (ht_cnt_valid)) {
+    __atomic_sub_fetch (&cnt_valid, kh_val (ht_cnt_valid, k), __ATOMIC_RELAXED);
+    kh_del (ii32, ht_cnt_valid, k);
+  }
 
   k = kh_get (iu64, ht_cnt_bw, date);
-  kh_del (iu64, ht_cnt_bw, k);
+  if (k != kh_end (ht_cnt_bw)) {
+    __atomic_sub_fetch (&cnt_bw, kh_val (ht_cnt_bw, k), __ATOMIC_RELAXED);
+    kh_del (iu64, ht_cnt_bw, k);
+  }
+  unlock_shard (OVERALL_SHARD);
 
   return 0;
 }
@@ -2733,23 +4006,412 @@ GRawData *
 parse_raw_data (GModule module) {
   GRawData *raw_data = NULL;
 
+  lock_shard (module);
   if (filter_raw_num_data (module) == 0)
     raw_data = parse_raw_num_data (module);
+  unlock_shard (module);
+
   return raw_data;
 }
 
+/* Replace the given table with a new, empty, one of the same type. */
+static void
+new_table (GKHashMetric * mtrc) {
+  switch (mtrc->type) {
+  case MTRC_TYPE_IUI8:
+    mtrc->iui8 = new_iui8_ht ();
+    break;
+  case MTRC_TYPE_II32:
+    mtrc->ii32 = new_ii32_ht ();
+    break;
+  case MTRC_TYPE_U648:
+    mtrc->u648 = new_u648_ht ();
+    break;
+  case MTRC_TYPE_IS32:
+    mtrc->is32 = new_is32_ht ();
+    break;
+  case MTRC_TYPE_IU64:
+    mtrc->iu64 = new_iu64_ht ();
+    break;
+  case MTRC_TYPE_SI32:
+    mtrc->si32 = new_si32_ht ();
+    break;
+  case MTRC_TYPE_SS32:
+    mtrc->ss32 = new_ss32_ht ();
+    break;
+  case MTRC_TYPE_SGSL:
+    mtrc->sgsl = new_sgsl_ht ();
+    break;
+  case MTRC_TYPE_IGSL:
+    mtrc->igsl = new_igsl_ht ();
+    break;
+  case MTRC_TYPE_SU64:
+    mtrc->su64 = new_su64_ht ();
+    break;
+  case MTRC_TYPE_IHLL:
+    mtrc->ihll = new_ihll_ht ();
+    break;
+  case MTRC_TYPE_IHST:
+    mtrc->ihst = new_ihst_ht ();
+    break;
+  }
+}
+
+/* Merge the overall counters of a persisted database into the storage
+ * and map its unique visitor and user agent keys to the storage's. */
+static void
+merge_overall (const GKHashMetric * src, khash_t (ii32) * uniqs,
+               khash_t (ii32) * agents) {
+  khash_t (si32) * si32 = NULL;
+  khash_t (ii32) * ii32 = NULL;
+  khash_t (iu64) * iu64 = NULL;
+  const char *key = NULL;
+  uint32_t nkey = 0;
+  khint_t k;
+
+  si32 = src[OVERALL_UNIQUE_KEYS].si32;
+  for (k = kh_begin (si32); k != kh_end (si32); ++k) {
+    if (!kh_exist (si32, k))
+      continue;
+    if ((nkey = ht_insert_unique_key (kh_key (si32, k))) != 0)
+      ins_ii32 (uniqs, kh_val (si32, k), nkey);
+  }
+
+  si32 = src[OVERALL_AGENT_KEYS].si32;
+  for (k = kh_begin (si32); k != kh_end (si32); ++k) {
+    if (!kh_exist (si32, k))
+      continue;
+    key = kh_key (si32, k);
+    if ((nkey = ht_insert_agent_key (key)) == 0)
+      continue;
+    ht_insert_agent_value (nkey, key);
+    ins_ii32 (agents, kh_val (si32, k), nkey);
+  }
+
+  si32 = src[OVERALL_CNT_OVERALL].si32;
+  for (k = kh_begin (si32); k != kh_end (si32); ++k) {
+    if (kh_exist (si32, k))
+      inc_cnt_overall_key (kh_key (si32, k), kh_val (si32, k));
+  }
+
+  ii32 = src[OVERALL_CNT_VALID].ii32;
+  for (k = kh_begin (ii32); k != kh_end (ii32); ++k) {
+    if (kh_exist (ii32, k))
+      ht_inc_cnt_valid (kh_key (ii32, k), kh_val (ii32, k));
+  }
+
+  iu64 = src[OVERALL_CNT_BW].iu64;
+  for (k = kh_begin (iu64); k != kh_end (iu64); ++k) {
+    if (kh_exist (iu64, k))
+      ht_inc_cnt_bw (kh_key (iu64, k), kh_val (iu64, k));
+  }
+
+  /* checkpoints of the other node's logs mean nothing here, only the
+   * last timestamp read from a pipe is kept */
+  ii32 = src[OVERALL_LAST_PARSE].ii32;
+  if ((nkey = get_ii32 (ii32, 0)) > ht_get_last_parse (0))
+    ht_insert_last_parse (0, nkey);
+}
+
+/* Merge the tables of a module from a persisted database into the
+ * storage. Its keys are remapped into the storage's keymap by their
+ * string value. A visitor already counted for the same data key is
+ * counted once. */
+static void
+merge_module (GModule module, const GKHashMetric * src,
+              khash_t (ii32) * uniqs, khash_t (ii32) * agents) {
+  khash_t (ii32) * keys = new_ii32_ht (), *dups = new_ii32_ht ();
+  khash_t (si32) * si32 = NULL;
+  khash_t (ii32) * ii32 = NULL;
+  khash_t (is32) * is32 = NULL;
+  khash_t (iu64) * iu64 = NULL;
+  khash_t (u648) * u648 = NULL;
+  khash_t (igsl) * igsl = NULL;
+  khash_t (su64) * su64 = NULL;
+  khash_t (ihll) * ihll = NULL;
+  khash_t (ihst) * ihst = NULL;
+  GSLList *node = NULL;
+  uint32_t nkey = 0, dkey = 0, ukey = 0, dup = 0, val = 0;
+  khint_t k;
+
+  si32 = src[MTRC_KEYMAP].si32;
+  for (k = kh_begin (si32); k != kh_end (si32); ++k) {
+    if (!kh_exist (si32, k))
+      continue;
+    if ((nkey = ht_insert_keymap (module, kh_key (si32, k))) != 0)
+      ins_ii32 (keys, kh_val (si32, k), nkey);
+  }
+
+  is32 = src[MTRC_DATAMAP].is32;
+  for (k = kh_begin (is32); k != kh_end (is32); ++k) {
+    if (kh_exist (is32, k) && (nkey = get_ii32 (keys, kh_key (is32, k))))
+      ht_insert_datamap (module, nkey, kh_val (is32, k));
+  }
+
+  is32 = src[MTRC_ROOTMAP].is32;
+  for (k = kh_begin (is32); k != kh_end (is32); ++k) {
+    if (kh_exist (is32, k) && (nkey = get_ii32 (keys, kh_key (is32, k))))
+      ht_insert_rootmap (module, nkey, kh_val (is32, k));
+  }
+
+  ii32 = src[MTRC_ROOT].ii32;
+  for (k = kh_begin (ii32); k != kh_end (ii32); ++k) {
+    if (kh_exist (ii32, k) && (nkey = get_ii32 (keys, kh_key (ii32, k))))
+      ht_insert_root (module, nkey, get_ii32 (keys, kh_val (ii32, k)));
+  }
+
+  /* unique visitors are unioned, those already in the storage are
+   * taken off the visitors counter below */
+  u648 = src[MTRC_UNIQMAP].u648;
+  for (k = kh_begin (u648); k != kh_end (u648); ++k) {
+    if (!kh_exist (u648, k))
+      continue;
+    u64decode (kh_key (u648, k), &dkey, &ukey);
+    if (!(nkey = get_ii32 (keys, dkey)) || !(ukey = get_ii32 (uniqs, ukey)))
+      continue;
+    if (ht_insert_uniqmap (module, nkey, ukey) == 0)
+      inc_ii32 (dups, nkey, 1);
+  }
+
+  ii32 = src[MTRC_VISITORS].ii32;
+  for (k = kh_begin (ii32); k != kh_end (ii32); ++k) {
+    if (!kh_exist (ii32, k) || !(nkey = get_ii32 (keys, kh_key (ii32, k))))
+      continue;
+    val = kh_val (ii32, k);
+    dup = get_ii32 (dups, nkey);
+    ht_insert_visitor (module, nkey, val > dup ? val - dup : 0);
+  }
+
+  /* sketches of approximated visitors are unioned, their estimate
+   * replacing the counter added up above */
+  ihll = src[MTRC_UNIQHLL].ihll;
+  for (k = kh_begin (ihll); k != kh_end (ihll); ++k) {
+    if (kh_exist (ihll, k) && (nkey = get_ii32 (keys, kh_key (ihll, k))))
+      merge_uniq_hll (module, nkey, kh_val (ihll, k));
+  }
+
+  ii32 = src[MTRC_HITS].ii32;
+  for (k = kh_begin (ii32); k != kh_end (ii32); ++k) {
+    if (kh_exist (ii32, k) && (nkey = get_ii32 (keys, kh_key (ii32, k))))
+      ht_insert_hits (module, nkey, kh_val (ii32, k));
+  }
+
+  ii32 = src[MTRC_MISSED].ii32;
+  for (k = kh_begin (ii32); k != kh_end (ii32); ++k) {
+    if (kh_exist (ii32, k) && (nkey = get_ii32 (keys, kh_key (ii32, k))))
+      inc_ii32 (get_hash (module, MTRC_MISSED), nkey, kh_val (ii32, k));
+  }
+
+  iu64 = src[MTRC_BW].iu64;
+  for (k = kh_begin (iu64); k != kh_end (iu64); ++k) {
+    if (kh_exist (iu64, k) && (nkey = get_ii32 (keys, kh_key (iu64, k))))
+      ht_insert_bw (module, nkey, kh_val (iu64, k));
+  }
+
+  iu64 = src[MTRC_CUMTS].iu64;
+  for (k = kh_begin (iu64); k != kh_end (iu64); ++k) {
+    if (kh_exist (iu64, k) && (nkey = get_ii32 (keys, kh_key (iu64, k))))
+      ht_insert_cumts (module, nkey, kh_val (iu64, k));
+  }
+
+  ihst = src[MTRC_LATENCY].ihst;
+  for (k = kh_begin (ihst); k != kh_end (ihst); ++k) {
+    if (kh_exist (ihst, k) && (nkey = get_ii32 (keys, kh_key (ihst, k))))
+      merge_latency (module, nkey, kh_val (ihst, k));
+  }
+
+  iu64 = src[MTRC_MAXTS].iu64;
+  for (k = kh_begin (iu64); k != kh_end (iu64); ++k) {
+    if (kh_exist (iu64, k) && (nkey = get_ii32 (keys, kh_key (iu64, k))))
+      ht_insert_maxts (module, nkey, kh_val (iu64, k));
+  }
+
+  is32 = src[MTRC_METHODS].is32;
+  for (k = kh_begin (is32); k != kh_end (is32); ++k) {
+    if (kh_exist (is32, k) && (nkey = get_ii32 (keys, kh_key (is32, k))))
+      ht_insert_method (module, nkey, kh_val (is32, k));
+  }
+
+  is32 = src[MTRC_PROTOCOLS].is32;
+  for (k = kh_begin (is32); k != kh_end (is32); ++k) {
+    if (kh_exist (is32, k) && (nkey = get_ii32 (keys, kh_key (is32, k))))
+      ht_insert_protocol (module, nkey, kh_val (is32, k));
+  }
+
+  igsl = src[MTRC_AGENTS].igsl;
+  for (k = kh_begin (igsl); k != kh_end (igsl); ++k) {
+    if (!kh_exist (igsl, k) || !(nkey = get_ii32 (keys, kh_key (igsl, k))))
+      continue;
+    for (node = kh_val (igsl, k); node != NULL; node = node->next) {
+      if ((val = get_ii32 (agents, (*(uint32_t *) node->data))))
+        ht_insert_agent (module, nkey, val);
+    }
+  }
+
+  su64 = src[MTRC_METADATA].su64;
+  for (k = kh_begin (su64); k != kh_end (su64); ++k) {
+    if (kh_exist (su64, k))
+      ht_insert_meta_data (module, kh_key (su64, k), kh_val (su64, k));
+  }
+
+  des_ii32 (keys);
+  des_ii32 (dups);
+}
+
+static void *
+merge_worker (void *ptr_data) {
+  GKHashMergeTasks *tasks = ptr_data;
+  size_t idx;
+
+  for (;;) {
+    pthread_mutex_lock (&tasks->mutex);
+    idx = tasks->next++;
+    pthread_mutex_unlock (&tasks->mutex);
+
+    if (idx >= TOTAL_MODULES || module_list[idx] == -1)
+      break;
+    merge_module (module_list[idx],
+                  tasks->mtrcs + OVERALL_TOTAL + idx * GSMTRC_TOTAL,
+                  tasks->uniqs, tasks->agents);
+  }
+
+  return NULL;
+}
+
+/* Merge the panels of a restored database, one task per panel, spread
+ * across up to MERGE_THREADS threads. Each panel is a shard of its own,
+ * so the threads only contend on the key sequences and the tables used
+ * across the whole app. The calling thread takes part in merging them. */
+static void
+merge_modules (const GKHashMetric * mtrcs, khash_t (ii32) * uniqs,
+               khash_t (ii32) * agents) {
+  pthread_t threads[MERGE_THREADS - 1];
+  GKHashMergeTasks tasks;
+  long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+  size_t idx = 0;
+  int i, npanels = 0, writers = MERGE_THREADS, nthreads = 0;
+
+  memset (&tasks, 0, sizeof (GKHashMergeTasks));
+  tasks.mtrcs = mtrcs;
+  tasks.uniqs = uniqs;
+  tasks.agents = agents;
+  pthread_mutex_init (&tasks.mutex, NULL);
+
+  FOREACH_MODULE (idx, module_list)
+    npanels++;
+  if (writers > npanels)
+    writers = npanels;
+  if (writers > ncpu)
+    writers = ncpu;
+  share_storage (writers);
+
+  for (i = 1; i < writers; ++i) {
+    if (pthread_create (&threads[nthreads], NULL, merge_worker, &tasks) != 0)
+      break;
+    nthreads++;
+  }
+  merge_worker (&tasks);
+
+  for (i = 0; i < nthreads; ++i)
+    pthread_join (threads[i], NULL);
+  pthread_mutex_destroy (&tasks.mutex);
+  share_storage (1);
+}
+
+/* Merge the database persisted under the given path, e.g., by another
+ * node, into the storage. Its tables are restored aside first. */
+static void
+merge_db (const char *dir) {
+  GKHashMetric *mtrcs = NULL;
+  GKDB *db = NULL;
+  khash_t (ii32) * uniqs = NULL, *agents = NULL;
+  char *path = NULL;
+  int i, n = 0;
+
+  path = xmalloc (snprintf (NULL, 0, "%s/%s", dir, GKDB_FILENAME) + 1);
+  sprintf (path, "%s/%s", dir, GKDB_FILENAME);
+  if ((db = gkdb_open (path)) == NULL)
+    FATAL ("Unable to open database %s: %s", path, strerror (errno));
+  free (path);
+
+  n = get_persisted_tables (&mtrcs, 1);
+  for (i = 0; i < n; i++)
+    new_table (&mtrcs[i]);
+  gkdb_restore_tables (db, mtrcs, n);
+
+  uniqs = new_ii32_ht ();
+  agents = new_ii32_ht ();
+  merge_overall (mtrcs, uniqs, agents);
+  merge_modules (mtrcs, uniqs, agents);
+  des_ii32 (uniqs);
+  des_ii32 (agents);
+
+  /* restored strings live in the mapping, they are left alone */
+  for (i = 0; i < n; i++)
+    free_metric_type (mtrcs[i]);
+  free_persisted_tables (mtrcs, n);
+  gkdb_close (db);
+}
+
+/* Merge the databases given through --merge-db, each a comma separated
+ * list of paths, into the storage. With --wal, the merged data is
+ * persisted right away, as the log only holds changes made on top of
+ * the database. */
+static void
+merge_data (void) {
+  char *paths = NULL, *dir = NULL, *saveptr = NULL;
+  size_t idx = 0;
+  int i;
+
+  /* capped panels, and those in heavy-hitter mode, keep their heaviest
+   * keys once merged */
+  top_keys_paused = 1;
+  for (i = 0; i < conf.merge_db_idx; i++) {
+    paths = xstrdup (conf.merge_dbs[i]);
+    dir = strtok_r (paths, ",", &saveptr);
+    for (; dir != NULL; dir = strtok_r (NULL, ",", &saveptr))
+      merge_db (dir);
+    free (paths);
+  }
+  top_keys_paused = 0;
+  FOREACH_MODULE (idx, module_list) {
+    cap_keys (module_list[idx], 0);
+    if (top_keys[module_list[idx]])
+      build_top_keys (module_list[idx], top_keys[module_list[idx]]);
+  }
+
+  if (!conf.persist || !conf.wal)
+    return;
+  if (persist_data () != 0)
+    FATAL ("Unable to persist merged data.");
+  purge_wal (wal_lsn ());
+}
+
+/* Set the number of threads writing to the storage at once. With more
+ * than one, each ht_* call locks the shard it touches, so writers to
+ * distinct panels don't wait on each other, while keys are still handed
+ * out by a single sequence per table. It must be set while no other
+ * thread uses the storage. */
+void
+share_storage (int writers) {
+  shard_writers = writers < 1 ? 1 : writers;
+}
+
 /* Initialize hash tables */
 void
 init_storage (void) {
   GModule module;
   size_t idx = 0;
 
+  init_shard_locks ();
+
   /* Hashes used across the whole app (not per module) */
   /* *INDENT-OFF* */
   ht_agent_keys  = (khash_t (si32) *) new_si32_ht ();
   ht_agent_vals  = (khash_t (is32) *) new_is32_ht ();
   ht_dates       = (khash_t (iui8) *) new_iui8_ht ();
   ht_hostnames   = (khash_t (ss32) *) new_ss32_ht ();
+  ht_hostname_ts = (khash_t (si32) *) new_si32_ht ();
   ht_seqs        = (khash_t (si32) *) new_si32_ht ();
   ht_unique_keys = (khash_t (si32) *) new_si32_ht ();
 
@@ -2757,6 +4419,7 @@ init_storage (void) {
   ht_last_parse  = (khash_t (ii32) *) new_ii32_ht ();
   ht_cnt_valid   = (khash_t (ii32) *) new_ii32_ht ();
   ht_cnt_bw      = (khash_t (iu64) *) new_iu64_ht ();
+  ht_gz_parse    = (khash_t (ii32) *) new_ii32_ht ();
   /* *INDENT-ON* */
 
   gkh_storage = new_gkhstorage (TOTAL_MODULES);
@@ -2765,10 +4428,25 @@ init_storage (void) {
 
     gkh_storage[module].module = module;
     init_tables (module);
+    if (conf.heavy_hitters[module] > 0)
+      top_keys[module] = new_top_keys (conf.heavy_hitters[module]);
   }
 
   if (conf.restore)
     restore_data ();
+  /* persisting anew, the log left behind extends the data replaced */
+  else if (conf.persist)
+    purge_wal (UINT64_MAX);
+
+  if (conf.merge_db_idx > 0)
+    merge_data ();
+
+  if (conf.dns_cache_ttl)
+    load_hostnames ();
+
+  if (conf.persist && conf.wal)
+    open_wal ();
+  snapshot_time = time (NULL);
 }
 
 /* Destroys the hash structure and its content */
@@ -2779,13 +4457,18 @@ free_storage (void) {
   if (!gkh_storage)
     return;
 
-  if (conf.persist)
-    persist_data ();
+  stop_snapshot ();
+  wal_close ();
+  if (conf.persist && persist_data () == 0)
+    purge_wal (wal_lsn ());
+  if (conf.dns_cache_ttl)
+    store_hostnames ();
 
   des_si32_free (ht_unique_keys);
   des_is32_free (ht_agent_vals);
   des_si32_free (ht_agent_keys);
   des_ss32_free (ht_hostnames);
+  des_si32_free (ht_hostname_ts);
   des_si32_free (ht_seqs);
   des_iui8 (ht_dates);
 
@@ -2793,9 +4476,18 @@ free_storage (void) {
   des_ii32 (ht_last_parse);
   des_ii32 (ht_cnt_valid);
   des_iu64 (ht_cnt_bw);
+  des_ii32 (ht_gz_parse);
+  memset (cnt_overall, 0, sizeof (cnt_overall));
+  cnt_valid = cnt_bw = 0;
 
   FOREACH_MODULE (idx, module_list) {
     free_metrics (module_list[idx]);
+    if (top_keys[module_list[idx]])
+      free_top_keys (top_keys[module_list[idx]]);
+    top_keys[module_list[idx]] = NULL;
   }
   free (gkh_storage);
+  gkdb_close (gkh_db);
+  gkh_db = NULL;
+  free_shard_locks ();
 }
@@ -32,11 +32,18 @@
 
 #include <stdint.h>
 
+#include "ghist.h"
+#include "ghll.h"
 #include "gslist.h"
 #include "gstorage.h"
 #include "khash.h"
 #include "parser.h"
 
+/* Hostnames kept across runs, see --dns-cache-ttl */
+#define HOSTNAMES_FILENAME "SS32_HOSTNAMES.db"
+
+#define MERGE_THREADS 8 /* max threads merging a database */
+
 /* uint32_t keys, char payload */
 KHASH_MAP_INIT_INT (iui8, uint8_t);
 /* uint32_t keys, uint32_t payload */
@@ -57,6 +64,14 @@ KHASH_MAP_INIT_INT (igsl, GSLList *);
 KHASH_MAP_INIT_STR (su64, uint64_t);
 /* uint64_t key, uint32_t payload */
 KHASH_MAP_INIT_INT64 (u648, uint8_t);
+/* uint32_t keys, GHLL payload */
+KHASH_MAP_INIT_INT (ihll, GHLL *);
+/* uint32_t keys, GHist payload */
+KHASH_MAP_INIT_INT (ihst, GHist *);
+
+/* Data of the item evicted keys are folded into, keyed as date|key */
+#define OTHERS_KEY  "\x1fOthers"
+#define OTHERS_DATA "Others"
 
 /* Metrics Storage */
 
@@ -162,6 +177,33 @@ KHASH_MAP_INIT_INT64 (u648, uint8_t);
  */
 /*khash_t(igsl) MTRC_AGENTS */
 
+/* Maps numeric data keys to a HyperLogLog sketch of their unique
+ * visitors, used instead of MTRC_UNIQMAP with --approx-visitors.
+ * 1 -> {precision 12, sparse, 3 registers set}
+ */
+/*khash_t(ihll) MTRC_UNIQHLL */
+
+/* Maps numeric data keys to the hits they may have had before being
+ * monitored, see --heavy-hitters.
+ * 1 -> 12
+ * 2 -> 12
+ */
+/*khash_t(ii32) MTRC_MISSED */
+
+/* Maps numeric data keys to a histogram of their times served, see
+ * --latency-percentiles.
+ * 1 -> {3 buckets hit, 24 values}
+ */
+/*khash_t(ihst) MTRC_LATENCY */
+
+/* Overall counters, see ht_inc_cnt_overall() */
+typedef enum GCntOverall_ {
+  CNT_PROCESSED,
+  CNT_INVALID,
+  CNT_EXCLUDED_IP,
+  CNT_OVERALL_TOTAL,
+} GCntOverall;
+
 /* Enumerated Storage Metrics */
 typedef enum GSMetricType_ {
   /* uint32_t key - uint32_t val */
@@ -184,6 +226,10 @@ typedef enum GSMetricType_ {
   MTRC_TYPE_IUI8,
   /* uint64_t key - uint32_t val */
   MTRC_TYPE_U648,
+  /* uint32_t key - GHLL val */
+  MTRC_TYPE_IHLL,
+  /* uint32_t key - GHist val */
+  MTRC_TYPE_IHST,
 } GSMetricType;
 
 typedef struct GKHashMetric_ {
@@ -200,14 +246,37 @@ typedef struct GKHashMetric_ {
     khash_t (igsl) * igsl;
     khash_t (su64) * su64;
     khash_t (u648) * u648;
+    khash_t (ihll) * ihll;
+    khash_t (ihst) * ihst;
   };
   const char *filename;
 } GKHashMetric;
 
 /* Data Storage per module */
+/* A data key monitored by a panel in heavy-hitter mode, counted by its
+ * hits plus the hits it may have missed */
+typedef struct GTopKey_ {
+  uint32_t key;
+  uint32_t count;
+} GTopKey;
+
+/* The data keys monitored by a panel in heavy-hitter mode, kept in a
+ * min-heap by count (then key) so the key evicted next is at its top */
+typedef struct GTopKeys_ {
+  uint32_t size;                /* max number of keys monitored */
+  uint32_t n;                   /* keys in the heap */
+  uint32_t evicted;             /* evictions since the last uniqmap sweep */
+  int built;                    /* heap built from the panel's tables */
+  GTopKey *heap;
+  khash_t (ii32) * pos;         /* data key -> heap index + 1 */
+  khash_t (is32) * strs;        /* numeric key -> keymap key, not owned */
+  khash_t (ii32) * others;      /* data keys of the Others items */
+} GTopKeys;
+
 typedef struct GKHashStorage_ {
   GModule module;
   GKHashMetric metrics[GSMTRC_TOTAL];
+  int pending;                  /* tables not yet restored, see --lazy-restore */
 } GKHashStorage;
 
 char *ht_get_datamap (GModule module, uint32_t key);
@@ -224,15 +293,19 @@ int ht_insert_bw (GModule module, uint32_t key, uint64_t inc);
 int ht_insert_cumts (GModule module, uint32_t key, uint64_t inc);
 int ht_insert_datamap (GModule module, uint32_t key, const char *value);
 int ht_insert_hostname (const char *ip, const char *host);
+int ht_insert_gz_parse (uint32_t key, uint32_t value);
 int ht_insert_last_parse (uint32_t key, uint32_t value);
 int ht_insert_maxts (GModule module, uint32_t key, uint64_t value);
+int ht_insert_latency (GModule module, uint32_t key, uint64_t value);
 int ht_insert_meta_data (GModule module, const char *key, uint64_t value);
 int ht_insert_method (GModule module, uint32_t key, const char *value);
 int ht_insert_protocol (GModule module, uint32_t key, const char *value);
 int ht_insert_root (GModule module, uint32_t key, uint32_t value);
 int ht_insert_rootmap (GModule module, uint32_t key, const char *value);
+int ht_insert_uniq_hll (GModule module, uint32_t key, uint64_t value);
 int ht_insert_uniqmap (GModule module, uint32_t key, uint32_t value);
 int invalidate_date (int date);
+int snapshot_due (void);
 uint32_t *get_sorted_dates (void);
 uint32_t ht_get_date (uint32_t date);
 uint32_t ht_get_excluded_ips (void);
@@ -240,6 +313,7 @@ uint32_t ht_get_hits (GModule module, uint32_t key);
 uint32_t ht_get_invalid (void);
 uint32_t ht_get_invalid (void);
 uint32_t ht_get_keymap (GModule module, const char *key);
+uint32_t ht_get_gz_parse (uint32_t key);
 uint32_t ht_get_last_parse (uint32_t key);
 uint32_t ht_get_processed (void);
 uint32_t ht_get_size_datamap (GModule module);
@@ -248,7 +322,7 @@ uint32_t ht_get_size_uniqmap (GModule module);
 uint32_t ht_get_uniqmap (GModule module, const char *key);
 uint32_t ht_get_visitors (GModule module, uint32_t key);
 uint32_t ht_inc_cnt_bw (uint32_t key, uint64_t val);
-uint32_t ht_inc_cnt_overall (const char *key, uint32_t val);
+uint32_t ht_inc_cnt_overall (GCntOverall cnt, uint32_t val);
 uint32_t ht_inc_cnt_valid (uint32_t key, uint32_t val);
 uint32_t ht_insert_agent_key (const char *key);
 uint32_t ht_insert_agent_seq (const char *key);
@@ -262,6 +336,7 @@ uint32_t ht_sum_valid (void);
 uint64_t ht_get_bw (GModule module, uint32_t key);
 uint64_t ht_get_cumts (GModule module, uint32_t key);
 uint64_t ht_get_maxts (GModule module, uint32_t key);
+GHist *ht_get_latency (GModule module, uint32_t key);
 uint64_t ht_get_meta_data (GModule module, const char *key);
 uint64_t ht_sum_bw (void);
 void free_sgls_metrics (GModule module);
@@ -272,6 +347,8 @@ void ht_get_hits_min_max (GModule module, uint32_t * min, uint32_t * max);
 void ht_get_maxts_min_max (GModule module, uint64_t * min, uint64_t * max);
 void ht_get_visitors_min_max (GModule module, uint32_t * min, uint32_t * max);
 void init_storage (void);
+void share_storage (int writers);
+void snapshot_storage (void);
 
 GRawData *parse_raw_data (GModule module);
 GSLList *ht_get_host_agent_list (GModule module, uint32_t key);
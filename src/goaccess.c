@@ -91,6 +91,9 @@ int active_gdns = 0;
 /* WebSocket server - writer and reader threads */
 static GWSWriter *gwswriter;
 static GWSReader *gwsreader;
+/* Last report published to WebSocket clients, see publish_report() */
+static GReport *report = NULL;
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* Dashboard data structure */
 static GDash *dash;
 /* Data holder structure */
@@ -129,6 +132,66 @@ static GScroll gscroll = {
 };
 /* *INDENT-ON* */
 
+/* Drop a reference to the given report, freeing it along with the last
+ * one. */
+static void
+release_report (GReport * r) {
+  int refs = 0;
+
+  if (r == NULL)
+    return;
+
+  pthread_mutex_lock (&report_mutex);
+  refs = --r->refs;
+  pthread_mutex_unlock (&report_mutex);
+
+  if (refs == 0) {
+    free (r->json);
+    free (r);
+  }
+}
+
+/* Get a reference to the current report, to be released once sent.
+ * Readers only wait for the pointer to be swapped, never for a report
+ * to be generated. Reading the pointer and taking the reference must
+ * not be split by a publisher dropping the last one, which atomics
+ * alone don't guarantee without deferring the free, hence the mutex.
+ *
+ * If none was published, NULL is returned. */
+static GReport *
+acquire_report (void) {
+  GReport *r = NULL;
+
+  pthread_mutex_lock (&report_mutex);
+  if ((r = report) != NULL)
+    r->refs++;
+  pthread_mutex_unlock (&report_mutex);
+
+  return r;
+}
+
+/* Publish the given JSON report, taking ownership of it, or drop the
+ * current one given NULL. Readers holding the previous report keep it
+ * until they release it. */
+static void
+publish_report (char *json) {
+  GReport *r = NULL, *old = NULL;
+
+  if (json != NULL) {
+    r = xcalloc (1, sizeof (GReport));
+    r->json = json;
+    r->len = strlen (json);
+    r->refs = 1;
+  }
+
+  pthread_mutex_lock (&report_mutex);
+  old = report;
+  report = r;
+  pthread_mutex_unlock (&report_mutex);
+
+  release_report (old);
+}
+
 /* Free malloc'd holder */
 static void
 house_keeping_holder (void) {
@@ -155,7 +218,7 @@ house_keeping (void) {
   /* DASHBOARD */
   if (dash && !conf.output_stdout) {
     free_dashboard (dash);
-    reset_find ();
+    free_find ();
   }
 
   /* GEOLOCATION */
@@ -164,9 +227,11 @@ house_keeping (void) {
 #endif
 
   /* LOGGER */
+  greader_free (glog->reader);
   if (glog->pipe)
     fclose (glog->pipe);
   free_logerrors (glog);
+  free_json_log_format ();
   free (glog);
 
   /* INVALID REQUESTS */
@@ -193,6 +258,8 @@ house_keeping (void) {
   free (gwswriter);
   /* WebSocket reader */
   free (gwsreader);
+  /* report sent to WebSocket clients */
+  publish_report (NULL);
 }
 
 static void
@@ -477,7 +544,7 @@ load_ip_agent_list (void) {
   int type_ip = 0;
   /* make sure we have a valid IP */
   int sel = gscroll.module[gscroll.current].scroll;
-  GDashData item = dash->module[HOSTS].data[sel];
+  GDashData item = *get_dash_data (&dash->module[HOSTS], sel);
 
   if (!invalid_ipaddr (item.metrics->data, &type_ip))
     load_agent_list (main_win, item.metrics->data, item.metrics->keys);
@@ -684,33 +751,30 @@ tail_html (void) {
 
   allocate_holder ();
 
-  pthread_mutex_lock (&gdns_thread.mutex);
+  /* the holder and the tables it reads are only changed by this thread,
+   * resolved hostnames aside, which the report doesn't read */
   json = get_json (holder, 0);
-  pthread_mutex_unlock (&gdns_thread.mutex);
-
   if (json == NULL)
     return;
 
   broadcast_holder (gwswriter->fd, json, strlen (json));
-  free (json);
+  publish_report (json);
 }
 
-/* Fast-forward latest JSON data when client connection is opened. */
+/* Fast-forward latest JSON data when client connection is opened. The
+ * report last broadcast is sent as is, so a new client never waits for
+ * one to be generated, nor holds up the parser or the resolver. */
 static void
 fast_forward_client (int listener) {
-  char *json = NULL;
+  GReport *r = NULL;
 
-  pthread_mutex_lock (&gdns_thread.mutex);
-  json = get_json (holder, 0);
-  pthread_mutex_unlock (&gdns_thread.mutex);
-
-  if (json == NULL)
+  if ((r = acquire_report ()) == NULL)
     return;
 
   pthread_mutex_lock (&gwswriter->mutex);
-  send_holder_to_client (gwswriter->fd, listener, json, strlen (json));
+  send_holder_to_client (gwswriter->fd, listener, r->json, r->len);
   pthread_mutex_unlock (&gwswriter->mutex);
-  free (json);
+  release_report (r);
 }
 
 /* Start reading data coming from the client side through the
@@ -763,6 +827,22 @@ parse_tail_follow (FILE * fp) {
   }
 }
 
+/* Parse lines read from the pipe so far */
+static void
+parse_tail_pipe (void) {
+  char *line = NULL;
+
+  if (glog->reader == NULL)
+    return;
+
+  while ((line = greader_getline (glog->reader, 0)) != NULL) {
+    pthread_mutex_lock (&gdns_thread.mutex);
+    parse_log (&glog, line, 0);
+    pthread_mutex_unlock (&gdns_thread.mutex);
+    glog->read++;
+  }
+}
+
 /* Process appended log data */
 static void
 perform_tail_follow (uint64_t * size1, const char *fn) {
@@ -771,7 +851,7 @@ perform_tail_follow (uint64_t * size1, const char *fn) {
   struct stat fdstat;
 
   if (fn[0] == '-' && fn[1] == '\0') {
-    parse_tail_follow (glog->pipe);
+    parse_tail_pipe ();
     goto out;
   }
   if (glog->load_from_disk_only)
@@ -835,6 +915,9 @@ process_html (const char *filename) {
   if (gwswriter->fd == -1)
     return;
 
+  /* sent to clients connecting before the first update */
+  publish_report (get_json (holder, 0));
+
   size1 = xcalloc (conf.filenames_idx, sizeof (uint64_t));
   for (i = 0; i < conf.filenames_idx; ++i) {
     if (conf.filenames[i][0] == '-' && conf.filenames[i][1] == '\0')
@@ -1475,6 +1558,9 @@ main (int argc, char **argv) {
 
   /* init reverse lookup thread */
   gdns_init ();
+  /* resolve the hosts of the report ahead */
+  if (conf.output_stdout && conf.enable_html_resolver)
+    gdns_thread_create ();
   parse_initial_sort ();
   allocate_holder ();
 
@@ -32,6 +32,14 @@
 
 #include "ui.h"
 
+/* A report published to the WebSocket clients. It is immutable once
+ * published and freed once replaced and sent to no one. */
+typedef struct GReport_ {
+  char *json;
+  size_t len;
+  int refs;                     /* readers, plus one while current */
+} GReport;
+
 extern GSpinner *parsing_spinner;
 extern int active_gdns;         /* kill dns pthread flag */
 
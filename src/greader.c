@@ -0,0 +1,415 @@
+/**
+ * greader.c -- threaded reader for piped log data
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "greader.h"
+
+#include "error.h"
+#include "settings.h"
+#include "xmalloc.h"
+
+/* Determine if the reader was asked to stop. */
+static int
+reader_stopped (GReader * reader) {
+  int stop;
+
+  pthread_mutex_lock (&reader->mutex);
+  stop = reader->stop;
+  pthread_mutex_unlock (&reader->mutex);
+
+  return stop;
+}
+
+/* Set the idle state of the reader and wake up the consumer if the
+ * input has been drained. */
+static void
+set_idle (GReader * reader, int idle) {
+  pthread_mutex_lock (&reader->mutex);
+  reader->idle = idle;
+  if (idle)
+    pthread_cond_signal (&reader->not_empty);
+  pthread_mutex_unlock (&reader->mutex);
+}
+
+/* Wait for a free batch in the ring.
+ *
+ * If the reader was asked to stop, NULL is returned.
+ * On success, an empty batch is returned. */
+static GLineBatch *
+acquire_batch (GReader * reader) {
+  GLineBatch *batch = NULL;
+
+  pthread_mutex_lock (&reader->mutex);
+  while (reader->count == READER_BATCHES && !reader->stop)
+    pthread_cond_wait (&reader->not_full, &reader->mutex);
+  if (!reader->stop)
+    batch = &reader->batches[(reader->head + reader->count) % READER_BATCHES];
+  pthread_mutex_unlock (&reader->mutex);
+
+  if (batch) {
+    batch->len = 0;
+    batch->nlines = 0;
+  }
+
+  return batch;
+}
+
+/* Hand the given batch over to the consumer. Empty batches are kept
+ * by the reader.
+ *
+ * If the batch was queued, NULL is returned.
+ * Otherwise, the given batch is returned. */
+static GLineBatch *
+push_batch (GReader * reader, GLineBatch * batch) {
+  if (batch == NULL || batch->nlines == 0)
+    return batch;
+
+  pthread_mutex_lock (&reader->mutex);
+  reader->count++;
+  pthread_cond_signal (&reader->not_empty);
+  pthread_mutex_unlock (&reader->mutex);
+
+  return NULL;
+}
+
+/* Append the carried over partial line followed by the given segment
+ * to the batch as a single NUL-terminated line. */
+static void
+batch_add (GReader * reader, GLineBatch * batch, const char *s, size_t len) {
+  size_t need = batch->len + reader->plen + len + 1;
+
+  if (need > batch->size) {
+    batch->size = need + need / 2;
+    if (batch->size < READER_BATCH_SIZE)
+      batch->size = READER_BATCH_SIZE;
+    batch->buf = xrealloc (batch->buf, batch->size);
+  }
+
+  memcpy (batch->buf + batch->len, reader->part, reader->plen);
+  batch->len += reader->plen;
+  memcpy (batch->buf + batch->len, s, len);
+  batch->len += len;
+  batch->buf[batch->len++] = '\0';
+  batch->nlines++;
+
+  reader->plen = 0;
+}
+
+/* Keep an incomplete line until the rest of it is read. */
+static void
+carry_part (GReader * reader, const char *s, size_t len) {
+  if (reader->plen + len > reader->psize) {
+    reader->psize = (reader->plen + len) * 2;
+    reader->part = xrealloc (reader->part, reader->psize);
+  }
+  memcpy (reader->part + reader->plen, s, len);
+  reader->plen += len;
+}
+
+/* Split the given chunk of data into lines and add them to the
+ * current batch. Full batches are handed over to the consumer.
+ *
+ * If the reader was asked to stop, 1 is returned.
+ * On success, 0 is returned. */
+static int
+split_lines (GReader * reader, GLineBatch ** batch, const char *buf,
+             size_t len) {
+  const char *p = buf, *end = buf + len, *nl = NULL;
+
+  while (p < end && (nl = memchr (p, '\n', end - p)) != NULL) {
+    if (*batch == NULL && (*batch = acquire_batch (reader)) == NULL)
+      return 1;
+
+    batch_add (reader, *batch, p, nl - p + 1);
+    if ((*batch)->len >= READER_BATCH_SIZE)
+      *batch = push_batch (reader, *batch);
+    p = nl + 1;
+  }
+  if (p < end)
+    carry_part (reader, p, end - p);
+
+  return 0;
+}
+
+/* Read a chunk of data from the input, decompressing it if needed.
+ *
+ * On error, -1 is returned and errno is set.
+ * On success, the number of bytes read is returned, 0 on EOF. */
+static ssize_t
+reader_read (GReader * reader, char *buf, size_t size) {
+#ifdef HAVE_LIBZ
+  int n, err;
+
+  if (reader->gz) {
+    if ((n = gzread (reader->gz, buf, size)) >= 0)
+      return n;
+    LOG_DEBUG (("Unable to read gzip log: %s\n", gzerror (reader->gz, &err)));
+    errno = EIO;
+    return -1;
+  }
+#endif
+
+  return read (reader->fd, buf, size);
+}
+
+/* Reader thread. Read large chunks from the input, split them into
+ * lines and queue them in batches until EOF or until asked to stop. */
+static void *
+reader_worker (void *ptr_data) {
+  GReader *reader = ptr_data;
+  GLineBatch *batch = NULL;
+  struct pollfd pfd;
+  char *buf = xmalloc (READER_READ_SIZE);
+  ssize_t n;
+
+  pfd.fd = reader->fd;
+  pfd.events = POLLIN;
+
+  while (!reader_stopped (reader)) {
+    if ((n = reader_read (reader, buf, READER_READ_SIZE)) > 0) {
+      if (reader->idle)
+        set_idle (reader, 0);
+      if (split_lines (reader, &batch, buf, n))
+        break;
+      continue;
+    }
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      /* input drained, hand over what we have so far */
+      batch = push_batch (reader, batch);
+      if (!reader->idle)
+        set_idle (reader, 1);
+      poll (&pfd, 1, READER_POLL_MS);
+      continue;
+    }
+    /* EOF or read error */
+    if (n == -1)
+      LOG_DEBUG (("Unable to read log data: %s\n", strerror (errno)));
+    break;
+  }
+
+  /* a last line without a trailing newline */
+  if (reader->plen && (batch || (batch = acquire_batch (reader))))
+    batch_add (reader, batch, "", 0);
+  push_batch (reader, batch);
+
+  pthread_mutex_lock (&reader->mutex);
+  reader->eof = 1;
+  pthread_cond_signal (&reader->not_empty);
+  pthread_mutex_unlock (&reader->mutex);
+
+  free (buf);
+
+  return NULL;
+}
+
+/* Release the batch the consumer is done with back to the reader. */
+static void
+release_batch (GReader * reader) {
+  pthread_mutex_lock (&reader->mutex);
+  reader->head = (reader->head + 1) % READER_BATCHES;
+  reader->count--;
+  reader->cur = 0;
+  pthread_cond_signal (&reader->not_full);
+  pthread_mutex_unlock (&reader->mutex);
+}
+
+/* Wait for a queued batch. If `wait` is not set, only wait until the
+ * reader drains the input.
+ *
+ * If no batch is available, 0 is returned.
+ * On success, 1 is returned. */
+static int
+next_batch (GReader * reader, int wait) {
+  struct timespec ts;
+
+  pthread_mutex_lock (&reader->mutex);
+  while (reader->count == 0 && !reader->eof && (wait || !reader->idle) &&
+         !conf.stop_processing) {
+    /* wake up every so often to handle SIGINT */
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_nsec += READER_POLL_MS * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait (&reader->not_empty, &reader->mutex, &ts);
+  }
+  if (reader->count > 0) {
+    reader->cur = 1;
+    reader->left = reader->batches[reader->head].nlines;
+    reader->pos = 0;
+  }
+  pthread_mutex_unlock (&reader->mutex);
+
+  return reader->cur;
+}
+
+/* Get the next line read from the input. If `wait` is set, block
+ * until a line is available or EOF is reached, else return once the
+ * input has been drained. The line is owned by the reader and remains
+ * valid until the next call.
+ *
+ * If no line is available, NULL is returned.
+ * On success, the line including its trailing newline is returned. */
+char *
+greader_getline (GReader * reader, int wait) {
+  GLineBatch *batch = NULL;
+  char *line = NULL;
+
+  if (reader->cur && reader->left == 0)
+    release_batch (reader);
+  if (!reader->cur && !next_batch (reader, wait))
+    return NULL;
+
+  batch = &reader->batches[reader->head];
+  line = batch->buf + reader->pos;
+  reader->pos += strlen (line) + 1;
+  reader->left--;
+
+  return line;
+}
+
+/* Allocate a reader and start its thread. */
+static GReader *
+reader_start (GReader * reader) {
+  int th;
+
+  if (pthread_cond_init (&reader->not_empty, NULL))
+    FATAL ("Failed init thread condition");
+  if (pthread_cond_init (&reader->not_full, NULL))
+    FATAL ("Failed init thread condition");
+  if (pthread_mutex_init (&reader->mutex, NULL))
+    FATAL ("Failed init thread mutex");
+
+  th = pthread_create (&reader->thread, NULL, reader_worker, reader);
+  if (th)
+    FATAL ("Return code from pthread_create(): %d", th);
+
+  return reader;
+}
+
+/* Start a reader thread on the given file descriptor. The descriptor
+ * is switched to non-blocking so the thread can be stopped at any
+ * time, and switched back once the reader is freed, as it may share
+ * its file description with the process feeding it. If it was
+ * blocking, lines are read until EOF. */
+GReader *
+greader_new (int fd) {
+  GReader *reader = xcalloc (1, sizeof (GReader));
+
+  reader->fd = fd;
+  if ((reader->flags = fcntl (fd, F_GETFL, 0)) == -1)
+    FATAL ("Unable to get fd flags: %s.", strerror (errno));
+  reader->wait = !(reader->flags & O_NONBLOCK);
+  if (fcntl (fd, F_SETFL, reader->flags | O_NONBLOCK) == -1)
+    FATAL ("Unable to set fd as non-blocking: %s.", strerror (errno));
+
+  return reader_start (reader);
+}
+
+#ifdef HAVE_LIBZ
+/* Start a reader thread decompressing the given gzip log. Several of
+ * them may run at once, each one on its own log, while the parser
+ * consumes them in order. */
+GReader *
+greader_new_gz (const char *fn) {
+  GReader *reader = xcalloc (1, sizeof (GReader));
+
+  reader->fd = -1;
+  reader->wait = 1;
+  if ((reader->gz = gzopen (fn, "rb")) == NULL)
+    FATAL ("Unable to open the specified log file. %s", strerror (errno));
+  gzbuffer (reader->gz, READER_READ_SIZE);
+
+  return reader_start (reader);
+}
+#endif
+
+/* Determine if the given log is gzip compressed by looking at its
+ * magic bytes.
+ *
+ * If not compressed or unable to read it, 0 is returned.
+ * If compressed, 1 is returned. */
+int
+is_gzip_log (const char *fn) {
+  unsigned char magic[2] = { 0 };
+  FILE *fp = NULL;
+  size_t n = 0;
+
+  if ((fp = fopen (fn, "rb")) == NULL)
+    return 0;
+  n = fread (magic, 1, sizeof (magic), fp);
+  fclose (fp);
+
+  return n == sizeof (magic) && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+/* Stop the reader thread, restore the flags of its file descriptor and
+ * free the reader. */
+void
+greader_free (GReader * reader) {
+  int i;
+
+  if (reader == NULL)
+    return;
+
+  pthread_mutex_lock (&reader->mutex);
+  reader->stop = 1;
+  pthread_cond_signal (&reader->not_full);
+  pthread_mutex_unlock (&reader->mutex);
+  pthread_join (reader->thread, NULL);
+
+  if (reader->fd != -1 && fcntl (reader->fd, F_SETFL, reader->flags) == -1)
+    LOG_DEBUG (("Unable to restore fd flags: %s\n", strerror (errno)));
+
+  for (i = 0; i < READER_BATCHES; ++i)
+    free (reader->batches[i].buf);
+  free (reader->part);
+#ifdef HAVE_LIBZ
+  if (reader->gz)
+    gzclose (reader->gz);
+#endif
+
+  pthread_cond_destroy (&reader->not_empty);
+  pthread_cond_destroy (&reader->not_full);
+  pthread_mutex_destroy (&reader->mutex);
+  free (reader);
+}
@@ -0,0 +1,102 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef GREADER_H_INCLUDED
+#define GREADER_H_INCLUDED
+
+#include <pthread.h>
+#include <stddef.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#define READER_BATCHES          8       /* batches in the ring */
+#define READER_BATCH_SIZE  (256 * 1024) /* bytes per batch before handing it over */
+#define READER_READ_SIZE    (64 * 1024) /* bytes per read(2) */
+#define READER_POLL_MS        200       /* max wait for data before checking for stop */
+
+/* A batch of lines. Lines are stored back to back, each one keeping
+ * its trailing newline and terminated by a NUL byte. */
+typedef struct GLineBatch_ {
+  char *buf;
+  size_t len;                   /* bytes used */
+  size_t size;                  /* bytes allocated */
+  int nlines;                   /* number of lines */
+} GLineBatch;
+
+/* Piped or decompressed data is read by a dedicated thread and handed
+ * over to the parser as batches of lines through a bounded
+ * single-producer, single-consumer ring. The reader blocks while the
+ * ring is full. */
+typedef struct GReader_ {
+  int fd;
+  int flags;                    /* fd flags to restore once done */
+#ifdef HAVE_LIBZ
+  gzFile gz;                    /* gzip compressed log, if any */
+#endif
+  int wait;                     /* input was blocking, read until EOF */
+  int eof;                      /* no more data will be queued */
+  int idle;                     /* reader drained the input */
+  int stop;                     /* reader was asked to stop */
+
+  GLineBatch batches[READER_BATCHES];
+  int head;                     /* index of the oldest queued batch */
+  int count;                    /* number of queued batches */
+
+  /* incomplete line carried over to the next read */
+  char *part;
+  size_t plen;
+  size_t psize;
+
+  /* consumer cursor within the batch at head */
+  int cur;
+  int left;
+  size_t pos;
+
+  pthread_cond_t not_empty;     /* a batch was queued */
+  pthread_cond_t not_full;      /* a batch was released */
+  pthread_mutex_t mutex;
+  pthread_t thread;
+} GReader;
+
+char *greader_getline (GReader * reader, int wait);
+GReader *greader_new (int fd);
+int is_gzip_log (const char *fn);
+void greader_free (GReader * reader);
+
+#ifdef HAVE_LIBZ
+GReader *greader_new_gz (const char *fn);
+#endif
+
+#endif // for #ifndef GREADER_H
@@ -60,6 +60,9 @@ static GEnum enum_metrics[] = {
     {"MTRC_PROTOCOLS" , MTRC_PROTOCOLS} ,
     {"MTRC_AGENTS"    , MTRC_AGENTS}    ,
     {"MTRC_METADATA"  , MTRC_METADATA}  ,
+    {"MTRC_UNIQHLL"   , MTRC_UNIQHLL}   ,
+    {"MTRC_MISSED"    , MTRC_MISSED}    ,
+    {"MTRC_LATENCY"   , MTRC_LATENCY}   ,
 };
 /* Allocate memory for a new GMetrics instance.
  *
@@ -148,6 +151,9 @@ set_data_metrics (GMetrics * ometrics, GMetrics ** nmetrics, GPercTotals totals)
     metrics->avgts.nts = ometrics->avgts.nts;
     metrics->cumts.nts = ometrics->cumts.nts;
     metrics->maxts.nts = ometrics->maxts.nts;
+    metrics->p50ts.nts = ometrics->p50ts.nts;
+    metrics->p95ts.nts = ometrics->p95ts.nts;
+    metrics->p99ts.nts = ometrics->p99ts.nts;
   }
 
   /* method field */
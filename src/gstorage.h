@@ -34,7 +34,7 @@
 #include "parser.h"
 
 /* Total number of storage metrics (GSMetric) */
-#define GSMTRC_TOTAL 15
+#define GSMTRC_TOTAL 18
 #define DB_PATH "/tmp"
 
 /* Enumerated Storage Metrics */
@@ -54,6 +54,9 @@ typedef enum GSMetric_ {
   MTRC_PROTOCOLS,
   MTRC_AGENTS,
   MTRC_METADATA,
+  MTRC_UNIQHLL,
+  MTRC_MISSED,
+  MTRC_LATENCY,
 } GSMetric;
 
 GMetrics *new_gmetrics (void);
@@ -0,0 +1,359 @@
+/**
+ * gtrigram.c -- trigram index to narrow down searches over strings
+ * ghll.c -- HyperLogLog sketches to approximate unique visitors
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtrigram.h"
+
+#include "xmalloc.h"
+
+/* Fold ASCII letters to lowercase, so a case insensitive search narrows
+ * down through the same trigrams as a case sensitive one. */
+static unsigned char
+trgm_fold (unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static uint32_t
+trgm_key (const unsigned char *s) {
+  return ((uint32_t) s[0] << 16) | ((uint32_t) s[1] << 8) | s[2];
+}
+
+/* Allocate memory for a new trigram index.
+ *
+ * On success, the newly allocated GTrigram is returned. */
+GTrigram *
+trgm_new (void) {
+  GTrigram *t = xcalloc (1, sizeof (GTrigram));
+
+  t->strings = kh_init (tstr);
+  t->postings = kh_init (tpost);
+
+  return t;
+}
+
+/* List the given string id under the given trigram. Ids are added in
+ * ascending order, so a trigram seen twice in a string is listed once. */
+static void
+trgm_post (GTrigram * t, uint32_t key, uint32_t id) {
+  GPosting *p;
+  khint_t k;
+  int ret;
+
+  k = kh_put (tpost, t->postings, key, &ret);
+  p = &kh_val (t->postings, k);
+  if (ret != 0)
+    memset (p, 0, sizeof (GPosting));
+
+  if (p->n > 0 && p->ids[p->n - 1] == id)
+    return;
+
+  if (p->n == p->size) {
+    p->size = p->size ? p->size * 2 : 4;
+    p->ids = xrealloc (p->ids, p->size * sizeof (uint32_t));
+  }
+  p->ids[p->n++] = id;
+}
+
+/* Add the given string to the index, unless already there.
+ *
+ * The id of the string is returned. */
+uint32_t
+trgm_add (GTrigram * t, const char *str) {
+  unsigned char buf[3] = { 0 };
+  const unsigned char *p;
+  uint32_t id;
+  khint_t k;
+  int ret, n = 0;
+
+  if (str == NULL)
+    str = "";
+
+  k = kh_get (tstr, t->strings, str);
+  if (k != kh_end (t->strings))
+    return kh_val (t->strings, k);
+
+  id = t->size++;
+  k = kh_put (tstr, t->strings, xstrdup (str), &ret);
+  kh_val (t->strings, k) = id;
+
+  for (p = (const unsigned char *) str; *p; p++) {
+    buf[0] = buf[1];
+    buf[1] = buf[2];
+    buf[2] = trgm_fold (*p);
+    if (++n >= 3)
+      trgm_post (t, trgm_key (buf), id);
+  }
+
+  return id;
+}
+
+/* Skip a bracket expression, i.e., [...], given its opening bracket.
+ *
+ * A pointer to the closing bracket, or to the end of the pattern, is
+ * returned. */
+static const char *
+skip_bracket (const char *p) {
+  p++;
+  if (*p == '^')
+    p++;
+  /* a leading ] is part of the list */
+  if (*p == ']')
+    p++;
+  for (; *p && *p != ']'; p++) {
+    /* [:class:], [=equiv=] or [.coll.] */
+    if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+      const char *end = strchr (p + 2, p[1]);
+      while (end && end[1] != ']')
+        end = strchr (end + 1, p[1]);
+      if (end == NULL)
+        return p + strlen (p);
+      p = end + 1;
+    }
+  }
+
+  return p;
+}
+
+/* Skip a parenthesized group given its opening parenthesis.
+ *
+ * A pointer to the closing parenthesis, or to the end of the pattern,
+ * is returned. */
+static const char *
+skip_group (const char *p) {
+  int depth = 0;
+
+  for (; *p; p++) {
+    if (*p == '\\' && p[1])
+      p++;
+    else if (*p == '[')
+      p = skip_bracket (p);
+    else if (*p == '(')
+      depth++;
+    else if (*p == ')' && --depth == 0)
+      break;
+    if (*p == '\0')
+      break;
+  }
+
+  return p;
+}
+
+/* Append the trigrams of the given run of literal chars. */
+static void
+add_run_trigrams (const unsigned char *run, int len, uint32_t ** keys,
+                  int *n, int *size) {
+  int i;
+
+  for (i = 0; i + 3 <= len; i++) {
+    if (*n == *size) {
+      *size = *size ? *size * 2 : 8;
+      *keys = xrealloc (*keys, *size * sizeof (uint32_t));
+    }
+    (*keys)[(*n)++] = trgm_key (run + i);
+  }
+}
+
+/* Get the trigrams any string matched by the given POSIX extended
+ * regular expression has, from the runs of literal chars it requires.
+ * Anything that isn't a plain literal, e.g., groups, bracket
+ * expressions, or optional or non-ASCII chars, ends a run, and an
+ * alternation leaves nothing to require.
+ *
+ * If the pattern has no run of at least three literal chars, or has an
+ * alternation, 0 is returned.
+ * Otherwise, the number of trigrams set in keys is returned. */
+static int
+pattern_trigrams (const char *pattern, uint32_t ** keys) {
+  unsigned char *run = xmalloc (strlen (pattern) + 1);
+  const char *p;
+  int len = 0, n = 0, size = 0;
+
+  *keys = NULL;
+  for (p = pattern; *p; p++) {
+    switch (*p) {
+    case '|':
+      n = len = 0;
+      goto out;
+    case '*':
+    case '?':
+    case '{':
+      /* the previous atom may not be there at all */
+      if (len > 0)
+        len--;
+      add_run_trigrams (run, len, keys, &n, &size);
+      len = 0;
+      if (*p == '{' && (p = strchr (p, '}')) == NULL)
+        goto out;
+      break;
+    case '\\':
+      if (p[1] == '\0')
+        goto out;
+      /* escaped punctuation is literal, e.g., \. */
+      if ((unsigned char) p[1] < 0x80 && strchr (".[]()*+?{}|^$\\/-", p[1])) {
+        run[len++] = trgm_fold (*++p);
+        break;
+      }
+      /* a class or an anchor, e.g., \w or \b */
+      p++;
+      add_run_trigrams (run, len, keys, &n, &size);
+      len = 0;
+      break;
+    case '[':
+    case '(':
+      p = *p == '[' ? skip_bracket (p) : skip_group (p);
+      add_run_trigrams (run, len, keys, &n, &size);
+      len = 0;
+      if (*p == '\0')
+        goto out;
+      break;
+    case '+':
+    case '.':
+    case '^':
+    case '$':
+    case ')':
+      add_run_trigrams (run, len, keys, &n, &size);
+      len = 0;
+      break;
+    default:
+      if ((unsigned char) *p >= 0x80) {
+        add_run_trigrams (run, len, keys, &n, &size);
+        len = 0;
+        break;
+      }
+      run[len++] = trgm_fold (*p);
+    }
+  }
+  add_run_trigrams (run, len, keys, &n, &size);
+
+out:
+  free (run);
+  if (n == 0) {
+    free (*keys);
+    *keys = NULL;
+  }
+  return n;
+}
+
+/* Find the given id in a posting list. */
+static int
+posting_has (const GPosting * p, uint32_t id) {
+  uint32_t lo = 0, hi = p->n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (p->ids[mid] == id)
+      return 1;
+    if (p->ids[mid] < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return 0;
+}
+
+/* Get the strings in the index that may match the given POSIX extended
+ * regular expression, i.e., those holding every trigram it requires.
+ * Strings added after the call are not covered and so must be checked
+ * as any other. A candidate still needs to be matched against the
+ * pattern itself.
+ *
+ * If the pattern requires no trigram, NULL is returned.
+ * Otherwise, a newly allocated bit set of the candidate ids, see
+ * TRGM_HAS(), is returned and size is set to the ids it covers. */
+uint8_t *
+trgm_match (GTrigram * t, const char *pattern, uint32_t * size) {
+  GPosting **lists = NULL, *tmp;
+  uint32_t *keys = NULL, id;
+  uint8_t *set = NULL;
+  khint_t k;
+  int i, j, n;
+
+  if ((n = pattern_trigrams (pattern, &keys)) == 0)
+    return NULL;
+
+  *size = t->size;
+  set = xcalloc ((t->size + 7) / 8 + 1, sizeof (uint8_t));
+  lists = xcalloc (n, sizeof (GPosting *));
+
+  for (i = 0; i < n; i++) {
+    k = kh_get (tpost, t->postings, keys[i]);
+    /* a trigram nothing holds, nothing matches */
+    if (k == kh_end (t->postings))
+      goto out;
+    lists[i] = &kh_val (t->postings, k);
+    /* walk the shortest list, look up the others */
+    if (lists[i]->n < lists[0]->n) {
+      tmp = lists[0];
+      lists[0] = lists[i];
+      lists[i] = tmp;
+    }
+  }
+
+  for (j = 0; j < (int) lists[0]->n; j++) {
+    id = lists[0]->ids[j];
+    for (i = 1; i < n && posting_has (lists[i], id); i++);
+    if (i == n)
+      set[id >> 3] |= 1 << (id & 7);
+  }
+
+out:
+  free (lists);
+  free (keys);
+
+  return set;
+}
+
+/* Free all memory allocated by the given trigram index. */
+void
+trgm_free (GTrigram * t) {
+  khint_t k;
+
+  if (t == NULL)
+    return;
+
+  for (k = kh_begin (t->strings); k != kh_end (t->strings); ++k) {
+    if (kh_exist (t->strings, k))
+      free ((char *) kh_key (t->strings, k));
+  }
+  for (k = kh_begin (t->postings); k != kh_end (t->postings); ++k) {
+    if (kh_exist (t->postings, k))
+      free (kh_val (t->postings, k).ids);
+  }
+  kh_destroy (tstr, t->strings);
+  kh_destroy (tpost, t->postings);
+  free (t);
+}
@@ -0,0 +1,69 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef GTRIGRAM_H_INCLUDED
+#define GTRIGRAM_H_INCLUDED
+
+#include <stdint.h>
+
+#include "khash.h"
+
+/* Ids of the strings holding a trigram, in ascending order */
+typedef struct GPosting_ {
+  uint32_t *ids;
+  uint32_t n;
+  uint32_t size;
+} GPosting;
+
+KHASH_MAP_INIT_STR (tstr, uint32_t);
+KHASH_MAP_INIT_INT (tpost, GPosting);
+
+/* A trigram index over a set of strings. Each distinct string is given
+ * an id, in the order it is added, and each of its trigrams, ASCII
+ * letters folded to lowercase, lists it, so the index only grows as new
+ * strings are added. */
+typedef struct GTrigram_ {
+  khash_t (tstr) * strings;     /* string => id */
+  khash_t (tpost) * postings;   /* trigram => string ids */
+  uint32_t size;                /* strings indexed */
+} GTrigram;
+
+GTrigram *trgm_new (void);
+uint32_t trgm_add (GTrigram * t, const char *str);
+uint8_t *trgm_match (GTrigram * t, const char *pattern, uint32_t * size);
+void trgm_free (GTrigram * t);
+
+#define TRGM_HAS(set, id) ((set)[(id) >> 3] & (1 << ((id) & 7)))
+
+#endif // for #ifndef GTRIGRAM_H
@@ -0,0 +1,618 @@
+/**
+ * gwal.c -- append-only log of storage changes for crash recovery
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gwal.h"
+
+#include "error.h"
+#include "xmalloc.h"
+
+#define WAL_BATCH_HDR 16        /* length, checksum and lsn */
+#define WAL_SEGMENT_FMT "%s/" WAL_PREFIX "%016llx" WAL_EXT
+
+static GWAL wal = {.fd = -1,.mutex = PTHREAD_MUTEX_INITIALIZER,.idle =
+    PTHREAD_COND_INITIALIZER,.flushed = PTHREAD_COND_INITIALIZER };
+
+/* FNV-1a checksum of a batch and its lsn. */
+static uint32_t
+wal_sum (uint64_t lsn, const char *buf, size_t len) {
+  uint32_t h = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < sizeof (lsn); ++i)
+    h = (h ^ (uint8_t) (lsn >> (i * 8))) * 16777619U;
+  for (i = 0; i < len; ++i)
+    h = (h ^ (uint8_t) buf[i]) * 16777619U;
+
+  return h;
+}
+
+/* Get the path of the segment starting at the given batch.
+ *
+ * On success, the malloc'd path is returned. */
+static char *
+segment_name (const char *path, uint64_t start) {
+  char *fn = NULL;
+
+  fn = xmalloc (snprintf (NULL, 0, WAL_SEGMENT_FMT, path,
+                          (unsigned long long) start) + 1);
+  sprintf (fn, WAL_SEGMENT_FMT, path, (unsigned long long) start);
+
+  return fn;
+}
+
+static void
+wal_reserve (size_t len) {
+  if (wal.len + len <= wal.size)
+    return;
+
+  while (wal.size < wal.len + len)
+    wal.size = wal.size ? wal.size * 2 : WAL_BUFFER_SIZE;
+  wal.buf = xrealloc (wal.buf, wal.size);
+}
+
+static void
+put_varint (uint64_t v) {
+  wal_reserve (10);
+  while (v >= 0x80) {
+    wal.buf[wal.len++] = (char) (v | 0x80);
+    v >>= 7;
+  }
+  wal.buf[wal.len++] = (char) v;
+}
+
+/* Decode a varint and advance the given pointer.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned and the value is set. */
+static int
+get_varint (const char **p, const char *end, uint64_t * v) {
+  int shift;
+
+  *v = 0;
+  for (shift = 0; *p < end && shift < 64; shift += 7) {
+    *v |= (uint64_t) ((uint8_t) ** p & 0x7F) << shift;
+    if (!((uint8_t) * (*p)++ & 0x80))
+      return 0;
+  }
+
+  return 1;
+}
+
+static void
+write_all (const char *buf, size_t len) {
+  ssize_t n;
+
+  while (len) {
+    if ((n = write (wal.fd, buf, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      FATAL ("Unable to write the write-ahead log: %s", strerror (errno));
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+/* Get the length of the committed batches, i.e., the buffer up to the
+ * open batch if any. */
+static size_t
+committed_len (void) {
+  return wal.nrecords ? wal.batch : wal.len;
+}
+
+/* Hand the committed batches over to be written out by swapping the
+ * buffers, so that only the open batch, if any, is copied back to the
+ * buffer changes are logged to.
+ *
+ * The length of the batches handed over is returned. */
+static size_t
+swap_buffers (void) {
+  size_t len = committed_len (), rest = wal.len - len, size = wal.size;
+  char *buf = wal.buf;
+
+  if (len == 0)
+    return 0;
+
+  wal.buf = wal.out;
+  wal.size = wal.out_size;
+  wal.out = buf;
+  wal.out_size = size;
+
+  wal.len = wal.batch = 0;
+  if (rest) {
+    wal_reserve (rest);
+    memcpy (wal.buf, wal.out + len, rest);
+    wal.len = rest;
+  }
+
+  return len;
+}
+
+/* Write out the committed batches and flush them to disk. The mutex,
+ * held by the caller, is released meanwhile, so changes are logged
+ * while waiting for the disk. A single write out is in flight at a
+ * time. */
+static void
+wal_sync (void) {
+  size_t len;
+
+  while (wal.flushing)
+    pthread_cond_wait (&wal.flushed, &wal.mutex);
+  if ((len = swap_buffers ()) == 0)
+    return;
+
+  wal.flushing = 1;
+  pthread_mutex_unlock (&wal.mutex);
+  write_all (wal.out, len);
+  if (fsync (wal.fd) == -1)
+    FATAL ("Unable to sync the write-ahead log: %s", strerror (errno));
+  pthread_mutex_lock (&wal.mutex);
+
+  wal.flushing = 0;
+  clock_gettime (CLOCK_MONOTONIC, &wal.synced);
+  pthread_cond_broadcast (&wal.flushed);
+}
+
+/* Get the milliseconds left before the committed batches are due to be
+ * synced, 0 if they are due. */
+static long
+sync_wait (void) {
+  struct timespec now;
+  long elapsed;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - wal.synced.tv_sec) * 1000 +
+    (now.tv_nsec - wal.synced.tv_nsec) / 1000000;
+
+  return elapsed >= WAL_SYNC_MS ? 0 : WAL_SYNC_MS - elapsed;
+}
+
+/* Determine if the pending batches are due to be written out. */
+static int
+sync_due (void) {
+  return wal.len >= WAL_BUFFER_SIZE || sync_wait () == 0;
+}
+
+/* Write out and sync committed batches once due, off the threads
+ * logging changes, including once WAL_SYNC_MS went by without another
+ * line parsed, e.g., while tailing an idle log or waiting on a pipe. */
+static void *
+wal_flusher (GO_UNUSED void *arg) {
+  struct timespec ts;
+  long ms;
+
+  pthread_mutex_lock (&wal.mutex);
+  while (wal.fd != -1) {
+    if (committed_len () && sync_due ()) {
+      wal_sync ();
+      continue;
+    }
+    ms = committed_len ()? sync_wait () : WAL_SYNC_MS;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_nsec += ms * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait (&wal.idle, &wal.mutex, &ts);
+  }
+  pthread_mutex_unlock (&wal.mutex);
+
+  return NULL;
+}
+
+/* Append a change to the open batch. */
+void
+wal_log (GWALOp op, GModule module, uint32_t key, uint64_t val,
+         const char *str) {
+  size_t len;
+
+  if (wal.fd == -1)
+    return;
+
+  pthread_mutex_lock (&wal.mutex);
+  /* closed meanwhile by another thread */
+  if (wal.fd == -1) {
+    pthread_mutex_unlock (&wal.mutex);
+    return;
+  }
+
+  /* reserve room for the batch header */
+  if (wal.nrecords++ == 0) {
+    wal.batch = wal.len;
+    wal_reserve (WAL_BATCH_HDR);
+    wal.len += WAL_BATCH_HDR;
+  }
+
+  put_varint (op);
+  put_varint (module);
+  put_varint (key);
+  put_varint (val);
+  if (str == NULL) {
+    put_varint (0);
+  } else {
+    len = strlen (str);
+    put_varint (len + 1);
+    wal_reserve (len);
+    memcpy (wal.buf + wal.len, str, len);
+    wal.len += len;
+  }
+  pthread_mutex_unlock (&wal.mutex);
+}
+
+/* Close the open batch, i.e., the changes made by a single log line.
+ * Batches are written out and synced together by the flusher once
+ * WAL_BUFFER_SIZE bytes are pending or WAL_SYNC_MS went by, so that
+ * many lines share a single fsync. Should the disk fall behind, the
+ * caller waits rather than buffering without bound. */
+static void
+commit_batch (void) {
+  uint32_t len, sum;
+  uint64_t lsn;
+  char *hdr;
+
+  if (wal.fd == -1 || wal.nrecords == 0)
+    return;
+
+  lsn = ++wal.lsn;
+  hdr = wal.buf + wal.batch;
+  len = wal.len - wal.batch - WAL_BATCH_HDR;
+  sum = wal_sum (lsn, hdr + WAL_BATCH_HDR, len);
+  memcpy (hdr, &len, sizeof (len));
+  memcpy (hdr + 4, &sum, sizeof (sum));
+  memcpy (hdr + 8, &lsn, sizeof (lsn));
+
+  wal.nrecords = 0;
+  wal.nbatches++;
+  wal.batch = wal.len;
+
+  if (sync_due ())
+    pthread_cond_signal (&wal.idle);
+  while (wal.flushing && wal.len >= 2 * WAL_BUFFER_SIZE)
+    pthread_cond_wait (&wal.flushed, &wal.mutex);
+}
+
+/* Close the open batch. With concurrent writers, it holds the changes
+ * each of them made since the last commit. */
+void
+wal_commit (void) {
+  if (wal.fd == -1)
+    return;
+
+  pthread_mutex_lock (&wal.mutex);
+  commit_batch ();
+  pthread_mutex_unlock (&wal.mutex);
+}
+
+/* Get the last committed batch. */
+uint64_t
+wal_lsn (void) {
+  return wal.lsn;
+}
+
+static void
+open_segment (uint64_t start) {
+  GWALHeader hdr;
+  char *fn = segment_name (wal.path, start);
+
+  if ((wal.fd = open (fn, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    FATAL ("Unable to create %s: %s", fn, strerror (errno));
+  free (fn);
+
+  memset (&hdr, 0, sizeof (GWALHeader));
+  memcpy (hdr.magic, WAL_MAGIC, sizeof (hdr.magic));
+  hdr.version = WAL_VERSION;
+  hdr.start = start;
+
+  wal.start = start;
+  wal.nbatches = 0;
+  write_all ((const char *) &hdr, sizeof (GWALHeader));
+  if (fsync (wal.fd) == -1)
+    FATAL ("Unable to sync the write-ahead log: %s", strerror (errno));
+  clock_gettime (CLOCK_MONOTONIC, &wal.synced);
+}
+
+/* Sync and close the open segment, once the write out in flight, if
+ * any, is done. A segment without batches is of no use and is
+ * removed. */
+static void
+close_segment (void) {
+  char *fn = NULL;
+
+  commit_batch ();
+  while (wal.flushing || committed_len ())
+    wal_sync ();
+  close (wal.fd);
+  wal.fd = -1;
+
+  if (wal.nbatches)
+    return;
+
+  fn = segment_name (wal.path, wal.start);
+  unlink (fn);
+  free (fn);
+}
+
+/* Start logging changes under the given path, past the last batch
+ * restored. */
+void
+wal_open (const char *path) {
+  if (wal.fd != -1)
+    return;
+
+  wal.path = xstrdup (path);
+  open_segment (wal.lsn + 1);
+
+  if (pthread_create (&wal.flusher, NULL, wal_flusher, NULL) != 0)
+    FATAL ("Unable to start the write-ahead log flusher");
+}
+
+/* Start a new segment, so the current one can be dropped once a
+ * snapshot holding its changes is written. */
+void
+wal_rotate (void) {
+  if (wal.fd == -1)
+    return;
+
+  pthread_mutex_lock (&wal.mutex);
+  close_segment ();
+  open_segment (wal.lsn + 1);
+  pthread_mutex_unlock (&wal.mutex);
+}
+
+/* Stop logging changes. The last committed batch is kept. */
+void
+wal_close (void) {
+  if (wal.fd == -1)
+    return;
+
+  pthread_mutex_lock (&wal.mutex);
+  close_segment ();
+  free (wal.buf);
+  free (wal.out);
+  free (wal.path);
+  wal.buf = wal.out = wal.path = NULL;
+  wal.len = wal.size = wal.out_size = wal.batch = 0;
+  pthread_cond_signal (&wal.idle);
+  pthread_mutex_unlock (&wal.mutex);
+
+  pthread_join (wal.flusher, NULL);
+}
+
+static int
+cmp_lsn (const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Find the segments under the given path.
+ *
+ * The number of segments is returned and the first batch of each is
+ * set, in order. */
+static int
+list_segments (const char *path, uint64_t ** starts) {
+  DIR *dir = NULL;
+  struct dirent *ent = NULL;
+  char *end = NULL;
+  size_t len, plen = strlen (WAL_PREFIX), elen = strlen (WAL_EXT);
+  uint64_t start;
+  int n = 0, size = 0;
+
+  *starts = NULL;
+  if ((dir = opendir (path)) == NULL)
+    return 0;
+
+  while ((ent = readdir (dir)) != NULL) {
+    len = strlen (ent->d_name);
+    if (len <= plen + elen || strncmp (ent->d_name, WAL_PREFIX, plen) ||
+        strcmp (ent->d_name + len - elen, WAL_EXT))
+      continue;
+
+    errno = 0;
+    start = strtoull (ent->d_name + plen, &end, 16);
+    if (errno || end != ent->d_name + len - elen)
+      continue;
+
+    if (n == size) {
+      size = size ? size * 2 : 16;
+      *starts = xrealloc (*starts, size * sizeof (uint64_t));
+    }
+    (*starts)[n++] = start;
+  }
+  closedir (dir);
+
+  if (n)
+    qsort (*starts, n, sizeof (uint64_t), cmp_lsn);
+
+  return n;
+}
+
+/* Remove the segments under the given path starting at or before the
+ * given batch, i.e., those a written snapshot holds. The open segment
+ * is kept. */
+void
+wal_purge (const char *path, uint64_t lsn) {
+  uint64_t *starts = NULL;
+  char *fn = NULL;
+  int i, n;
+
+  n = list_segments (path, &starts);
+  for (i = 0; i < n && starts[i] <= lsn; ++i) {
+    if (wal.fd != -1 && starts[i] == wal.start)
+      continue;
+    fn = segment_name (path, starts[i]);
+    if (unlink (fn) == -1)
+      LOG_DEBUG (("Unable to remove %s: %s\n", fn, strerror (errno)));
+    free (fn);
+  }
+  free (starts);
+}
+
+/* Decode and apply the records of a batch.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+replay_batch (const char *p, const char *end,
+              void (*apply) (const GWALRecord *)) {
+  GWALRecord rec;
+  uint64_t op, module, key, slen;
+  char *str = NULL;
+  size_t size = 0;
+  int ret = 0;
+
+  while (p < end) {
+    memset (&rec, 0, sizeof (GWALRecord));
+    if (get_varint (&p, end, &op) || get_varint (&p, end, &module) ||
+        get_varint (&p, end, &key) || get_varint (&p, end, &rec.val) ||
+        get_varint (&p, end, &slen) || (slen && slen - 1 > (size_t) (end - p))) {
+      ret = 1;
+      break;
+    }
+
+    if (slen) {
+      if (slen > size)
+        str = xrealloc (str, size = slen);
+      memcpy (str, p, slen - 1);
+      str[slen - 1] = '\0';
+      p += slen - 1;
+      rec.str = str;
+    }
+    rec.op = op;
+    rec.module = module;
+    rec.key = key;
+    apply (&rec);
+  }
+  free (str);
+
+  return ret;
+}
+
+/* Replay the batches of a segment past the given one.
+ *
+ * The last batch applied is returned. */
+static uint64_t
+replay_segment (const char *path, uint64_t start, uint64_t lsn,
+                void (*apply) (const GWALRecord *)) {
+  GWALHeader hdr;
+  struct stat st;
+  const char *map = NULL, *batch = NULL;
+  char *fn = segment_name (path, start);
+  uint64_t blsn;
+  uint32_t len, sum;
+  size_t off, size;
+  void *ptr;
+  int fd;
+
+  if ((fd = open (fn, O_RDONLY)) == -1 || fstat (fd, &st) == -1 ||
+      (size_t) st.st_size < sizeof (GWALHeader)) {
+    LOG_DEBUG (("Skipping write-ahead log %s\n", fn));
+    goto out;
+  }
+
+  size = st.st_size;
+  if ((ptr = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    LOG_DEBUG (("Unable to map %s: %s\n", fn, strerror (errno)));
+    goto out;
+  }
+  map = ptr;
+  posix_madvise (ptr, size, POSIX_MADV_SEQUENTIAL);
+
+  memcpy (&hdr, map, sizeof (GWALHeader));
+  if (memcmp (hdr.magic, WAL_MAGIC, sizeof (hdr.magic)) != 0 ||
+      hdr.version != WAL_VERSION || hdr.start != start) {
+    LOG_DEBUG (("Invalid write-ahead log %s\n", fn));
+    goto unmap;
+  }
+
+  /* stop at the first torn or missing batch */
+  for (off = sizeof (GWALHeader); size - off >= WAL_BATCH_HDR;
+       off += WAL_BATCH_HDR + len) {
+    batch = map + off;
+    memcpy (&len, batch, sizeof (len));
+    memcpy (&sum, batch + 4, sizeof (sum));
+    memcpy (&blsn, batch + 8, sizeof (blsn));
+
+    if (len > size - off - WAL_BATCH_HDR ||
+        wal_sum (blsn, batch + WAL_BATCH_HDR, len) != sum)
+      break;
+    if (blsn <= lsn)
+      continue;
+    if (blsn != lsn + 1)
+      break;
+
+    if (replay_batch (batch + WAL_BATCH_HDR, batch + WAL_BATCH_HDR + len, apply))
+      break;
+    lsn = blsn;
+  }
+
+unmap:
+  munmap (ptr, size);
+out:
+  if (fd != -1)
+    close (fd);
+  free (fn);
+
+  return lsn;
+}
+
+/* Replay the log under the given path on top of a snapshot holding
+ * every batch up to `lsn`, one segment after the other.
+ *
+ * The last batch applied is returned. */
+uint64_t
+wal_replay (const char *path, uint64_t lsn, void (*apply) (const GWALRecord *)) {
+  uint64_t *starts = NULL;
+  int i, n;
+
+  n = list_segments (path, &starts);
+  for (i = 0; i < n; ++i)
+    lsn = replay_segment (path, starts[i], lsn, apply);
+  free (starts);
+
+  wal.lsn = lsn;
+
+  return lsn;
+}
@@ -0,0 +1,139 @@
+/**
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef GWAL_H_INCLUDED
+#define GWAL_H_INCLUDED
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "commons.h"
+
+#define WAL_PREFIX      "goaccess."
+#define WAL_EXT         ".wal"
+#define WAL_MAGIC       "GOACCWAL"
+#define WAL_VERSION     1
+#define WAL_BUFFER_SIZE (1024 * 1024)   /* write out once this much is pending */
+#define WAL_SYNC_MS     1000    /* max time changes are kept unsynced */
+
+/* A change to the storage, i.e., a call to one of its ht_insert_*
+ * entry points along with its arguments. */
+typedef enum GWALOp_ {
+  WAL_LAST_PARSE = 1,
+  WAL_DATE,
+  WAL_CNT_OVERALL,
+  WAL_CNT_VALID,
+  WAL_CNT_BW,
+  WAL_AGENT_SEQ,
+  WAL_UNIQUE_KEY,
+  WAL_AGENT_KEY,
+  WAL_AGENT_VALUE,
+  WAL_KEYMAP,
+  WAL_DATAMAP,
+  WAL_ROOTMAP,
+  WAL_UNIQMAP,
+  WAL_ROOT,
+  WAL_META_DATA,
+  WAL_HITS,
+  WAL_VISITOR,
+  WAL_BW,
+  WAL_CUMTS,
+  WAL_MAXTS,
+  WAL_METHOD,
+  WAL_PROTOCOL,
+  WAL_AGENT,
+  WAL_INVALIDATE_DATE,
+  WAL_CLEAN_PARTIAL,
+  WAL_CLEAN_FULL,
+  WAL_UNIQHLL,
+  WAL_LATENCY,
+  WAL_GZ_PARSE,
+} GWALOp;
+
+typedef struct GWALRecord_ {
+  GWALOp op;
+  GModule module;
+  uint32_t key;
+  uint64_t val;
+  const char *str;              /* NULL if none */
+} GWALRecord;
+
+/* The log is split in segments, each named after the first batch it
+ * holds, i.e., goaccess.<lsn>.wal. A new segment is started on every
+ * snapshot so older ones can be dropped once the snapshot is written.
+ *
+ * segment: header | batch 1 | ... | batch N
+ * batch:   length | checksum | lsn | record 1 | ... | record N
+ * record:  op | module | key | val | strlen + 1 | str  (varints) */
+typedef struct GWALHeader_ {
+  char magic[8];
+  uint32_t version;
+  uint32_t pad;
+  uint64_t start;               /* first batch of the segment */
+} GWALHeader;
+
+typedef struct GWAL_ {
+  char *path;                   /* database path */
+  int fd;                       /* open segment, -1 if none */
+  uint64_t lsn;                 /* last committed batch */
+  uint64_t start;               /* first batch of the open segment */
+
+  char *buf;                    /* committed batches and the open one */
+  size_t len;
+  size_t size;
+  size_t batch;                 /* offset of the open batch */
+  int nrecords;                 /* records in the open batch */
+  int nbatches;                 /* batches written to the open segment */
+  char *out;                    /* batches being written out */
+  size_t out_size;
+  int flushing;                 /* a write out is in flight */
+  struct timespec synced;       /* last time the segment was synced */
+  pthread_mutex_t mutex;        /* guards the buffer against concurrent writers */
+  pthread_cond_t idle;          /* wakes up the flusher */
+  pthread_cond_t flushed;       /* signaled once a write out is done */
+  pthread_t flusher;            /* writes out and syncs due batches */
+} GWAL;
+
+void wal_open (const char *path);
+uint64_t wal_lsn (void);
+uint64_t wal_replay (const char *path, uint64_t lsn,
+                     void (*apply) (const GWALRecord *));
+void wal_close (void);
+void wal_commit (void);
+void wal_log (GWALOp op, GModule module, uint32_t key, uint64_t val,
+              const char *str);
+void wal_purge (const char *path, uint64_t lsn);
+void wal_rotate (void);
+
+#endif // for #ifndef GWAL_H
@@ -664,6 +664,16 @@ pmaxts (GJSON * json, GMetrics * nmetrics, int sp) {
   pskeyu64val (json, "maxts", nmetrics->maxts.nts, sp, 0);
 }
 
+/* Write to a buffer the percentiles of the time served. */
+static void
+ppts (GJSON * json, GMetrics * nmetrics, int sp) {
+  if (!conf.serve_usecs || !conf.latency_percentiles)
+    return;
+  pskeyu64val (json, "p50ts", nmetrics->p50ts.nts, sp, 0);
+  pskeyu64val (json, "p95ts", nmetrics->p95ts.nts, sp, 0);
+  pskeyu64val (json, "p99ts", nmetrics->p99ts.nts, sp, 0);
+}
+
 /* Write to a buffer request method data. */
 static void
 pmethod (GJSON * json, GMetrics * nmetrics, int sp) {
@@ -859,6 +869,7 @@ print_json_block (GJSON * json, GMetrics * nmetrics, int sp) {
   pavgts (json, nmetrics, sp);
   pcumts (json, nmetrics, sp);
   pmaxts (json, nmetrics, sp);
+  ppts (json, nmetrics, sp);
 
   /* print protocol/method */
   pmethod (json, nmetrics, sp);
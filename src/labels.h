@@ -82,6 +82,9 @@
 #define MTRC_AVGTS_LBL           _( "Avg. T.S.")
 #define MTRC_CUMTS_LBL           _( "Cum. T.S.")
 #define MTRC_MAXTS_LBL           _( "Max. T.S.")
+#define MTRC_P50TS_LBL           _( "P50 T.S.")
+#define MTRC_P95TS_LBL           _( "P95 T.S.")
+#define MTRC_P99TS_LBL           _( "P99 T.S.")
 #define MTRC_METHODS_LBL         _( "Method")
 #define MTRC_METHODS_SHORT_LBL   _( "Mtd")
 #define MTRC_PROTOCOLS_LBL       _( "Protocol")
@@ -269,6 +272,28 @@
   _("No log format was found on your conf file.")
 #define ERR_FORMAT_NO_TIME_FMT         \
   _("No time format was found on your conf file.")
+#define ERR_FORMAT_JSON_LOG_FMT        \
+  _("Invalid JSON log format, it must map keys to format specifiers.")
+#define ERR_TIME_WINDOW                \
+  _("Invalid time, use YYYY-MM-DD [HH:MM[:SS]] or N[s|m|h|d] ago:")
+#define ERR_PERSIST_INTERVAL           \
+  _("Invalid persist interval, it must be a number of seconds:")
+#define ERR_DB_COMPRESSION             \
+  _("Unsupported database compression, build with --with-zlib:")
+#define ERR_DB_COMPRESSION_LEVEL       \
+  _("Invalid database compression level, it must be from 1 to 9:")
+#define ERR_HLL_PRECISION              \
+  _("Invalid HyperLogLog precision, it must be from 4 to 16:")
+#define ERR_HEAVY_HITTERS              \
+  _("Invalid heavy hitters, use PANEL:N, e.g., REQUESTS:50000:")
+#define ERR_DNS_WORKERS                \
+  _("Invalid number of DNS workers, it must be from 1 to 64:")
+#define ERR_DNS_CACHE_TTL              \
+  _("Invalid DNS cache TTL, it must be a number of seconds:")
+#define ERR_DNS_NEGATIVE_TTL           \
+  _("Invalid DNS negative TTL, it must be a number of seconds:")
+#define ERR_MAX_KEYS                   \
+  _("Invalid max keys, use PANEL:N, e.g., REQUESTS:500000:")
 #define ERR_NODEF_CONF_FILE            \
   _("No default config file found.")
 #define ERR_NODEF_CONF_FILE_DESC       \
@@ -32,11 +32,13 @@
 #include <config.h>
 #endif
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <errno.h>
+#include <ctype.h>
 
 #ifdef HAVE_LIBTOKYOCABINET
 #include "tcabdb.h"
@@ -50,6 +52,9 @@
 #include "options.h"
 
 #include "error.h"
+#include "gdns.h"
+#include "ghll.h"
+#include "gkdb.h"
 #include "labels.h"
 #include "util.h"
 
@@ -90,6 +95,7 @@ struct option long_opts[] = {
   {"anonymize-ip"         , no_argument       , 0 , 0  }  ,
   {"addr"                 , required_argument , 0 , 0  }  ,
   {"all-static-files"     , no_argument       , 0 , 0  }  ,
+  {"approx-visitors"      , no_argument       , 0 , 0  }  ,
   {"color"                , required_argument , 0 , 0  }  ,
   {"color-scheme"         , required_argument , 0 , 0  }  ,
   {"crawlers-only"        , no_argument       , 0 , 0  }  ,
@@ -98,11 +104,16 @@ struct option long_opts[] = {
   {"date-format"          , required_argument , 0 , 0  }  ,
   {"date-spec"            , required_argument , 0 , 0  }  ,
   {"dcf"                  , no_argument       , 0 , 0  }  ,
+  {"dns-cache-ttl"        , required_argument , 0 , 0  }  ,
+  {"dns-negative-ttl"     , required_argument , 0 , 0  }  ,
+  {"dns-workers"          , required_argument , 0 , 0  }  ,
   {"double-decode"        , no_argument       , 0 , 0  }  ,
   {"enable-panel"         , required_argument , 0 , 0  }  ,
   {"fifo-in"              , required_argument , 0 , 0  }  ,
   {"fifo-out"             , required_argument , 0 , 0  }  ,
+  {"heavy-hitters"        , required_argument , 0 , 0  }  ,
   {"hide-referer"         , required_argument , 0 , 0  }  ,
+  {"hll-precision"        , required_argument , 0 , 0  }  ,
   {"hour-spec"            , required_argument , 0 , 0  }  ,
   {"html-custom-css"      , required_argument , 0 , 0  }  ,
   {"html-custom-js"       , required_argument , 0 , 0  }  ,
@@ -114,9 +125,12 @@ struct option long_opts[] = {
   {"ignore-referer"       , required_argument , 0 , 0  }  ,
   {"ignore-status"        , required_argument , 0 , 0  }  ,
   {"invalid-requests"     , required_argument , 0 , 0  }  ,
+  {"json-log-format"      , required_argument , 0 , 0  }  ,
   {"json-pretty-print"    , no_argument       , 0 , 0  }  ,
+  {"latency-percentiles"  , no_argument       , 0 , 0  }  ,
   {"log-format"           , required_argument , 0 , 0  }  ,
   {"max-items"            , required_argument , 0 , 0  }  ,
+  {"max-keys"             , required_argument , 0 , 0  }  ,
   {"no-color"             , no_argument       , 0 , 0  }  ,
   {"no-column-names"      , no_argument       , 0 , 0  }  ,
   {"no-csv-summary"       , no_argument       , 0 , 0  }  ,
@@ -134,12 +148,20 @@ struct option long_opts[] = {
   {"process-and-exit"     , no_argument       , 0 , 0  }  ,
   {"real-os"              , no_argument       , 0 , 0  }  ,
   {"real-time-html"       , no_argument       , 0 , 0  }  ,
+  {"since"                , required_argument , 0 , 0  }  ,
   {"sort-panel"           , required_argument , 0 , 0  }  ,
   {"static-file"          , required_argument , 0 , 0  }  ,
+  {"until"                , required_argument , 0 , 0  }  ,
   {"keep-last"            , required_argument , 0 , 0  }  ,
   {"db-path"              , required_argument , 0 , 0  }  ,
   {"persist"              , no_argument       , 0 , 0  }  ,
+  {"persist-interval"     , required_argument , 0 , 0  }  ,
+  {"db-compression"       , required_argument , 0 , 0  }  ,
+  {"db-compression-level" , required_argument , 0 , 0  }  ,
   {"restore"              , no_argument       , 0 , 0  }  ,
+  {"wal"                  , no_argument       , 0 , 0  }  ,
+  {"lazy-restore"         , no_argument       , 0 , 0  }  ,
+  {"merge-db"             , required_argument , 0 , 0  }  ,
 #ifdef HAVE_LIBSSL
   {"ssl-cert"             , required_argument , 0 ,  0  } ,
   {"ssl-key"              , required_argument , 0 ,  0  } ,
@@ -166,6 +188,8 @@ cmd_help (void)
   /* Log & Date Format Options */
   "Log & Date Format Options\n\n"
   "  --date-format=<dateformat>      - Specify log date format. e.g., %%d/%%b/%%Y\n"
+  "  --json-log-format=<json_obj>    - Map the keys of a JSON log to specifiers.\n"
+  "                                    e.g., {\"remote_addr\":\"%%h\",...}\n"
   "  --log-format=<logformat>        - Specify log format. Inner quotes need to be\n"
   "                                    escaped, or use single quotes.\n"
   "  --time-format=<timeformat>      - Specify log time format. e.g., %%H:%%M:%%S\n\n"
@@ -242,13 +266,25 @@ cmd_help (void)
   "                                    count.\n"
   "  --anonymize-ip                  - Anonymize IP addresses before outputting to report.\n"
   "  --all-static-files              - Include static files with a query string.\n"
+  "  --approx-visitors               - Estimate unique visitors in bounded memory,\n"
+  "                                    within about 1.6%% by default.\n"
   "  --crawlers-only                 - Parse and display only crawlers.\n"
   "  --date-spec=<date|hr>           - Date specificity. Possible values: `date`\n"
   "                                    (default), or `hr`.\n"
+  "  --dns-cache-ttl=<SECS>          - Keep resolved hostnames under --db-path\n"
+  "                                    across runs, for SECS seconds.\n"
+  "  --dns-negative-ttl=<SECS>       - Don't retry resolving an IP that timed out\n"
+  "                                    for SECS seconds, 300 by default.\n"
+  "  --dns-workers=<1-64>            - Number of IPs resolved at once, 4 by\n"
+  "                                    default.\n"
   "  --double-decode                 - Decode double-encoded values.\n"
   "  --enable-panel=<PANEL>          - Enable parsing/displaying the given panel.\n"
+  "  --heavy-hitters=<PANEL:N>       - Keep only the N heaviest items of a panel,\n"
+  "                                    folding the rest into an Others item.\n"
   "  --hide-referer=<NEEDLE>         - Hide a referer but still count it. Wild cards\n"
   "                                    are allowed. i.e., *.bing.com\n"
+  "  --hll-precision=<4-16>          - Precision of --approx-visitors, 12 by\n"
+  "                                    default. Error is 1.04/sqrt(2^precision).\n"
   "  --hour-spec=<hr|min>            - Hour specificity. Possible values: `hr`\n"
   "                                    (default), or `min` (tenth of a min).\n"
   "  --ignore-crawlers               - Ignore crawlers.\n"
@@ -260,19 +296,39 @@ cmd_help (void)
   "                                    panel => Ignore from valid requests and panels.\n"
   "  --ignore-status=<CODE>          - Ignore parsing the given status code.\n"
   "  --keep-last=<NDAYS>             - Keep the last NDAYS in storage.\n"
+  "  --latency-percentiles           - Keep a histogram of times served per item\n"
+  "                                    and output their 50th, 95th and 99th\n"
+  "                                    percentiles.\n"
+  "  --max-keys=<PANEL:N>            - Cap a panel to N keys, folding the least hit\n"
+  "                                    ones into an Others item.\n"
   "  --num-tests=<number>            - Number of lines to test. >= 0 (10 default)\n"
   "  --process-and-exit              - Parse log and exit without outputting data.\n"
   "  --persist                       - Persist data to disk on exit to the given\n"
   "                                    --db-path or to /tmp by default.\n"
+  "  --persist-interval=<SECS>       - Also persist data in the background every\n"
+  "                                    SECS seconds. Requires --persist.\n"
+  "  --db-compression=<none|zlib>    - Compress each table persisted to disk.\n"
+  "  --db-compression-level=<1-9>    - Compression level, 6 by default.\n"
   "  --restore                       - Restore data from disk from the given\n"
   "                                    --db-path or from /tmp by default.\n"
+  "  --lazy-restore                  - Restore each panel's data the first time\n"
+  "                                    it is used. Requires --restore.\n"
+  "  --wal                           - Log changes to disk as they are parsed, so\n"
+  "                                    --restore recovers them after a crash.\n"
+  "                                    Requires --persist.\n"
+  "  --merge-db=<path,...>           - Merge the data persisted under each given\n"
+  "                                    path, e.g., by other nodes.\n"
   "  --real-os                       - Display real OS names. e.g, Windows XP, Snow\n"
   "                                    Leopard.\n"
+  "  --since=<TIME>                  - Only parse entries from TIME on. e.g.,\n"
+  "                                    \"2020-03-01 10:00\" or 2h (2 hours ago).\n"
   "  --sort-panel=PANEL,METRIC,ORDER - Sort panel on initial load. For example:\n"
   "                                    --sort-panel=VISITORS,BY_HITS,ASC. See\n"
   "                                    manpage for a list of panels/fields.\n"
   "  --static-file=<extension>       - Add static file extension. e.g.: .mp3.\n"
   "                                    Extensions are case sensitive.\n"
+  "  --until=<TIME>                  - Only parse entries before TIME. Same format\n"
+  "                                    as --since.\n"
   "\n"
 
 /* GeoIP Options */
@@ -315,6 +371,32 @@ set_array_opt (const char *oarg, const char *arr[], int *size, int max) {
     arr[(*size)++] = oarg;
 }
 
+/* Set the limit of a panel given as PANEL:N, e.g., REQUESTS:50000.
+ *
+ * On error, 1 is returned.
+ * On success 0 is returned */
+static int
+set_panel_limit (const char *oarg, uint32_t limits[]) {
+  char panel[16] = "", *sEnd;
+  unsigned long n;
+  int module, len = 0;
+
+  if (sscanf (oarg, "%15[^:]:%n", panel, &len) != 1 || len == 0)
+    return 1;
+  if ((module = get_module_enum (panel)) == -1)
+    return 1;
+  if (!isdigit ((unsigned char) oarg[len]))
+    return 1;
+
+  errno = 0;
+  n = strtoul (oarg + len, &sEnd, 10);
+  if (*sEnd != '\0' || errno == ERANGE || n == 0 || n > UINT32_MAX)
+    return 1;
+  limits[module] = n;
+
+  return 0;
+}
+
 /* Parse command line long options. */
 static void
 parse_long_opt (const char *name, const char *oarg) {
@@ -327,6 +409,10 @@ parse_long_opt (const char *name, const char *oarg) {
   if (!strcmp ("log-format", name))
     set_log_format_str (oarg);
 
+  /* JSON log format */
+  if (!strcmp ("json-log-format", name))
+    set_json_log_format_str (oarg);
+
   /* time format */
   if (!strcmp ("time-format", name))
     set_time_format_str (oarg);
@@ -449,10 +535,56 @@ parse_long_opt (const char *name, const char *oarg) {
   if (!strcmp ("persist", name))
     conf.persist = 1;
 
+  /* persist data in the background every N seconds */
+  if (!strcmp ("persist-interval", name)) {
+    char *sEnd;
+    long secs;
+
+    errno = 0;
+    secs = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || errno == ERANGE || secs < 0 ||
+        secs > UINT32_MAX)
+      FATAL ("%s %s", ERR_PERSIST_INTERVAL, oarg);
+    conf.persist_interval = secs;
+  }
+
+  /* compress the tables persisted to disk */
+  if (!strcmp ("db-compression", name)) {
+    if (!strcmp ("none", oarg))
+      conf.db_codec = GKDB_CODEC_NONE;
+#ifdef HAVE_LIBZ
+    else if (!strcmp ("zlib", oarg))
+      conf.db_codec = GKDB_CODEC_ZLIB;
+#endif
+    else
+      FATAL ("%s %s", ERR_DB_COMPRESSION, oarg);
+  }
+
+  /* compression level of the tables persisted to disk */
+  if (!strcmp ("db-compression-level", name)) {
+    char *sEnd;
+    long level = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || level < 1 || level > 9)
+      FATAL ("%s %s", ERR_DB_COMPRESSION_LEVEL, oarg);
+    conf.db_compression_level = level;
+  }
+
   /* restore data from disk */
   if (!strcmp ("restore", name))
     conf.restore = 1;
 
+  /* log changes to disk as they are parsed */
+  if (!strcmp ("wal", name))
+    conf.wal = 1;
+
+  /* merge data persisted elsewhere */
+  if (!strcmp ("merge-db", name))
+    set_array_opt (oarg, conf.merge_dbs, &conf.merge_db_idx, MAX_MERGE_DB);
+
+  /* restore each panel's data on first use */
+  if (!strcmp ("lazy-restore", name))
+    conf.lazy_restore = 1;
+
   /* TLS/SSL certificate */
   if (!strcmp ("ssl-cert", name))
     conf.sslcert = oarg;
@@ -500,6 +632,20 @@ parse_long_opt (const char *name, const char *oarg) {
   if (!strcmp ("all-static-files", name))
     conf.all_static_files = 1;
 
+  /* approximate unique visitors */
+  if (!strcmp ("approx-visitors", name))
+    conf.approx_visitors = 1;
+
+  /* precision of the approximated unique visitors */
+  if (!strcmp ("hll-precision", name)) {
+    char *sEnd;
+    long precision = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || precision < HLL_MIN_PRECISION ||
+        precision > HLL_MAX_PRECISION)
+      FATAL ("%s %s", ERR_HLL_PRECISION, oarg);
+    conf.hll_precision = precision;
+  }
+
   /* crawlers only */
   if (!strcmp ("crawlers-only", name))
     conf.crawlers_only = 1;
@@ -508,6 +654,42 @@ parse_long_opt (const char *name, const char *oarg) {
   if (!strcmp ("date-spec", name) && !strcmp (oarg, "hr"))
     conf.date_spec_hr = 1;
 
+  /* seconds resolved hostnames are kept across runs */
+  if (!strcmp ("dns-cache-ttl", name)) {
+    char *sEnd;
+    long secs;
+
+    errno = 0;
+    secs = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || errno == ERANGE || secs < 1 ||
+        secs > UINT32_MAX)
+      FATAL ("%s %s", ERR_DNS_CACHE_TTL, oarg);
+    conf.dns_cache_ttl = secs;
+  }
+
+  /* seconds before retrying a timed out reverse lookup */
+  if (!strcmp ("dns-negative-ttl", name)) {
+    char *sEnd;
+    long secs;
+
+    errno = 0;
+    secs = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || errno == ERANGE || secs < 1 ||
+        secs > UINT32_MAX)
+      FATAL ("%s %s", ERR_DNS_NEGATIVE_TTL, oarg);
+    conf.dns_negative_ttl = secs;
+  }
+
+  /* number of resolver threads */
+  if (!strcmp ("dns-workers", name)) {
+    char *sEnd;
+    long workers = strtol (oarg, &sEnd, 10);
+    if (oarg == sEnd || *sEnd != '\0' || workers < 1 ||
+        workers > DNS_MAX_WORKERS)
+      FATAL ("%s %s", ERR_DNS_WORKERS, oarg);
+    conf.dns_workers = workers;
+  }
+
   /* double decode */
   if (!strcmp ("double-decode", name))
     conf.double_decode = 1;
@@ -517,6 +699,16 @@ parse_long_opt (const char *name, const char *oarg) {
     set_array_opt (oarg, conf.enable_panels, &conf.enable_panel_idx,
                    TOTAL_MODULES);
 
+  /* monitor the heaviest items of a panel only */
+  if (!strcmp ("heavy-hitters", name) &&
+      set_panel_limit (oarg, conf.heavy_hitters) != 0)
+    FATAL ("%s %s", ERR_HEAVY_HITTERS, oarg);
+
+  /* cap on the keys of a panel */
+  if (!strcmp ("max-keys", name) &&
+      set_panel_limit (oarg, conf.max_keys) != 0)
+    FATAL ("%s %s", ERR_MAX_KEYS, oarg);
+
   /* hour specificity */
   if (!strcmp ("hour-spec", name) && !strcmp (oarg, "min"))
     conf.hour_spec_min = 1;
@@ -577,6 +769,16 @@ parse_long_opt (const char *name, const char *oarg) {
     conf.keep_last = keeplast >= 0 ? keeplast : 0;
   }
 
+  /* percentiles of the time served */
+  if (!strcmp ("latency-percentiles", name))
+    conf.latency_percentiles = 1;
+
+  /* only parse entries within the given time window */
+  if (!strcmp ("since", name) && (conf.since = str_to_window (oarg)) == -1)
+    FATAL ("%s %s", ERR_TIME_WINDOW, oarg);
+  if (!strcmp ("until", name) && (conf.until = str_to_window (oarg)) == -1)
+    FATAL ("%s %s", ERR_TIME_WINDOW, oarg);
+
   /* specifies the path of the database file */
   if (!strcmp ("db-path", name))
     conf.db_path = oarg;
@@ -786,6 +786,36 @@ print_def_maxts (FILE * fp, int sp) {
   print_def_block (fp, def, sp, 0);
 }
 
+/* Output JSON time served percentile definition blocks. They have no
+ * overall metadata, see --latency-percentiles. */
+static void
+print_def_pts (FILE * fp, int sp) {
+  GDefMetric p50 = {
+    .datakey = "p50ts",
+    .lbl = MTRC_P50TS_LBL,
+    .datatype = "utime",
+    .cwidth = "8%",
+  };
+  GDefMetric p95 = {
+    .datakey = "p95ts",
+    .lbl = MTRC_P95TS_LBL,
+    .datatype = "utime",
+    .cwidth = "8%",
+  };
+  GDefMetric p99 = {
+    .datakey = "p99ts",
+    .lbl = MTRC_P99TS_LBL,
+    .datatype = "utime",
+    .cwidth = "8%",
+  };
+
+  if (!conf.serve_usecs || !conf.latency_percentiles)
+    return;
+  print_def_block (fp, p50, sp, 0);
+  print_def_block (fp, p95, sp, 0);
+  print_def_block (fp, p99, sp, 0);
+}
+
 /* Output JSON method definition block. */
 static void
 print_def_method (FILE * fp, int sp) {
@@ -921,6 +951,7 @@ print_host_metrics (FILE * fp, const GHTML * def, int sp) {
   print_def_avgts (fp, sp);
   print_def_cumts (fp, sp);
   print_def_maxts (fp, sp);
+  print_def_pts (fp, sp);
 
   if (output->method)
     print_def_method (fp, sp);
@@ -945,6 +976,7 @@ print_metrics (FILE * fp, const GHTML * def, int sp) {
   print_def_avgts (fp, sp);
   print_def_cumts (fp, sp);
   print_def_maxts (fp, sp);
+  print_def_pts (fp, sp);
 
   if (output->method)
     print_def_method (fp, sp);
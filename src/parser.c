@@ -66,8 +66,10 @@
 
 #include "browsers.h"
 #include "goaccess.h"
+#include "gwal.h"
 #include "error.h"
 #include "opesys.h"
+#include "strscan.h"
 #include "util.h"
 #include "xmalloc.h"
 
@@ -103,6 +105,7 @@ static void insert_visitor (uint32_t uniq_nkey, GModule module);
 static void insert_bw (uint32_t data_nkey, uint64_t size, GModule module);
 static void insert_cumts (uint32_t data_nkey, uint64_t ts, GModule module);
 static void insert_maxts (uint32_t data_nkey, uint64_t ts, GModule module);
+static void insert_latency (uint32_t data_nkey, uint64_t ts, GModule module);
 static void insert_method (uint32_t data_nkey, const char *method,
                            GModule module);
 static void insert_protocol (uint32_t data_nkey, const char *proto,
@@ -122,6 +125,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -135,6 +139,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     insert_method,
     insert_protocol,
     NULL,
@@ -148,6 +153,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     insert_method,
     insert_protocol,
     NULL,
@@ -161,6 +167,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     insert_method,
     insert_protocol,
     NULL,
@@ -174,6 +181,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     insert_agent,
@@ -187,6 +195,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     insert_method,
     insert_protocol,
     NULL,
@@ -200,6 +209,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -213,6 +223,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -226,6 +237,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -239,6 +251,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -254,6 +267,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -269,6 +283,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -282,6 +297,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -295,6 +311,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -308,6 +325,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -321,6 +339,7 @@ static GParse paneling[] = {
     insert_bw,
     insert_cumts,
     insert_maxts,
+    insert_latency,
     NULL,
     NULL,
     NULL,
@@ -328,6 +347,15 @@ static GParse paneling[] = {
 };
 /* *INDENT-ON* */
 
+/* Preset log format handled by parse_preset(), or -1 if none */
+static int preset_fmt = -1;
+/* Keys mapped by --json-log-format */
+static GJSONSpecs json_specs;
+#ifdef HAVE_LIBZ
+/* Readers decompressing gzip logs ahead of parsing, by log index */
+static GReader **gz_readers = NULL;
+#endif
+
 /* Initialize a new GKeyData instance */
 static void
 new_modulekey (GKeyData * kdata) {
@@ -517,24 +545,52 @@ free_glog (GLogItem * logitem) {
   free (logitem);
 }
 
-/* Decodes the given URL-encoded string.
+/* Decodes the given URL-encoded string in place. Runs of bytes
+ * between escapes are located with strscan2() and moved as a block.
  *
- * On success, the decoded string is assigned to the output buffer. */
+ * On success, the number of '%' in the decoded string is returned. */
 #define B16210(x) (((x) >= '0' && (x) <= '9') ? ((x) - '0') : (toupper((x)) - 'A' + 10))
-static void
-decode_hex (char *url, char *out) {
-  char *ptr;
-  const char *c;
-
-  for (c = url, ptr = out; *c; c++) {
-    if (*c != '%' || !isxdigit (c[1]) || !isxdigit (c[2])) {
-      *ptr++ = *c;
+static int
+decode_hex (char *url) {
+  char *ptr, *c, *next;
+  size_t len = 0;
+  int pct = 0;
+
+  /* nothing to move up to the first escape */
+  ptr = c = (char *) strscan2 (url, '%', '%');
+  while (*c) {
+    if (!isxdigit (c[1]) || !isxdigit (c[2])) {
+      *ptr = *c++;
     } else {
-      *ptr++ = (char) ((B16210 (c[1]) * 16) + (B16210 (c[2])));
-      c += 2;
+      *ptr = (char) ((B16210 (c[1]) * 16) + (B16210 (c[2])));
+      c += 3;
     }
+    pct += *ptr++ == '%';
+
+    next = (char *) strscan2 (c, '%', '%');
+    len = next - c;
+    memmove (ptr, c, len);
+    ptr += len;
+    c = next;
   }
   *ptr = 0;
+
+  return pct;
+}
+
+/* Decodes the given URL-encoded string in place. The second pass of
+ * --double-decode is skipped when the first one left no '%' behind.
+ *
+ * On success, the decoded trimmed string is returned. */
+static char *
+decode_str (char *url) {
+  /* double encoded URL? */
+  if (decode_hex (url) && conf.double_decode)
+    decode_hex (url);
+  if (*strscan2 (url, '\r', '\n') != '\0')
+    strip_newlines (url);
+
+  return trim_str (url);
 }
 
 /* Entry point to decode the given URL-encoded string.
@@ -543,19 +599,10 @@ decode_hex (char *url, char *out) {
  * buffer. */
 static char *
 decode_url (char *url) {
-  char *out, *decoded;
-
   if ((url == NULL) || (*url == '\0'))
     return NULL;
 
-  out = decoded = xstrdup (url);
-  decode_hex (url, out);
-  /* double encoded URL? */
-  if (conf.double_decode)
-    decode_hex (decoded, out);
-  strip_newlines (out);
-
-  return trim_str (out);
+  return decode_str (xstrdup (url));
 }
 
 /* Process keyphrases from Google search, cache, and translate.
@@ -622,13 +669,13 @@ extract_keyphrase (char *ref, char **keyphrase) {
  * returned. */
 static int
 extract_geolocation (GLogItem * logitem, char *continent, char *country) {
+  char city[CITY_LEN] = "";
+
   if (!is_geoip_resource ())
     return 1;
 
-  geoip_get_country (logitem->host, country, logitem->type_ip);
-  geoip_get_continent (logitem->host, continent, logitem->type_ip);
-
-  return 0;
+  /* a single (cached) lookup sets all location fields */
+  return set_geolocation (logitem->host, continent, country, city);
 }
 #endif
 
@@ -800,7 +847,7 @@ extract_protocol (const char *token) {
  * protocol are assigned to the corresponding buffers. */
 static char *
 parse_req (char *line, char **method, char **protocol) {
-  char *req = NULL, *request = NULL, *dreq = NULL, *ptr = NULL;
+  char *req = NULL, *request = NULL, *ptr = NULL;
   const char *meth, *proto;
   ptrdiff_t rlen;
 
@@ -808,7 +855,8 @@ parse_req (char *line, char **method, char **protocol) {
 
   /* couldn't find a method, so use the whole request line */
   if (meth == NULL) {
-    request = xstrdup (line);
+    req = line;
+    rlen = strlen (line);
   }
   /* method found, attempt to parse request */
   else {
@@ -820,10 +868,6 @@ parse_req (char *line, char **method, char **protocol) {
     if ((rlen = ptr - req) <= 0)
       return alloc_string ("-");
 
-    request = xmalloc (rlen + 1);
-    strncpy (request, req, rlen);
-    request[rlen] = 0;
-
     if (conf.append_method)
       (*method) = strtoupper (xstrdup (meth));
 
@@ -831,15 +875,17 @@ parse_req (char *line, char **method, char **protocol) {
       (*protocol) = strtoupper (xstrdup (proto));
   }
 
-  if (!(dreq = decode_url (request)))
-    return request;
-  else if (*dreq == '\0') {
-    free (dreq);
-    return request;
+  request = xmalloc (rlen + 1);
+  memcpy (request, req, rlen);
+  request[rlen] = 0;
+
+  /* decoded in place, keep it as is if nothing was left */
+  if (*decode_str (request) == '\0') {
+    memcpy (request, req, rlen);
+    request[rlen] = 0;
   }
 
-  free (request);
-  return dreq;
+  return request;
 }
 
 /* Extract the next delimiter given a log format and copy the
@@ -898,6 +944,8 @@ parse_string (char **str, const char *delims, int cnt) {
 
   end = !*delims ? 0x0 : *p;
   do {
+    /* skip over anything that isn't a delim or an escape */
+    pch = (char *) strscan2 (pch, end, '\\');
     /* match number of delims */
     if (*pch == end)
       idx++;
@@ -1144,12 +1192,7 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     if (tkn == NULL || *tkn == '\0')
       return spec_err (logitem, SPEC_TOKN_NUL, *p, NULL);
 
-    if ((logitem->req = decode_url (tkn)) == NULL) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
-    free (tkn);
+    logitem->req = decode_str (tkn);
     break;
     /* query string alone, e.g., ?param=goaccess&tbm=shop */
   case 'q':
@@ -1159,12 +1202,7 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     if (tkn == NULL || *tkn == '\0')
       return 0;
 
-    if ((logitem->qstr = decode_url (tkn)) == NULL) {
-      spec_err (logitem, SPEC_TOKN_INV, *p, tkn);
-      free (tkn);
-      return 1;
-    }
-    free (tkn);
+    logitem->qstr = decode_str (tkn);
     break;
     /* request protocol */
   case 'H':
@@ -1255,8 +1293,7 @@ parse_specifier (GLogItem * logitem, char **str, const char *p, const char *end)
     if (tkn != NULL && *tkn != '\0') {
       /* Make sure the user agent is decoded (i.e.: CloudFront)
        * and replace all '+' with ' ' (i.e.: w3c) */
-      logitem->agent = decode_url (tkn);
-      free (tkn);
+      logitem->agent = decode_str (tkn);
       break;
     } else if (tkn != NULL && *tkn == '\0') {
       free (tkn);
@@ -1375,6 +1412,18 @@ extract_braces (char **p) {
   return ret;
 }
 
+/* Get the length of the initial segment of `str` not containing any
+ * of the `skips` characters. Typical XFF reject sets hold one or two
+ * characters, e.g., ", ", so those are scanned with strscan2().
+ *
+ * The length of the segment is returned. */
+static size_t
+xff_span (const char *str, const char *skips) {
+  if (skips[0] == '\0' || (skips[1] != '\0' && skips[2] != '\0'))
+    return strcspn (str, skips);
+  return strscan2 (str, skips[0], skips[1] ? skips[1] : skips[0]) - str;
+}
+
 /* Attempt to extract the client IP from an X-Forwarded-For (XFF) field.
  *
  * If no IP is found, 1 is returned.
@@ -1390,7 +1439,7 @@ find_xff_host (GLogItem * logitem, char **str, char **p) {
 
   ptr = *str;
   while (*ptr != '\0') {
-    if ((len = strcspn (ptr, skips)) == 0) {
+    if ((len = xff_span (ptr, skips)) == 0) {
       len++, ptr++;
       goto move;
     }
@@ -1441,15 +1490,15 @@ special_specifier (GLogItem * logitem, char **str, char **p) {
   return 0;
 }
 
-/* Iterate over the given log format.
+/* Iterate over the given log format, or a fragment of it.
  *
  * On error, or unable to parse it, 1 is returned.
  * On success, the malloc'd token is assigned to a GLogItem member and
  * 0 is returned. */
 static int
-parse_format (GLogItem * logitem, char *str) {
+parse_format (GLogItem * logitem, char *str, char *lfmt) {
   char end[2 + 1] = { 0 };
-  char *lfmt = conf.log_format, *p = NULL;
+  char *p = NULL;
   int perc = 0, tilde = 0, optdelim = 0;
 
   if (str == NULL || *str == '\0')
@@ -1500,6 +1549,614 @@ parse_format (GLogItem * logitem, char *str) {
   return 0;
 }
 
+/* Move forward through a JSON text until a non-whitespace char. */
+static char *
+json_ws (char *s) {
+  while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+    s++;
+  return s;
+}
+
+/* Find the closing quote of a JSON string, given the char after its
+ * opening quote.
+ *
+ * If the string is not terminated, NULL is returned.
+ * On success, a pointer to the closing quote is returned. */
+static char *
+json_str_end (char *s) {
+  for (;;) {
+    s = (char *) strscan2 (s, '"', '\\');
+    if (*s == '"')
+      return s;
+    if (*s == '\0' || s[1] == '\0')
+      return NULL;
+    s += 2;
+  }
+}
+
+/* Skip over a JSON object or array, including any nested ones.
+ *
+ * If it's not terminated, NULL is returned.
+ * On success, a pointer past its closing bracket is returned. */
+static char *
+json_skip (char *s) {
+  int depth = 0;
+
+  for (; *s; s++) {
+    if (*s == '"') {
+      if ((s = json_str_end (s + 1)) == NULL)
+        return NULL;
+    } else if (*s == '{' || *s == '[') {
+      depth++;
+    } else if ((*s == '}' || *s == ']') && --depth == 0) {
+      return s + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/* Parse the four hex digits of a \uXXXX escape.
+ *
+ * On error, -1 is returned.
+ * On success, the code unit is returned. */
+static long
+json_hex4 (const char *s) {
+  long cp = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    if (!isxdigit ((unsigned char) s[i]))
+      return -1;
+    cp = cp * 16 + B16210 (s[i]);
+  }
+
+  return cp;
+}
+
+/* Unescape the given NUL-terminated JSON string in place. Unicode
+ * escapes are converted to UTF-8, which is never longer than the
+ * escape itself. */
+static void
+json_unescape (char *s) {
+  char *d = NULL;
+  long cp = 0, lo = 0;
+
+  /* nothing to move up to the first escape */
+  s = d = (char *) strscan2 (s, '\\', '\\');
+  while (*s) {
+    if (*s != '\\') {
+      *d++ = *s++;
+      continue;
+    }
+    switch (s[1]) {
+    case '"':
+    case '\\':
+    case '/':
+      *d++ = s[1];
+      break;
+    case 'b':
+      *d++ = '\b';
+      break;
+    case 'f':
+      *d++ = '\f';
+      break;
+    case 'n':
+      *d++ = '\n';
+      break;
+    case 'r':
+      *d++ = '\r';
+      break;
+    case 't':
+      *d++ = '\t';
+      break;
+    case 'u':
+      if ((cp = json_hex4 (s + 2)) <= 0)
+        goto raw;
+      s += 4;
+      /* surrogate pair */
+      if (cp >= 0xD800 && cp <= 0xDBFF && s[2] == '\\' && s[3] == 'u' &&
+          (lo = json_hex4 (s + 4)) >= 0xDC00 && lo <= 0xDFFF) {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        s += 6;
+      }
+      if (cp < 0x80) {
+        *d++ = (char) cp;
+      } else if (cp < 0x800) {
+        *d++ = (char) (0xC0 | (cp >> 6));
+        *d++ = (char) (0x80 | (cp & 0x3F));
+      } else if (cp < 0x10000) {
+        *d++ = (char) (0xE0 | (cp >> 12));
+        *d++ = (char) (0x80 | ((cp >> 6) & 0x3F));
+        *d++ = (char) (0x80 | (cp & 0x3F));
+      } else {
+        *d++ = (char) (0xF0 | (cp >> 18));
+        *d++ = (char) (0x80 | ((cp >> 12) & 0x3F));
+        *d++ = (char) (0x80 | ((cp >> 6) & 0x3F));
+        *d++ = (char) (0x80 | (cp & 0x3F));
+      }
+      break;
+    default:
+    raw:
+      /* keep invalid escapes as they are */
+      *d++ = *s++;
+      continue;
+    }
+    s += 2;
+  }
+  *d = '\0';
+}
+
+/* Find the log format fragment mapped to the given JSON key.
+ *
+ * If the key is not mapped, NULL is returned.
+ * On success, the format fragment is returned. */
+static char *
+json_spec_fmt (const char *key, size_t klen) {
+  int i;
+
+  for (i = 0; i < json_specs.idx; i++) {
+    if (json_specs.items[i].klen == klen &&
+        memcmp (json_specs.items[i].key, key, klen) == 0)
+      return json_specs.items[i].fmt;
+  }
+
+  return NULL;
+}
+
+/* Iterate over the members of a flat JSON object held in the given
+ * (writable) buffer. String values are unescaped in place, other
+ * scalars are passed as is and nested objects or arrays are skipped.
+ * If a callback is given, it's called for every member whose key is
+ * mapped in --json-log-format, otherwise for every string member.
+ *
+ * On error, or if the callback fails, 1 is returned.
+ * On success, 0 is returned. */
+static int
+json_members (char *s, int (*cb) (void *, char *, size_t, char *), void *data) {
+  char *key = NULL, *end = NULL, c;
+  size_t klen = 0;
+  int skip = 0, ret = 0;
+
+  s = json_ws (s);
+  if (*s++ != '{')
+    return 1;
+
+  for (s = json_ws (s); *s != '}'; s = json_ws (s + 1)) {
+    if (*s != '"' || (end = json_str_end (s + 1)) == NULL)
+      return 1;
+    key = s + 1;
+    klen = end - key;
+
+    s = json_ws (end + 1);
+    if (*s++ != ':')
+      return 1;
+    s = json_ws (s);
+
+    skip = data != NULL && json_spec_fmt (key, klen) == NULL;
+    if (*s == '"') {
+      if ((end = json_str_end (s + 1)) == NULL)
+        return 1;
+      if (!skip) {
+        *end = '\0';
+        json_unescape (s + 1);
+        ret = cb (data, key, klen, s + 1);
+      }
+      s = end + 1;
+    } else if (*s == '{' || *s == '[') {
+      if ((s = json_skip (s)) == NULL)
+        return 1;
+    } else {
+      end = s + strcspn (s, ",} \t\r\n");
+      if (end == s)
+        return 1;
+      /* scalars are only meaningful to the log parser */
+      if (data != NULL && !skip &&
+          (end - s != 4 || strncmp (s, "null", 4) != 0)) {
+        c = *end;
+        *end = '\0';
+        ret = cb (data, key, klen, s);
+        *end = c;
+      }
+      s = end;
+    }
+    if (ret)
+      return 1;
+
+    s = json_ws (s);
+    if (*s == '}')
+      break;
+    if (*s != ',')
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Parse the value of a mapped JSON member with its format fragment.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+json_member_value (void *data, char *key, size_t klen, char *val) {
+  GLogItem *logitem = data;
+  char *fmt = json_spec_fmt (key, klen);
+
+  if (*val != '\0')
+    return parse_format (logitem, val, fmt);
+
+  /* an empty value is an empty token to a single specifier, e.g., an
+   * empty referrer, otherwise it's a missing field */
+  if (fmt[0] == '%' && fmt[1] != '\0' && fmt[2] == '\0')
+    return parse_specifier (logitem, &val, fmt + 1, "");
+
+  return 0;
+}
+
+/* Add a member of --json-log-format to the list of mapped keys.
+ *
+ * On success, 0 is returned. */
+static int
+json_add_spec (GO_UNUSED void *data, char *key, size_t klen, char *val) {
+  GJSONSpec *spec = NULL;
+
+  if (json_specs.idx == json_specs.size) {
+    json_specs.size = json_specs.size ? json_specs.size * 2 : 8;
+    json_specs.items =
+      xrealloc (json_specs.items, json_specs.size * sizeof (GJSONSpec));
+  }
+
+  spec = &json_specs.items[json_specs.idx++];
+  spec->key = xmalloc (klen + 1);
+  memcpy (spec->key, key, klen);
+  spec->key[klen] = '\0';
+  spec->klen = klen;
+  spec->fmt = xstrdup (val);
+
+  return 0;
+}
+
+/* Free the keys mapped by --json-log-format. */
+void
+free_json_log_format (void) {
+  int i;
+
+  for (i = 0; i < json_specs.idx; i++) {
+    free (json_specs.items[i].key);
+    free (json_specs.items[i].fmt);
+  }
+  free (json_specs.items);
+  free (json_specs.buf);
+  memset (&json_specs, 0, sizeof (json_specs));
+}
+
+/* Build the list of mapped keys from --json-log-format.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+set_json_log_format (void) {
+  char *fmt = NULL;
+  int ret = 0;
+
+  free_json_log_format ();
+  if (!conf.json_log_format)
+    return 0;
+
+  fmt = xstrdup (conf.log_format);
+  ret = json_members (fmt, json_add_spec, NULL);
+  free (fmt);
+
+  return ret || json_specs.idx == 0;
+}
+
+/* Parse a line of a JSON access log, e.g., one JSON object per line.
+ * The line is copied to a scratch buffer that grows as needed, so the
+ * original line is left untouched for error reporting.
+ *
+ * On error, 1 is returned.
+ * On success, the GLogItem is set and 0 is returned. */
+static int
+parse_json_format (GLogItem * logitem, char *line) {
+  size_t len = strlen (line) + 1;
+
+  if (len > json_specs.buf_size) {
+    json_specs.buf_size = len;
+    json_specs.buf = xrealloc (json_specs.buf, len);
+  }
+  memcpy (json_specs.buf, line, len);
+
+  if (json_members (json_specs.buf, json_member_value, logitem)) {
+    if (logitem->errstr == NULL)
+      logitem->errstr = xstrdup ("Invalid JSON log line.");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Parse two decimal digits within the given range.
+ *
+ * On error, -1 is returned.
+ * On success, the parsed number is returned. */
+static int
+preset_num (const char *s, int min, int max) {
+  int n = 0;
+
+  if (s[0] < '0' || s[0] > '9' || s[1] < '0' || s[1] > '9')
+    return -1;
+  n = (s[0] - '0') * 10 + (s[1] - '0');
+
+  return (n < min || n > max) ? -1 : n;
+}
+
+/* Parse the month abbreviation of an Apache date, i.e., %b.
+ *
+ * On error, -1 is returned.
+ * On success, the month (0-11) is returned. */
+static int
+preset_month (const char *s) {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  int i;
+
+  for (i = 0; i < 12; i++) {
+    if (s[0] == months[i * 3] && s[1] == months[i * 3 + 1] &&
+        s[2] == months[i * 3 + 2])
+      return i;
+  }
+
+  return -1;
+}
+
+/* Parse an Apache date and time, i.e., 01/Mar/2020:13:37:00. Only
+ * zero-padded fields within the ranges strptime(3) accepts are taken,
+ * so the result matches %d/%b/%Y and %H:%M:%S.
+ *
+ * On error, 1 is returned.
+ * On success, the date and time are set, the string is moved past the
+ * time and 0 is returned. */
+static int
+preset_date_time (GLogItem * logitem, char **str) {
+  char buf[DATE_LEN] = "";
+  const char *s = *str;
+  int day = 0, mon = 0, hour = 0, min = 0, sec = 0, i;
+
+  if ((day = preset_num (s, 1, 31)) == -1 || s[2] != '/')
+    return 1;
+  if ((mon = preset_month (s + 3)) == -1 || s[6] != '/')
+    return 1;
+  /* 4-digit years only, so %Y formats them back the same way */
+  if (s[7] < '1' || s[7] > '9')
+    return 1;
+  for (i = 8; i < 11; i++)
+    if (s[i] < '0' || s[i] > '9')
+      return 1;
+  if (s[11] != ':')
+    return 1;
+  if ((hour = preset_num (s + 12, 0, 23)) == -1 || s[14] != ':')
+    return 1;
+  if ((min = preset_num (s + 15, 0, 59)) == -1 || s[17] != ':')
+    return 1;
+  if ((sec = preset_num (s + 18, 0, 59)) == -1 || s[20] != ' ')
+    return 1;
+
+  /* %Y%m%d */
+  memcpy (buf, s + 7, 4);
+  buf[4] = '0' + (mon + 1) / 10;
+  buf[5] = '0' + (mon + 1) % 10;
+  memcpy (buf + 6, s, 2);
+  buf[8] = '\0';
+  logitem->date = xstrdup (buf);
+
+  /* %H:%M:%S */
+  logitem->time = xmalloc (TIME_LEN);
+  memcpy (logitem->time, s + 12, 8);
+  logitem->time[8] = '\0';
+
+  logitem->dt.tm_year = atoi (s + 7) - 1900;
+  logitem->dt.tm_mon = mon;
+  logitem->dt.tm_mday = day;
+  logitem->dt.tm_hour = hour;
+  logitem->dt.tm_min = min;
+  logitem->dt.tm_sec = sec;
+
+  *str += 20;
+
+  return 0;
+}
+
+/* Parse the remote host of a preset log format, i.e., %h followed by
+ * a space.
+ *
+ * On error, 1 is returned.
+ * On success, the host is set, the string is moved to the delimiter
+ * and 0 is returned. */
+static int
+preset_host (GLogItem * logitem, char **str) {
+  char *s = *str, *end = NULL, *host = NULL;
+
+  /* escaped or untrimmed tokens are left to parse_string() */
+  end = (char *) strscan2 (s, ' ', '\\');
+  if (*end != ' ' || end == s || isspace ((unsigned char) s[0]) ||
+      isspace ((unsigned char) end[-1]))
+    return 1;
+
+  host = xmalloc (end - s + 1);
+  memcpy (host, s, end - s);
+  host[end - s] = '\0';
+
+  if (!conf.no_ip_validation && invalid_ipaddr (host, &logitem->type_ip)) {
+    free (host);
+    return 1;
+  }
+  logitem->host = host;
+  *str = end;
+
+  return 0;
+}
+
+/* Parse the response size of a preset log format, i.e., %b, either
+ * followed by a space or at the end of the line.
+ *
+ * On error, 1 is returned.
+ * On success, the size is set, the string is moved past it and 0 is
+ * returned. */
+static int
+preset_size (GLogItem * logitem, char **str, int last) {
+  uint64_t bandw = 0;
+  char *s = *str;
+  int ndigits = 0;
+
+  for (; *s >= '0' && *s <= '9'; s++, ndigits++)
+    bandw = bandw * 10 + (*s - '0');
+  /* might not fit in 64 bits, let strtoull() deal with it */
+  if (ndigits > 19)
+    return 1;
+  if (ndigits == 0 && *s++ != '-')
+    return 1;
+
+  if (!last && *s != ' ')
+    return 1;
+  if (last) {
+    while (isspace ((unsigned char) *s))
+      s++;
+    if (*s != '\0')
+      return 1;
+  }
+
+  logitem->resp_size = bandw;
+  conf.bandwidth = 1;
+  *str = s;
+
+  return 0;
+}
+
+/* Parse a line of one of the NCSA preset log formats, i.e., COMBINED,
+ * VCOMBINED, COMMON or VCOMMON, with the field order and delimiters
+ * known upfront. Only the canonical layout is taken, anything else is
+ * left to parse_format().
+ *
+ * If the line doesn't match the preset, 1 is returned.
+ * On success, the GLogItem is set and 0 is returned. */
+static int
+parse_preset (GLogItem * logitem, char *str) {
+  char *p = NULL;
+  int vhost = preset_fmt == VCOMBINED || preset_fmt == VCOMMON;
+  int common = preset_fmt == COMMON || preset_fmt == VCOMMON;
+
+  if (str == NULL || *str == '\0')
+    return 1;
+
+  /* %v:%^ */
+  if (vhost) {
+    if (parse_specifier (logitem, &str, "v:", ":") || *str++ != ':')
+      return 1;
+    if ((p = strchr (str, ' ')) == NULL)
+      return 1;
+    str = p + 1;
+    if (*str == '\0')
+      return 0;
+  }
+
+  /* %h %^[ */
+  if (preset_host (logitem, &str))
+    return 1;
+  if ((p = strchr (str + 1, '[')) == NULL)
+    return 1;
+  str = p + 1;
+
+  /* %d:%t %^] " */
+  if (preset_date_time (logitem, &str))
+    return 1;
+  if ((p = strchr (str + 1, ']')) == NULL || p[1] != ' ' || p[2] != '"')
+    return 1;
+  str = p + 3;
+
+  /* %r" */
+  if (*str == '\0')
+    return 0;
+  if (parse_specifier (logitem, &str, "r\"", "\"") || *str != '"' ||
+      str[1] != ' ')
+    return 1;
+  str += 2;
+
+  /* %s %b */
+  if (*str == '\0')
+    return 0;
+  if (str[0] < '1' || str[0] > '5' || preset_num (str + 1, 0, 99) == -1 ||
+      str[3] != ' ')
+    return 1;
+  logitem->status = xmalloc (4);
+  memcpy (logitem->status, str, 3);
+  logitem->status[3] = '\0';
+  str += 4;
+
+  if (*str == '\0')
+    return 0;
+  if (preset_size (logitem, &str, common))
+    return 1;
+  if (common)
+    return 0;
+
+  /* "%R" "%u" */
+  if (str[1] != '"')
+    return 1;
+  str += 2;
+  if (*str == '\0')
+    return 0;
+  if (parse_specifier (logitem, &str, "R\"", "\"") || *str != '"' ||
+      str[1] != ' ' || str[2] != '"')
+    return 1;
+  str += 3;
+
+  if (*str == '\0')
+    return 0;
+  return parse_specifier (logitem, &str, "u\"", "\"");
+}
+
+/* Determine if the current log, date and time formats can be handled
+ * by parse_preset(). */
+static void
+set_preset_format (void) {
+  int idx = (int) get_selected_format_idx ();
+
+  preset_fmt = -1;
+  if (idx != COMBINED && idx != VCOMBINED && idx != COMMON && idx != VCOMMON)
+    return;
+
+  if (!conf.date_format || strcmp (conf.date_format, "%d/%b/%Y") != 0)
+    return;
+  if (!conf.time_format || (strcmp (conf.time_format, "%H:%M:%S") != 0 &&
+                            strcmp (conf.time_format, "%T") != 0))
+    return;
+  if (!conf.date_num_format || strcmp (conf.date_num_format, "%Y%m%d") != 0)
+    return;
+
+  preset_fmt = idx;
+}
+
+/* Parse a line of log, and fill structure with appropriate values.
+ * JSON logs are parsed by parse_json_format(). Preset log formats are
+ * attempted first with parse_preset(), lines that don't fit are parsed
+ * from scratch by parse_format().
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+parse_line (GLog * glog, GLogItem ** logitem, char *line) {
+  if (conf.json_log_format)
+    return parse_json_format (*logitem, line);
+
+  if (preset_fmt != -1) {
+    if (parse_preset (*logitem, line) == 0)
+      return 0;
+    free_glog (*logitem);
+    *logitem = init_log_item (glog);
+  }
+
+  return parse_format (*logitem, line, conf.log_format);
+}
+
 /* Determine if the log string is valid and if it's not a comment.
  *
  * On error, or invalid, 1 is returned.
@@ -1516,20 +2173,6 @@ valid_line (char *line) {
   return 0;
 }
 
-/* Determine if we need to lock the mutex. */
-static void
-lock_spinner (void) {
-  if (parsing_spinner != NULL && parsing_spinner->state == SPN_RUN)
-    pthread_mutex_lock (&parsing_spinner->mutex);
-}
-
-/* Determine if we need to unlock the mutex. */
-static void
-unlock_spinner (void) {
-  if (parsing_spinner != NULL && parsing_spinner->state == SPN_RUN)
-    pthread_mutex_unlock (&parsing_spinner->mutex);
-}
-
 /* Ignore request's query string. e.g.,
  * /index.php?timestamp=1454385289 */
 static void
@@ -1597,7 +2240,7 @@ verify_missing_fields (GLogItem * logitem) {
 static void
 count_invalid (GLog * glog, const char *line) {
   glog->invalid++;
-  ht_inc_cnt_overall ("failed_requests", 1);
+  ht_inc_cnt_overall (CNT_INVALID, 1);
 
   if (conf.invalid_requests_log) {
     LOG_INVALID (("%s", line));
@@ -1642,18 +2285,15 @@ uncount_processed (GLog * glog) {
 /* Keep track of all valid log strings. */
 static void
 count_valid (int num_date) {
-  lock_spinner ();
   ht_inc_cnt_valid (num_date, 1);
-  unlock_spinner ();
 }
 
-/* Keep track of all valid and processed log strings. */
+/* Keep track of all valid and processed log strings. The spinner reads
+ * the number processed as it goes, without locking. */
 static void
 count_process (GLog * glog) {
-  lock_spinner ();
-  glog->processed++;
-  ht_inc_cnt_overall ("total_requests", 1);
-  unlock_spinner ();
+  __atomic_add_fetch (&glog->processed, 1, __ATOMIC_RELAXED);
+  ht_inc_cnt_overall (CNT_PROCESSED, 1);
 }
 
 /* Keep track of all excluded log strings (IPs).
@@ -1663,7 +2303,7 @@ count_process (GLog * glog) {
 static int
 excluded_ip (GLogItem * logitem) {
   if (conf.ignore_ip_idx && ip_in_range (logitem->host)) {
-    ht_inc_cnt_overall ("excluded_ip", 1);
+    ht_inc_cnt_overall (CNT_EXCLUDED_IP, 1);
     return 0;
   }
   return 1;
@@ -1840,6 +2480,13 @@ insert_maxts (uint32_t data_nkey, uint64_t ts, GModule module) {
   //ht_insert_meta_data (module, "maxts", ts);
 }
 
+/* A wrapper call to add a time served to the histogram of an
+ * uint32_t key. */
+static void
+insert_latency (uint32_t data_nkey, uint64_t ts, GModule module) {
+  ht_insert_latency (module, data_nkey, ts);
+}
+
 static void
 insert_method (uint32_t nkey, const char *data, GModule module) {
   ht_insert_method (module, nkey, data ? data : "---");
@@ -2408,6 +3055,9 @@ set_datamap (GLogItem * logitem, GKeyData * kdata, const GParse * parse) {
   /* insert averages time served */
   if (parse->maxts)
     parse->maxts (kdata->data_nkey, logitem->serve_time, module);
+  /* insert time served distribution */
+  if (parse->latency && conf.latency_percentiles)
+    parse->latency (kdata->data_nkey, logitem->serve_time, module);
   /* insert method */
   if (parse->method && conf.append_method)
     parse->method (kdata->data_nkey, logitem->method, module);
@@ -2432,10 +3082,15 @@ map_log (GLogItem * logitem, const GParse * parse, GModule module) {
   if (parse->datamap && kdata.data_key)
     kdata.data_nkey = insert_keymap (kdata.data_key, module);
 
-  /* each module contains a uniq visitor key/value */
-  if (parse->visitor && logitem->uniq_key && include_uniq (logitem))
-    kdata.uniq_nkey =
-      insert_uniqmap (kdata.data_nkey, logitem->uniq_nkey, module);
+  /* each module contains a uniq visitor key/value, or a sketch of its
+   * visitors, which sets the visitors count itself */
+  if (parse->visitor && logitem->uniq_key && include_uniq (logitem)) {
+    if (!conf.approx_visitors)
+      kdata.uniq_nkey =
+        insert_uniqmap (kdata.data_nkey, logitem->uniq_nkey, module);
+    else if (kdata.data_nkey)
+      ht_insert_uniq_hll (module, kdata.data_nkey, logitem->uniq_hash);
+  }
 
   /* root keys are optional */
   if (parse->rootmap && kdata.root_key)
@@ -2484,8 +3139,11 @@ process_log (GLogItem * logitem) {
     num_date = clean_old_data_by_date (logitem->date);
 
   /* Insert one unique visitor key per request to avoid the
-   * overhead of storing one key per module */
-  if ((logitem->uniq_nkey = ht_insert_unique_key (logitem->uniq_key)) == 0)
+   * overhead of storing one key per module. Approximated visitors
+   * are never stored, only hashed. */
+  if (conf.approx_visitors)
+    logitem->uniq_hash = hll_hash (logitem->uniq_key);
+  else if ((logitem->uniq_nkey = ht_insert_unique_key (logitem->uniq_key)) == 0)
     return;
 
   /* If we need to store user agents per IP, then we store them and retrieve
@@ -2514,6 +3172,53 @@ process_log (GLogItem * logitem) {
   }
 }
 
+/* Determine if the given timestamp falls within the --since/--until
+ * time window. Once well past its end, stop reading a time ordered log.
+ *
+ * If not within the time window, 0 is returned.
+ * If within the time window, 1 is returned. */
+static int
+in_time_window (GLog * glog, time_t ts) {
+  if (conf.since && ts < conf.since)
+    return 0;
+  if (conf.until && ts >= conf.until) {
+    if (glog->time_ordered && ts >= conf.until + WINDOW_SLACK)
+      glog->window_done = 1;
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Get the checkpoint of the log being read, i.e., the lines of it
+ * already parsed. */
+static uint32_t
+get_last_parse (GLog * glog) {
+  return glog->gz ? ht_get_gz_parse (glog->inode) :
+    ht_get_last_parse (glog->inode);
+}
+
+/* Commit the changes made by the current line to the write-ahead log,
+ * and take a background snapshot of the storage if one is due. The
+ * checkpoint of the log being read is moved up to the current line
+ * first, so replaying the log or restoring the snapshot resumes past
+ * the lines already counted. */
+static void
+commit_log (GLog * glog) {
+  int snapshot = snapshot_due ();
+
+  if ((conf.wal || snapshot) && glog->inode) {
+    if (glog->gz)
+      ht_insert_gz_parse (glog->inode, glog->read + 1);
+    else
+      ht_insert_last_parse (glog->inode, glog->read + 1);
+  }
+  wal_commit ();
+
+  if (snapshot)
+    snapshot_storage ();
+}
+
 /* Process a line from the log and store it accordingly taking into
  * account multiple parsing options prior to setting data into the
  * corresponding data structure.
@@ -2523,7 +3228,7 @@ static int
 pre_process_log (GLog * glog, char *line, int dry_run) {
   GLogItem *logitem;
   int ret = 0;
-  uint32_t last = ht_get_last_parse (glog->inode);
+  uint32_t last = get_last_parse (glog);
   uint32_t ts = 0;
 
   /* if it's a log, then use the last parsed line */
@@ -2534,17 +3239,24 @@ pre_process_log (GLog * glog, char *line, int dry_run) {
   if (valid_line (line))
     return -1;
 
-  count_process (glog);
   logitem = init_log_item (glog);
   /* Parse a line of log, and fill structure with appropriate values */
-  if (parse_format (logitem, line) || verify_missing_fields (logitem)) {
+  if (parse_line (glog, &logitem, line) || verify_missing_fields (logitem)) {
+    count_process (glog);
     ret = 1;
     count_invalid (glog, line);
     goto cleanup;
   }
 
-  /* it's a pipe, then use the last parsed timestamp */
+  /* entries outside of the time window are not counted */
   ts = mktime (&logitem->dt);
+  if (!in_time_window (glog, ts)) {
+    free_glog (logitem);
+    return 0;
+  }
+  count_process (glog);
+
+  /* it's a pipe, then use the last parsed timestamp */
   if (!glog->inode && last > 0 && last >= ts)
     return 0;
 
@@ -2575,6 +3287,9 @@ cleanup:
 
   ht_insert_last_parse (0, ts);
 
+  if (!dry_run)
+    commit_log (glog);
+
   return ret;
 }
 
@@ -2671,7 +3386,11 @@ read_lines (FILE * fp, GLog ** glog, int dry_run) {
     if (dry_run && NUM_TESTS == cnt)
       goto out;
     free (line);
+    line = NULL;
     (*glog)->read++;
+    /* past the time window */
+    if ((*glog)->window_done)
+      break;
   }
 
   /* if no data was available to read from (probably from a pipe) and
@@ -2707,6 +3426,11 @@ read_lines (FILE * fp, GLog ** glog, int dry_run) {
     if (dry_run && NUM_TESTS == cnt)
       break;
     (*glog)->read++;
+    /* past the time window */
+    if ((*glog)->window_done) {
+      s = NULL;
+      break;
+    }
   }
 
   /* if no data was available to read from (probably from a pipe) and
@@ -2718,36 +3442,353 @@ read_lines (FILE * fp, GLog ** glog, int dry_run) {
 }
 #endif
 
+/* Iterate over the lines queued by the given reader thread.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+read_reader (GLog ** glog, GReader * reader, int dry_run) {
+  char *line = NULL;
+  int ret = 0, cnt = 0, test = conf.num_tests > 0 ? 1 : 0;
+
+  /* a non-blocking pipe is only read until drained, the rest is
+   * processed as it comes in, unless processing and exiting */
+  while ((line = greader_getline (reader, reader->wait ||
+                                  conf.process_and_exit)) != NULL) {
+    /* handle SIGINT */
+    if (conf.stop_processing)
+      return test || ret;
+    if ((ret = read_line ((*glog), line, &test, &cnt, dry_run)))
+      return test || ret;
+    if (dry_run && NUM_TESTS == cnt)
+      return test || ret;
+    (*glog)->read++;
+  }
+
+  return ret;
+}
+
+/* Iterate over the lines read from the pipe. The reader thread is
+ * started on first use as it would not survive daemonizing.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+read_pipe (GLog ** glog, int dry_run) {
+  if ((*glog)->reader == NULL)
+    (*glog)->reader = greader_new (fileno ((*glog)->pipe));
+
+  return read_reader (glog, (*glog)->reader, dry_run);
+}
+
+#ifdef HAVE_LIBZ
+/* Get the checkpoint key of a compressed log. Unlike live logs,
+ * archives are never appended to, so they are identified by their
+ * inode, size and modification time.
+ *
+ * On error, 0 is returned.
+ * On success, a non-zero key is returned. */
+static uint32_t
+gz_log_key (const char *fn) {
+  struct stat st;
+  uint64_t id[3];
+  uint32_t h = 2166136261U;
+  size_t i;
+
+  if (stat (fn, &st) != 0)
+    return 0;
+
+  id[0] = (uint64_t) st.st_ino;
+  id[1] = (uint64_t) st.st_size;
+  id[2] = (uint64_t) st.st_mtime;
+  for (i = 0; i < sizeof (id); ++i)
+    h = (h ^ ((const unsigned char *) id)[i]) * 16777619U;
+
+  return h ? h : 1;
+}
+
+/* Determine if the given compressed log was fully parsed already. */
+static int
+gz_log_done (uint32_t key) {
+  return key && (ht_get_gz_parse (key) & LAST_PARSE_DONE);
+}
+
+/* Start decompressing the gzip logs following the one at `idx`, up to
+ * one per available core, so they are ready by the time the parser
+ * gets to them. */
+static void
+gz_readahead (int idx) {
+  long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+  const char *fn = NULL;
+  int i;
+
+  if (gz_readers == NULL)
+    gz_readers = xcalloc (conf.filenames_idx, sizeof (GReader *));
+
+  for (i = idx; i < conf.filenames_idx && i < idx + ncpu - 1; ++i) {
+    fn = conf.filenames[i];
+    if (gz_readers[i] || (fn[0] == '-' && fn[1] == '\0'))
+      continue;
+    if (!is_gzip_log (fn) || gz_log_done (gz_log_key (fn)))
+      continue;
+    gz_readers[i] = greader_new_gz (fn);
+  }
+}
+
+/* Stop and free any reader started ahead of parsing. */
+static void
+free_gz_readers (void) {
+  int i;
+
+  if (gz_readers == NULL)
+    return;
+
+  for (i = 0; i < conf.filenames_idx; ++i)
+    greader_free (gz_readers[i]);
+  free (gz_readers);
+  gz_readers = NULL;
+}
+#endif
+
+/* Decompress and parse the gzip log at the given index. Once fully
+ * parsed, the log is checkpointed so it is not read again. Its lines
+ * are counted from its own start, so the checkpoint holds no more than
+ * the lines of the archive itself, which are still added up as if read
+ * when it is skipped, keeping the checkpoints of the logs that follow
+ * it in line.
+ *
+ * On error, 1 is returned.
+ * On success, 0 is returned. */
+static int
+read_gz_log (GLog ** glog, int idx, int dry_run) {
+#ifdef HAVE_LIBZ
+  GReader *reader = NULL;
+  uint32_t key = gz_log_key (conf.filenames[idx]);
+  uint32_t before = (*glog)->read;
+  int ret = 0;
+
+  if (gz_log_done (key)) {
+    (*glog)->read += ht_get_gz_parse (key) & ~LAST_PARSE_DONE;
+    return 0;
+  }
+
+  /* the dry run only reads a few lines of it */
+  if (!dry_run)
+    gz_readahead (idx + 1);
+  if (gz_readers && (reader = gz_readers[idx]))
+    gz_readers[idx] = NULL;
+  else
+    reader = greader_new_gz (conf.filenames[idx]);
+
+  (*glog)->inode = key;
+  (*glog)->gz = 1;
+  (*glog)->read = 0;
+  ret = read_reader (glog, reader, dry_run);
+  greader_free (reader);
+  (*glog)->gz = 0;
+
+  if (!dry_run && key)
+    ht_insert_gz_parse (key, (*glog)->read |
+                        (ret || conf.stop_processing ? 0 : LAST_PARSE_DONE));
+  (*glog)->read += before;
+
+  return ret;
+#else
+  (void) glog;
+  (void) dry_run;
+  FATAL ("Unable to read compressed log %s, zlib support is required.",
+         conf.filenames[idx]);
+#endif
+}
+
+/* Skip the rest of the current line.
+ *
+ * If EOF is reached, 1 is returned.
+ * On success, 0 is returned. */
+static int
+skip_line (FILE * fp) {
+  int c;
+
+  while ((c = getc (fp)) != EOF && c != '\n');
+
+  return c == EOF;
+}
+
+/* Count the lines from the start of the log up to the given byte
+ * offset, i.e., the lines skipped by seeking to it, so the log's
+ * checkpoint is still a line number. They are only scanned for line
+ * breaks, not parsed.
+ *
+ * The number of lines is returned. */
+static uint32_t
+count_lines (FILE * fp, off_t end) {
+  char buf[LINE_BUFFER];
+  uint32_t lines = 0;
+  size_t len = 0, i;
+
+  if (fseeko (fp, 0, SEEK_SET) == -1)
+    FATAL ("Unable to seek the log file. %s", strerror (errno));
+
+  while (end > 0) {
+    len = end < (off_t) sizeof (buf) ? (size_t) end : sizeof (buf);
+    if ((len = fread (buf, 1, len, fp)) == 0)
+      break;
+    for (i = 0; i < len; ++i)
+      lines += buf[i] == '\n';
+    end -= len;
+  }
+
+  return lines;
+}
+
+/* Get the timestamp of the first line that parses at or after the
+ * given byte offset. Unless at the start of the log, the partial line
+ * at the offset is skipped.
+ *
+ * On error or EOF, 1 is returned.
+ * On success, the timestamp is set and 0 is returned. */
+static int
+probe_time (GLog * glog, FILE * fp, off_t off, time_t * ts) {
+  GLogItem *logitem = NULL;
+  char *line = NULL;
+  int i, ret = 1;
+
+  if (fseeko (fp, off, SEEK_SET) == -1 || (off > 0 && skip_line (fp)))
+    return 1;
+
+  for (i = 0; i < WINDOW_PROBES && ret; ++i) {
+    if ((line = fgetline (fp)) == NULL)
+      break;
+
+    logitem = init_log_item (glog);
+    if (!valid_line (line) && parse_line (glog, &logitem, line) == 0) {
+      *ts = mktime (&logitem->dt);
+      ret = 0;
+    }
+    free_glog (logitem);
+    free (line);
+  }
+
+  return ret;
+}
+
+/* Determine if the log looks ordered by time, i.e., the lines at evenly
+ * spaced offsets, from the first to one of the last, are in order give
+ * or take WINDOW_SLACK. A log small enough to be read whole isn't
+ * worth telling.
+ *
+ * If it doesn't look ordered, 0 is returned.
+ * If it does, the first and last times probed are set and 1 is
+ * returned. */
+static int
+is_time_ordered (GLog * glog, FILE * fp, off_t size, time_t * first,
+                 time_t * last) {
+  time_t prev = 0, ts = 0;
+  off_t end = size - WINDOW_MIN_SPAN;
+  int i;
+
+  if (size <= 2 * WINDOW_MIN_SPAN)
+    return 0;
+
+  for (i = 0; i <= WINDOW_ORDER_PROBES; ++i) {
+    if (probe_time (glog, fp, end / WINDOW_ORDER_PROBES * i, &ts))
+      return 0;
+    if (i > 0 && ts < prev - WINDOW_SLACK)
+      return 0;
+    if (i == 0)
+      *first = ts;
+    prev = ts;
+  }
+  *last = ts;
+
+  return *last >= *first;
+}
+
+/* Position the log at the start of the --since time window. If the
+ * log looks ordered by time, its byte offsets are bisected, parsing
+ * only a line at each probe, and reading stops once well past the
+ * --until time window. Otherwise, it's read from start to end. The
+ * lines skipped are counted as read.
+ *
+ * The offset where reading starts is returned. */
+static off_t
+seek_time_window (GLog * glog, FILE * fp, off_t size) {
+  time_t first = 0, last = 0, ts = 0;
+  time_t since = conf.since - WINDOW_SLACK;
+  off_t lo = 0, hi = size, mid = 0;
+
+  if (!is_time_ordered (glog, fp, size, &first, &last))
+    goto out;
+
+  glog->time_ordered = 1;
+  if (!conf.since || first >= since)
+    goto out;
+
+  while (hi - lo > WINDOW_MIN_SPAN) {
+    mid = lo + (hi - lo) / 2;
+    if (probe_time (glog, fp, mid, &ts) || ts >= since) {
+      hi = mid;
+      continue;
+    }
+    /* out of order, it's not worth seeking */
+    if (ts < first - WINDOW_SLACK || ts > last + WINDOW_SLACK) {
+      glog->time_ordered = 0;
+      lo = 0;
+      break;
+    }
+    lo = mid;
+  }
+
+out:
+  if (lo > 0) {
+    glog->read += count_lines (fp, lo);
+    glog->read += !skip_line (fp);
+  } else if (fseeko (fp, 0, SEEK_SET) == -1)
+    FATAL ("Unable to seek the log file. %s", strerror (errno));
+
+  return lo;
+}
+
 /* Read the given log line by line and process its data.
  *
  * On error, 1 is returned.
  * On success, 0 is returned. */
 static int
-read_log (GLog ** glog, const char *fn, int dry_run) {
+read_log (GLog ** glog, int idx, int dry_run) {
+  const char *fn = conf.filenames[idx];
   FILE *fp = NULL;
-  int piping = 0;
   struct stat fdstat;
 
+  (*glog)->time_ordered = (*glog)->window_done = 0;
+
   /* Ensure we have a valid pipe to read from stdin. Only checking for
    * conf.read_stdin without verifying for a valid FILE pointer would certainly
    * lead to issues. */
   if (fn[0] == '-' && fn[1] == '\0' && (*glog)->pipe) {
-    fp = (*glog)->pipe;
-    (*glog)->piping = piping = 1;
+    (*glog)->piping = 1;
+    return read_pipe (glog, dry_run);
   }
 
-  /* make sure we can open the log (if not reading from stdin) */
-  if (!piping && (fp = fopen (fn, "r")) == NULL)
+  /* decompress gzip logs on their own thread */
+  if (is_gzip_log (fn))
+    return read_gz_log (glog, idx, dry_run);
+
+  /* make sure we can open the log */
+  if ((fp = fopen (fn, "r")) == NULL)
     FATAL ("Unable to open the specified log file. %s", strerror (errno));
 
   /* grab the inode of the file being parsed */
-  if (!piping && stat (fn, &fdstat) == 0)
+  if (stat (fn, &fdstat) == 0)
     (*glog)->inode = fdstat.st_ino;
 
+  /* skip ahead to the time window, unless resuming from a checkpoint */
+  if ((conf.since || conf.until) && !dry_run && (*glog)->inode &&
+      !ht_get_last_parse ((*glog)->inode))
+    seek_time_window (*glog, fp, fdstat.st_size);
+
   /* read line by line */
   if (read_lines (fp, glog, dry_run)) {
-    if (!piping)
-      fclose (fp);
+    fclose (fp);
     return 1;
   }
 
@@ -2755,9 +3796,7 @@ read_log (GLog ** glog, const char *fn, int dry_run) {
   if ((*glog)->inode)
     ht_insert_last_parse ((*glog)->inode, (*glog)->read);
 
-  /* close log file if not a pipe */
-  if (!piping)
-    fclose (fp);
+  fclose (fp);
 
   return 0;
 }
@@ -2782,6 +3821,9 @@ parse_log (GLog ** glog, char *tail, int dry_run) {
   /* verify that we have the required formats */
   if ((err_log = verify_formats ()))
     FATAL ("%s", err_log);
+  set_preset_format ();
+  if (set_json_log_format ())
+    FATAL ("%s", ERR_FORMAT_JSON_LOG_FMT);
 
   /* no data piped, no logs passed, load from disk only then */
   //if (conf.load_from_disk && !conf.filenames_idx && !conf.read_stdin) {
@@ -2790,13 +3832,16 @@ parse_log (GLog ** glog, char *tail, int dry_run) {
   //}
 
   for (i = 0; i < conf.filenames_idx; ++i) {
-    if (read_log (glog, conf.filenames[i], dry_run)) {
+    if (read_log (glog, i, dry_run)) {
       fprintf (stderr, "%s\n", conf.filenames[i]);
-      return 1;
+      break;
     }
   }
+#ifdef HAVE_LIBZ
+  free_gz_readers ();
+#endif
 
-  return 0;
+  return i < conf.filenames_idx;
 }
 
 /* Ensure we have valid hits
@@ -41,12 +41,20 @@
 #define REF_SITE_LEN    511     /* maximum length of a referring site */
 #define CACHE_STATUS_LEN 7
 
+#define LAST_PARSE_DONE 0x80000000U     /* compressed log fully parsed */
+
+#define WINDOW_SLACK      300   /* secs a time ordered log may be out of order */
+#define WINDOW_MIN_SPAN (64 * 1024)     /* stop bisecting below this many bytes */
+#define WINDOW_PROBES      16   /* lines to try to parse at each probe */
+#define WINDOW_ORDER_PROBES 16  /* offsets probed to tell a log is ordered */
+
 #define SPEC_TOKN_SET   0x1
 #define SPEC_TOKN_NUL   0x2
 #define SPEC_TOKN_INV   0x3
 #define SPEC_SFMT_MIS   0x4
 
 #include "commons.h"
+#include "greader.h"
 #include "gslist.h"
 
 /* Log properties. Note: This is per line parsed */
@@ -78,6 +86,7 @@ typedef struct GLogItem_ {
 
   uint64_t resp_size;
   uint64_t serve_time;
+  uint64_t uniq_hash;           /* of uniq_key, see --approx-visitors */
 
   int ignorelevel;
   int type_ip;
@@ -98,7 +107,10 @@ typedef struct GLog_ {
   unsigned short load_from_disk_only;
   unsigned short piping;
   uint32_t read;                /* lines read/parsed */
-  uint32_t inode;
+  uint32_t inode;               /* or key of a compressed log */
+  unsigned short gz;            /* compressed log, checkpointed apart */
+  unsigned short time_ordered;  /* log looks ordered by time */
+  unsigned short window_done;   /* read past the --until time window */
 
   GLogItem *items;
 
@@ -106,8 +118,24 @@ typedef struct GLog_ {
   char **errors;
 
   FILE *pipe;
+  GReader *reader;              /* reader thread for piped data */
 } GLog;
 
+/* A JSON key mapped to a log format fragment, e.g., "status":"%s" */
+typedef struct GJSONSpec_ {
+  char *key;
+  size_t klen;
+  char *fmt;
+} GJSONSpec;
+
+typedef struct GJSONSpecs_ {
+  GJSONSpec *items;             /* mapped keys */
+  int idx;                      /* num of mapped keys */
+  int size;                     /* allocated items */
+  char *buf;                    /* scratch copy of the current line */
+  size_t buf_size;              /* allocated scratch size */
+} GJSONSpecs;
+
 /* Raw Data extracted from table stores */
 typedef struct GRawDataItem_ {
   union {
@@ -158,6 +186,7 @@ typedef struct GParse_ {
   void (*bw) (uint32_t data_nkey, uint64_t size, GModule module);
   void (*cumts) (uint32_t data_nkey, uint64_t ts, GModule module);
   void (*maxts) (uint32_t data_nkey, uint64_t ts, GModule module);
+  void (*latency) (uint32_t data_nkey, uint64_t ts, GModule module);
   void (*method) (uint32_t data_nkey, const char *method, GModule module);
   void (*protocol) (uint32_t data_nkey, const char *proto, GModule module);
   void (*agent) (uint32_t data_nkey, uint32_t agent_nkey, GModule module);
@@ -170,6 +199,7 @@ GLogItem *init_log_item (GLog * glog);
 GRawDataItem *new_grawdata_item (unsigned int size);
 GRawData *new_grawdata (void);
 int parse_log (GLog ** glog, char *tail, int dry_run);
+void free_json_log_format (void);
 void free_logerrors (GLog * glog);
 void free_raw_data (GRawData * raw_data);
 void output_logerrors (GLog * glog);
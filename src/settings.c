@@ -741,6 +741,18 @@ set_time_format_str (const char *oarg) {
   conf.time_format = fmt;
 }
 
+/* Set the log format to a JSON object mapping the keys of a JSON
+ * access log to format specifiers, e.g.,
+ * {"remote_addr":"%h","status":"%s"} */
+void
+set_json_log_format_str (const char *oarg) {
+  if (conf.log_format)
+    free (conf.log_format);
+
+  conf.log_format = xstrdup (oarg);
+  conf.json_log_format = 1;
+}
+
 /* Attempt to set the log format given a command line option argument.
  * The supplied optarg can be either an actual format string or the
  * enumerated value such as VCOMBINED */
@@ -752,6 +764,7 @@ set_log_format_str (const char *oarg) {
   /* free log format if it was previously set */
   if (conf.log_format)
     free (conf.log_format);
+  conf.json_log_format = 0;
 
   /* type not found, use whatever was given by the user then */
   if (type == -1) {
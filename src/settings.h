@@ -41,6 +41,7 @@
 #define MAX_IGNORE_STATUS      64
 #define MAX_OUTFORMATS          3
 #define MAX_FILENAMES         512
+#define MAX_MERGE_DB           64
 #define NO_CONFIG_FILE "No config file used"
 
 typedef enum LOGTYPE {
@@ -98,9 +99,12 @@ typedef struct GConf_
   const char *ignore_panels[TOTAL_MODULES];     /* array of panels to ignore */
   const char *ignore_referers[MAX_IGNORE_REF];  /* referrers to ignore */
   const char *ignore_status[MAX_IGNORE_STATUS]; /* status to ignore */
+  const char *merge_dbs[MAX_MERGE_DB];          /* db-paths to merge */
   const char *output_formats[MAX_OUTFORMATS];   /* output format, e.g. , HTML */
   const char *sort_panels[TOTAL_MODULES];       /* sorting options for each panel */
   const char *static_files[MAX_EXTENSIONS];     /* static extensions */
+  uint32_t heavy_hitters[TOTAL_MODULES];        /* items kept per panel */
+  uint32_t max_keys[TOTAL_MODULES];             /* keys capped per panel */
 
   /* Log/date/time formats */
   char *date_format;                /* date format */
@@ -138,20 +142,28 @@ typedef struct GConf_
   int anonymize_ip;                 /* anonymize ip addresses */
   int append_method;                /* append method to the req key */
   int append_protocol;              /* append protocol to the req key */
+  int approx_visitors;              /* estimate unique visitors */
   int client_err_to_unique_count;   /* count 400s as visitors */
   int code444_as_404;               /* 444 as 404s? */
   int color_scheme;                 /* color scheme */
   int crawlers_only ;               /* crawlers only */
   int daemonize;                    /* run program as a Unix daemon */
+  int db_codec;                     /* codec of persisted tables */
+  int db_compression_level;         /* codec level, 0 is its default */
+  int dns_workers;                  /* resolver threads, 0 is default */
   const char *username;             /* user to run program as */
   int double_decode;                /* need to double decode */
   int enable_html_resolver;         /* html/json/csv resolver */
   int geo_db;                       /* legacy geoip db */
   int hl_header;                    /* highlight header on term */
+  int hll_precision;                /* sketch precision, 0 is default */
   int ignore_crawlers;              /* ignore crawlers */
   int ignore_qstr;                  /* ignore query string */
   int ignore_statics;               /* ignore static files */
+  int json_log_format;              /* log format is a JSON key map */
   int json_pretty_print;            /* pretty print JSON data */
+  int latency_percentiles;          /* histogram of times served */
+  int lazy_restore;                 /* restore panels on first use */
   int list_agents;                  /* show list of agents per host */
   int load_conf_dlg;                /* load curses config dialog */
   int load_global_config;           /* use global config file */
@@ -171,10 +183,16 @@ typedef struct GConf_
   int real_os;                      /* show real OSs */
   int real_time_html;               /* enable real-time HTML output */
   int restore;                      /* reload data from db-path */
+  int wal;                          /* write-ahead log of changes */
   int skip_term_resolver;           /* no terminal resolver */
   int store_accumulated_time;       /* store accumulated processing time in tcb */
+  time_t since;                     /* only parse entries from this time on */
+  time_t until;                     /* only parse entries before this time */
+  uint32_t dns_cache_ttl;           /* secs hostnames are kept across runs */
+  uint32_t dns_negative_ttl;        /* secs before retrying a timed out IP */
   uint32_t keep_last;               /* number of days to keep in storage */
   uint32_t num_tests;               /* number of lines to test */
+  uint32_t persist_interval;        /* background snapshot every N secs */
   uint64_t log_size;                /* log size override */
 
   /* Internal flags */
@@ -197,6 +215,7 @@ typedef struct GConf_
   int ignore_panel_idx;             /* ignored panels index */
   int ignore_referer_idx;           /* ignored referrers index */
   int ignore_status_idx;            /* ignore status index */
+  int merge_db_idx;                 /* db-paths to merge index */
   int output_format_idx;            /* output format index */
   int sort_panel_idx;               /* sort panel index */
   int static_file_idx;              /* static extensions index */
@@ -213,6 +232,7 @@ char *get_selected_time_str (size_t idx);
 const char *verify_formats (void);
 size_t get_selected_format_idx (void);
 void set_date_format_str (const char *optarg);
+void set_json_log_format_str (const char *optarg);
 void set_log_format_str (const char *optarg);
 void set_spec_date_format (void);
 void set_time_format_str (const char *optarg);
@@ -0,0 +1,149 @@
+/**
+ * strscan.c -- vectorized string scanning
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "strscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+  defined(__SSE2__)
+#define STRSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*GStrScan2) (const char *, int, int);
+
+static const char *strscan2_resolve (const char *s, int c1, int c2);
+
+/* Kernel used by strscan2(), picked on first use */
+static GStrScan2 strscan2_fn = strscan2_resolve;
+
+/* Scalar fallback, one byte at a time. */
+static const char *
+strscan2_scalar (const char *s, int c1, int c2) {
+  char a = (char) c1, b = (char) c2;
+
+  while (*s != '\0' && *s != a && *s != b)
+    s++;
+
+  return s;
+}
+
+#ifdef STRSCAN_X86
+/* Get the bit index of the lowest set bit of a non-zero mask. */
+static int
+first_bit (unsigned int mask) {
+  return __builtin_ctz (mask);
+}
+
+/* Scan 16 bytes at a time. Loads are aligned, so they never cross a
+ * page boundary and it's safe to read past the terminating NUL. */
+static const char *
+strscan2_sse2 (const char *s, int c1, int c2) {
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i v1 = _mm_set1_epi8 ((char) c1);
+  const __m128i v2 = _mm_set1_epi8 ((char) c2);
+  unsigned int off = (uintptr_t) s & 15, mask = 0;
+  const char *p = s - off;
+  __m128i chunk, hit;
+
+  for (;;) {
+    chunk = _mm_load_si128 ((const __m128i *) (const void *) p);
+    hit = _mm_or_si128 (_mm_cmpeq_epi8 (chunk, zero),
+                        _mm_or_si128 (_mm_cmpeq_epi8 (chunk, v1),
+                                      _mm_cmpeq_epi8 (chunk, v2)));
+    mask = (unsigned int) _mm_movemask_epi8 (hit);
+    /* ignore bytes before the start of the string */
+    mask = (mask >> off) << off;
+    if (mask)
+      return p + first_bit (mask);
+    p += 16;
+    off = 0;
+  }
+}
+
+/* Scan 32 bytes at a time, see strscan2_sse2(). */
+__attribute__((target ("avx2")))
+static const char *
+strscan2_avx2 (const char *s, int c1, int c2) {
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i v1 = _mm256_set1_epi8 ((char) c1);
+  const __m256i v2 = _mm256_set1_epi8 ((char) c2);
+  unsigned int off = (uintptr_t) s & 31, mask = 0;
+  const char *p = s - off;
+  __m256i chunk, hit;
+
+  for (;;) {
+    chunk = _mm256_load_si256 ((const __m256i *) (const void *) p);
+    hit = _mm256_or_si256 (_mm256_cmpeq_epi8 (chunk, zero),
+                           _mm256_or_si256 (_mm256_cmpeq_epi8 (chunk, v1),
+                                            _mm256_cmpeq_epi8 (chunk, v2)));
+    mask = (unsigned int) _mm256_movemask_epi8 (hit);
+    /* shifting a 32-bit mask by 32 is undefined, so clear it instead */
+    mask &= off ? ~0U << off : ~0U;
+    if (mask)
+      return p + first_bit (mask);
+    p += 32;
+    off = 0;
+  }
+}
+#endif
+
+/* Pick the fastest kernel supported by the running CPU. */
+static const char *
+strscan2_resolve (const char *s, int c1, int c2) {
+  GStrScan2 fn = strscan2_scalar;
+
+#ifdef STRSCAN_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    fn = strscan2_avx2;
+  else
+    fn = strscan2_sse2;
+#endif
+
+  strscan2_fn = fn;
+  return fn (s, c1, c2);
+}
+
+/* Locate the first occurrence of either `c1` or `c2` within the given
+ * string. Both may be NUL.
+ *
+ * If neither is found, a pointer to the terminating NUL is returned.
+ * On success, a pointer to the matched character is returned. */
+const char *
+strscan2 (const char *s, int c1, int c2) {
+  return strscan2_fn (s, c1, c2);
+}
@@ -978,6 +978,7 @@ ui_spinner (void *ptr_data) {
   char buf[SPIN_LBL];
   int i = 0;
   long long tdiff = 0, psec = 0;
+  unsigned int processed = 0;
   time_t begin;
 
   if (sp->curses)
@@ -998,8 +999,9 @@ ui_spinner (void *ptr_data) {
       snprintf (buf, sizeof buf, SPIN_FMT, sp->label);
     } else {
       tdiff = (long long) (time (NULL) - begin);
-      psec = tdiff >= 1 ? *(sp->processed) / tdiff : 0;
-      snprintf (buf, sizeof buf, SPIN_FMTM, sp->label, *(sp->processed), psec);
+      processed = __atomic_load_n (sp->processed, __ATOMIC_RELAXED);
+      psec = tdiff >= 1 ? processed / tdiff : 0;
+      snprintf (buf, sizeof buf, SPIN_FMTM, sp->label, processed, psec);
     }
     setlocale (LC_NUMERIC, "POSIX");
 
@@ -528,6 +528,48 @@ str_to_time (const char *str, const char *fmt, struct tm *tm) {
   return 0;
 }
 
+/* Convert a --since/--until time into a timestamp. The time is either
+ * a local date and time, YYYY-MM-DD [HH:MM[:SS]], or a number of
+ * seconds, minutes, hours or days ago, e.g., 2h.
+ *
+ * On error, -1 is returned.
+ * On success, the timestamp is returned. */
+time_t
+str_to_window (const char *str) {
+  const char *fmts[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+  time_t now = time (NULL);
+  struct tm tm;
+  char *sEnd = NULL;
+  long long n = 0;
+  size_t i;
+
+  errno = 0;
+  n = strtoll (str, &sEnd, 10);
+  if (str != sEnd && errno != ERANGE && n >= 0 && sEnd[0] != '\0' &&
+      sEnd[1] == '\0') {
+    switch (sEnd[0]) {
+    case 's':
+      return now - n;
+    case 'm':
+      return now - n * 60;
+    case 'h':
+      return now - n * 3600;
+    case 'd':
+      return now - n * 86400;
+    }
+  }
+
+  for (i = 0; i < ARRAY_SIZE (fmts); ++i) {
+    /* same as log timestamps, see init_log_item() */
+    tm = *localtime (&now);
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    if (str_to_time (str, fmts[i], &tm) == 0)
+      return mktime (&tm);
+  }
+
+  return -1;
+}
+
 /* Convert a date from one format to another and store inot the given buffer.
  *
  * On error, 1 is returned.
@@ -682,6 +724,25 @@ trim_str (char *str) {
   return rtrim (ltrim (str));
 }
 
+/* Write the file size in bytes in a human readable format into the
+ * given buffer of n bytes, if any.
+ *
+ * The length of the human readable size is returned. */
+static int
+fmt_filesize (char *size, size_t n, unsigned long long log_size) {
+  if (log_size >= (1ULL << 50))
+    return snprintf (size, n, "%.2f PiB", (double) (log_size) / PIB (1ULL));
+  else if (log_size >= (1ULL << 40))
+    return snprintf (size, n, "%.2f TiB", (double) (log_size) / TIB (1ULL));
+  else if (log_size >= (1ULL << 30))
+    return snprintf (size, n, "%.2f GiB", (double) (log_size) / GIB (1ULL));
+  else if (log_size >= (1ULL << 20))
+    return snprintf (size, n, "%.2f MiB", (double) (log_size) / MIB (1ULL));
+  else if (log_size >= (1ULL << 10))
+    return snprintf (size, n, "%.2f KiB", (double) (log_size) / KIB (1ULL));
+  return snprintf (size, n, "%.1f   B", (double) (log_size));
+}
+
 /* Convert the file size in bytes to a human readable format.
  *
  * On error, the original size of the string in bytes is returned.
@@ -689,22 +750,23 @@ trim_str (char *str) {
 char *
 filesize_str (unsigned long long log_size) {
   char *size = xmalloc (sizeof (char) * 12);
-  if (log_size >= (1ULL << 50))
-    snprintf (size, 12, "%.2f PiB", (double) (log_size) / PIB (1ULL));
-  else if (log_size >= (1ULL << 40))
-    snprintf (size, 12, "%.2f TiB", (double) (log_size) / TIB (1ULL));
-  else if (log_size >= (1ULL << 30))
-    snprintf (size, 12, "%.2f GiB", (double) (log_size) / GIB (1ULL));
-  else if (log_size >= (1ULL << 20))
-    snprintf (size, 12, "%.2f MiB", (double) (log_size) / MIB (1ULL));
-  else if (log_size >= (1ULL << 10))
-    snprintf (size, 12, "%.2f KiB", (double) (log_size) / KIB (1ULL));
-  else
-    snprintf (size, 12, "%.1f   B", (double) (log_size));
+  fmt_filesize (size, 12, log_size);
 
   return size;
 }
 
+/* Get the length of the string filesize_str() returns for the given
+ * size, without allocating it.
+ *
+ * The length of the human readable size is returned. */
+int
+filesize_len (unsigned long long log_size) {
+  int len = fmt_filesize (NULL, 0, log_size);
+
+  /* as truncated by filesize_str() */
+  return len > 11 ? 11 : len;
+}
+
 /* Convert microseconds to a human readable format.
  *
  * On error, a malloc'd string in microseconds is returned.
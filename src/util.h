@@ -78,6 +78,7 @@ const char *verify_status_code (char *str);
 const char *verify_status_code_type (const char *str);
 int convert_date (char *res, const char *data, const char *from, const char *to, int size);
 int count_matches (const char *s1, char c);
+int filesize_len (unsigned long long log_size);
 int find_output_type (char **filename, const char *ext, int alloc);
 int hide_referer (const char *ref);
 int ignore_referer (const char *ref);
@@ -86,6 +87,7 @@ int invalid_ipaddr (char *str, int *ipvx);
 int ip_in_range (const char *ip);
 int str_inarray (const char *s, const char *arr[], int size);
 int str_to_time (const char *str, const char *fmt, struct tm *tm);
+time_t str_to_window (const char *str);
 int valid_output_type (const char *filename);
 int ptr2int(char *ptr);
 off_t file_size (const char *filename);
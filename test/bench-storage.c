@@ -0,0 +1,153 @@
+/**
+ * bench-storage.c -- contention of the storage across concurrent writers
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Writers add keys through the ht_* entry points, either each to a
+ * panel of its own, as when merging a database, or all to the same
+ * panel, and the throughput is reported by number of writers. A single
+ * writer is run both as the parser does, without locks, and as a shared
+ * storage does, so the cost of the locks themselves shows up. Run it
+ * through `make bench`. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gkhash.h"
+
+#include "commons.h"
+#include "goaccess.h"
+#include "settings.h"
+#include "ui.h"
+#include "util.h"
+
+#define BENCH_KEYS    200000    /* keys added by each writer */
+#define BENCH_WRITERS 8 /* max writers */
+
+/* Globals the storage expects from goaccess.c */
+GConf conf;
+GSpinner *parsing_spinner;
+int active_gdns = 0;
+
+void
+read_client (GO_UNUSED void *ptr_data) {
+}
+
+typedef struct GBenchWriter_ {
+  pthread_t thread;
+  GModule module;
+  int id;
+} GBenchWriter;
+
+/* Add a key, along with its hits, visitors and bandwidth, as parsing a
+ * line does. */
+static void *
+bench_writer (void *ptr_data) {
+  GBenchWriter *writer = ptr_data;
+  char key[32];
+  uint32_t nkey;
+  int i;
+
+  for (i = 0; i < BENCH_KEYS; ++i) {
+    snprintf (key, sizeof (key), "%d|%d", writer->id, i);
+    if ((nkey = ht_insert_keymap (writer->module, key)) == 0)
+      continue;
+    ht_insert_hits (writer->module, nkey, 1);
+    ht_insert_visitor (writer->module, nkey, 1);
+    ht_insert_bw (writer->module, nkey, 512);
+    ht_inc_cnt_overall (CNT_PROCESSED, 1);
+  }
+
+  return NULL;
+}
+
+static double
+elapsed (const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Run the given number of writers over a fresh storage, each on its own
+ * panel unless `shared` is set, and report their throughput. */
+static void
+bench (int writers, int locked, int shared) {
+  GBenchWriter w[BENCH_WRITERS];
+  struct timespec start;
+  int i, npanels = 0;
+  size_t idx = 0;
+  double secs;
+
+  FOREACH_MODULE (idx, module_list)
+    npanels++;
+
+  init_storage ();
+  share_storage (locked ? BENCH_WRITERS : 1);
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (i = 0; i < writers; ++i) {
+    w[i].id = i;
+    w[i].module = module_list[shared ? 0 : i % npanels];
+    if (pthread_create (&w[i].thread, NULL, bench_writer, &w[i]) != 0) {
+      fprintf (stderr, "Unable to start writer %d\n", i);
+      exit (EXIT_FAILURE);
+    }
+  }
+  for (i = 0; i < writers; ++i)
+    pthread_join (w[i].thread, NULL);
+  secs = elapsed (&start);
+
+  share_storage (1);
+  free_storage ();
+
+  printf ("%7d  %-6s  %-8s  %12.0f\n", writers, locked ? "yes" : "no",
+          shared ? "shared" : "own", writers * BENCH_KEYS / secs);
+}
+
+int
+main (void) {
+  int writers;
+
+  init_modules ();
+
+  printf ("writers  locked  panel           keys/s\n");
+  bench (1, 0, 0);
+  for (writers = 1; writers <= BENCH_WRITERS; writers *= 2) {
+    bench (writers, 1, 0);
+    bench (writers, 1, 1);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+/**
+ * bench-strscan.c -- scalar against SIMD strscan2() kernels
+ *    ______      ___
+ *   / ____/___  /   | _____________  __________
+ *  / / __/ __ \/ /| |/ ___/ ___/ _ \/ ___/ ___/
+ * / /_/ / /_/ / ___ / /__/ /__/  __(__  |__  )
+ * \____/\____/_/  |_\___/\___/\___/____/____/
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2009-2020 Gerardo Orellana <hello @ goaccess.io>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The referrers and user agents of a COMBINED log are scanned as the
+ * parser does, for the end of a quoted field, an escape to decode and
+ * a line break, by each strscan2() kernel the CPU supports. The kernels
+ * are static, so strscan.c is built into the benchmark itself. Run it
+ * through `make bench`, or pass it another COMBINED log. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/strscan.c"
+
+#define BENCH_BYTES (256 * 1024 * 1024)    /* bytes scanned per run */
+#define BENCH_FIELDS 8192       /* max fields taken from the log */
+
+typedef struct GBenchKernel_ {
+  const char *name;
+  GStrScan2 fn;
+} GBenchKernel;
+
+typedef struct GBenchScan_ {
+  const char *name;
+  int c1;
+  int c2;
+} GBenchScan;
+
+static char *fields[BENCH_FIELDS];
+static size_t nfields = 0, nbytes = 0, rounds = 0;
+
+/* Keep the referrer and user agent, i.e., the last two quoted fields,
+ * of each line of the given log. */
+static void
+load_fields (const char *fn) {
+  char line[4096], *q[6], *p;
+  FILE *fp = NULL;
+  int n, i;
+
+  if ((fp = fopen (fn, "r")) == NULL) {
+    perror (fn);
+    exit (EXIT_FAILURE);
+  }
+
+  while (fgets (line, sizeof (line), fp) && nfields + 2 <= BENCH_FIELDS) {
+    for (n = 0, p = line; n < 6 && (p = strchr (p, '"')); ++n)
+      q[n] = p++;
+    if (n < 6)
+      continue;
+    for (i = 2; i < 6; i += 2) {
+      *q[i + 1] = '\0';
+      if ((fields[nfields] = strdup (q[i] + 1)) == NULL) {
+        perror ("strdup");
+        exit (EXIT_FAILURE);
+      }
+      nbytes += strlen (fields[nfields++]);
+    }
+  }
+  fclose (fp);
+
+  if (nfields == 0) {
+    fprintf (stderr, "No COMBINED lines in %s\n", fn);
+    exit (EXIT_FAILURE);
+  }
+}
+
+static double
+elapsed (const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Scan every field with the given kernel and report its throughput.
+ * The offsets found are added up, so they can be checked against the
+ * scalar kernel's.
+ *
+ * The sum of the offsets is returned. */
+static size_t
+bench (const GBenchKernel * kernel, const GBenchScan * scan) {
+  struct timespec start;
+  size_t i, r, sum = 0;
+  double secs;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (r = 0; r < rounds; ++r) {
+    for (i = 0; i < nfields; ++i)
+      sum += kernel->fn (fields[i], scan->c1, scan->c2) - fields[i];
+  }
+  secs = elapsed (&start);
+
+  printf ("%-6s  %-10s  %10.1f  %10.0f\n", kernel->name, scan->name,
+          secs * 1e9 / rounds / nfields,
+          (double) nbytes * rounds / secs / (1024 * 1024));
+
+  return sum / rounds;
+}
+
+int
+main (int argc, char **argv) {
+  GBenchKernel kernels[3] = { {"scalar", strscan2_scalar} };
+  GBenchScan scans[] = {
+    {"quote", '"', '\\'},
+    {"escape", '%', '%'},
+    {"newline", '\r', '\n'},
+  };
+  size_t i, want, got;
+  int k, nkernels = 1, rc = EXIT_SUCCESS;
+
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s <combined log>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  load_fields (argv[1]);
+  rounds = BENCH_BYTES / (nbytes + 1) + 1;
+
+#ifdef STRSCAN_X86
+  kernels[nkernels++] = (GBenchKernel) {"sse2", strscan2_sse2};
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    kernels[nkernels++] = (GBenchKernel) {"avx2", strscan2_avx2};
+#endif
+
+  printf ("%zu fields, %.1f bytes on average\n", nfields,
+          (double) nbytes / nfields);
+  printf ("kernel  scan          ns/field        MB/s\n");
+  for (i = 0; i < sizeof (scans) / sizeof (scans[0]); ++i) {
+    want = bench (&kernels[0], &scans[i]);
+    for (k = 1; k < nkernels; ++k) {
+      if ((got = bench (&kernels[k], &scans[i])) == want)
+        continue;
+      fprintf (stderr, "%s %s: offsets add up to %zu, expected %zu\n",
+               kernels[k].name, scans[i].name, got, want);
+      rc = EXIT_FAILURE;
+    }
+  }
+
+  for (i = 0; i < nfields; ++i)
+    free (fields[i]);
+
+  return rc;
+}
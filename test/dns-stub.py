@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# Stub DNS server for test/dns.sh. It answers the reverse lookups of
+# 10.9.0.N on 127.0.0.1:53, by the last digit of N: 0 is a name that
+# doesn't exist, 1 never answers, i.e., times out, and anything else
+# resolves to h-10-9-0-N.example after a short delay, so that lookups
+# overlap when several are in flight. Other queries get no records.
+
+import socket
+import struct
+import sys
+import threading
+import time
+
+DELAY = 0.2
+
+
+def handle(sock, data, addr):
+    labels, o = [], 12
+    while data[o]:
+        labels.append(data[o + 1:o + 1 + data[o]].decode())
+        o += data[o] + 1
+    qend = o + 5
+    qtype = struct.unpack(">H", data[o + 1:o + 3])[0]
+    last = int(labels[0]) if labels and labels[0].isdigit() else 0
+
+    hdr = bytearray(data[:12])
+    hdr[2] = 0x81
+    hdr[3] = 0x80
+    hdr[6:12] = b"\0\0\0\0\0\0"
+    if qtype != 12:
+        sock.sendto(bytes(hdr) + data[12:qend], addr)
+        return
+    if last % 10 == 1:
+        return
+
+    time.sleep(DELAY)
+    if last % 10 == 0:
+        hdr[3] = 0x83
+        sock.sendto(bytes(hdr) + data[12:qend], addr)
+        return
+
+    name = "h-" + "-".join(labels[:4][::-1])
+    rdata = b"".join(bytes([len(x)]) + x.encode()
+                     for x in (name, "example")) + b"\0"
+    ans = b"\xc0\x0c" + struct.pack(">HHIH", 12, 1, 60, len(rdata)) + rdata
+    hdr[6:8] = b"\0\1"
+    sock.sendto(bytes(hdr) + data[12:qend] + ans, addr)
+
+
+def main():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", 53))
+    # tell the caller it can start querying
+    open(sys.argv[1], "w").close()
+    while True:
+        data, addr = sock.recvfrom(4096)
+        threading.Thread(target=handle, args=(sock, data, addr),
+                         daemon=True).start()
+
+
+main()
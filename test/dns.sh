@@ -0,0 +1,80 @@
+#!/bin/sh
+# Check the pool of DNS workers against a stub DNS server, see
+# test/dns-stub.py: every IP of the log is resolved, while lookups that
+# fail show the error, those that time out are left unresolved, and the
+# lookups overlap. The stub listens on 127.0.0.1:53, so the test runs in
+# user, network and mount namespaces of its own, where /etc/resolv.conf
+# points at it. It is skipped where these, or python3, are not
+# available.
+
+GOACCESS=${GOACCESS:-./goaccess}
+srcdir=${srcdir:-.}
+tmp=${TMPDIR:-/tmp}/goaccess-dns.$$
+nips=60
+
+if [ -z "$GOACCESS_DNS_NS" ]; then
+  if ! command -v python3 >/dev/null || ! command -v ip >/dev/null ||
+    ! unshare -rmn true 2>/dev/null; then
+    echo "SKIP: needs python3, ip and unprivileged unshare -rmn"
+    exit 77
+  fi
+  GOACCESS_DNS_NS=1 exec unshare -rmn sh "$0" "$@"
+fi
+
+trap 'kill $stub 2>/dev/null; rm -f "$tmp".*' EXIT
+
+ip link set lo up || exit 1
+echo "nameserver 127.0.0.1" >"$tmp.resolv"
+mount --bind "$tmp.resolv" /etc/resolv.conf || exit 1
+
+python3 "$srcdir/test/dns-stub.py" "$tmp.ready" &
+stub=$!
+i=0
+while [ ! -e "$tmp.ready" ] && [ $i -lt 50 ]; do
+  sleep 0.1
+  i=$((i + 1))
+done
+[ -e "$tmp.ready" ] || { echo "FAIL: stub DNS server did not start"; exit 1; }
+
+i=1
+while [ $i -le $nips ]; do
+  echo "10.9.0.$i - - [01/Mar/2020:00:00:00 +0000] \"GET / HTTP/1.1\" 200 1 \"-\" \"A\""
+  i=$((i + 1))
+done >"$tmp.log"
+
+start=$(date +%s)
+RES_OPTIONS="timeout:1 attempts:1" "$GOACCESS" "$tmp.log" --no-global-config \
+  --log-format=COMBINED --with-output-resolver -o json >"$tmp.json" 2>/dev/null
+secs=$(($(date +%s) - start))
+
+# a single lookup at a time takes at least the stub's delay for each
+python3 - "$tmp.json" $nips $secs <<'EOF'
+import json
+import sys
+
+hosts = json.load(open(sys.argv[1]))["hosts"]["data"]
+nips, secs, rc = int(sys.argv[2]), int(sys.argv[3]), 0
+names = {h["data"]: h.get("hostname") for h in hosts}
+
+if len(names) != nips:
+    print("FAIL: %d hosts, expected %d" % (len(names), nips))
+    sys.exit(1)
+for ip, name in sorted(names.items()):
+    n = int(ip.split(".")[-1])
+    if n % 10 == 0:
+        # the resolver's error is shown, its wording is up to the libc
+        ok = name is not None and not name.endswith(".example")
+        want = "an error"
+    else:
+        want = None if n % 10 == 1 else "h-10-9-0-%d.example" % n
+        ok = name == want
+    if not ok:
+        print("FAIL: %s resolved to %s, expected %s" % (ip, name, want))
+        rc = 1
+if secs >= nips * 0.2:
+    print("FAIL: took %ds, lookups did not overlap" % secs)
+    rc = 1
+if rc == 0:
+    print("PASS: %d hosts resolved in %ds" % (nips, secs))
+sys.exit(rc)
+EOF
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Check that the preset log formats (COMBINED, VCOMBINED, COMMON and
+# VCOMMON) give the same report through parse_preset() as through the
+# generic parse_format(). The date format %d/%h/%Y reads dates as
+# %d/%b/%Y does, but isn't one parse_preset() takes, so it forces the
+# generic parser over the same logs.
+
+GOACCESS=${GOACCESS:-./goaccess}
+dir=${srcdir:-.}/test/presets
+tmp=${TMPDIR:-/tmp}/goaccess-presets.$$
+rc=0
+
+trap 'rm -f "$tmp".*' EXIT
+
+# run a log through goaccess, dropping what changes from run to run
+report () {
+  "$GOACCESS" "$@" --no-global-config --time-format=%T -o json \
+    --json-pretty-print 2>/dev/null |
+    grep -v '"generated\|"start_date\|"end_date\|"generation_time\|date_time'
+}
+
+for fmt in COMBINED VCOMBINED COMMON VCOMMON; do
+  log=$dir/$(echo $fmt | tr 'A-Z' 'a-z').log
+  for opts in "" "--no-ip-validation" "--double-decode"; do
+    report "$log" --log-format=$fmt --date-format=%d/%b/%Y $opts >"$tmp.preset"
+    report "$log" --log-format=$fmt --date-format=%d/%h/%Y $opts >"$tmp.generic"
+    if [ ! -s "$tmp.preset" ]; then
+      echo "FAIL: $fmt $opts: no report"
+      rc=1
+    elif ! cmp -s "$tmp.preset" "$tmp.generic"; then
+      echo "FAIL: $fmt $opts: reports differ"
+      diff "$tmp.generic" "$tmp.preset" | head -20
+      rc=1
+    else
+      echo "PASS: $fmt $opts"
+    fi
+  done
+done
+
+exit $rc
@@ -0,0 +1,67 @@
+#!/bin/sh
+# Check that a report persisted to disk and restored on the next run
+# counts every line once: the lines appended to a log since are added,
+# while those already counted, including the ones of a compressed log
+# read in full before it, or those skipped by seeking to the --since
+# time window of a log ordered by time, are not counted again.
+
+GOACCESS=${GOACCESS:-./goaccess}
+tmp=${TMPDIR:-/tmp}/goaccess-restore.$$
+rc=0
+
+trap 'rm -rf "$tmp" "$tmp".*' EXIT
+
+# write the given number of lines, starting at the given one, the given
+# number of lines a day from 01/Mar/2020 on, all of them that day if 0
+lines () {
+  awk -v n=$1 -v start=$2 -v per=${3:-0} 'BEGIN {
+    for (i = start; i < start + n; ++i)
+      printf "10.0.%d.%d - - [%02d/Mar/2020:00:00:00 +0000] " \
+        "\"GET /p%d HTTP/1.1\" 200 1 \"-\" \"A\"\n",
+        i / 250, i % 250, per ? 1 + int(i / per) : 8, i
+  }'
+}
+
+# run goaccess over the logs, storing into $tmp, and print the requests
+requests () {
+  "$GOACCESS" --no-global-config --log-format=COMBINED --persist \
+    --db-path="$tmp/" -o json "$@" 2>/dev/null |
+    sed -n 's/.*"total_requests": *\([0-9]*\).*/\1/p'
+}
+
+check () {
+  if [ "$2" != "$3" ]; then
+    echo "FAIL: $1: $2 requests, expected $3"
+    rc=1
+  else
+    echo "PASS: $1"
+  fi
+}
+
+mkdir "$tmp" || exit 1
+lines 1000 0 | gzip >"$tmp.a.log.gz"
+lines 500 1000 >"$tmp.access.log"
+
+got=$(requests "$tmp.a.log.gz" "$tmp.access.log")
+if [ -z "$got" ]; then
+  echo "SKIP: no report, zlib support is required"
+  exit 77
+fi
+check "gzip and plain log" "$got" 1500
+
+lines 300 1500 >>"$tmp.access.log"
+check "restored, lines appended" \
+  "$(requests --restore "$tmp.a.log.gz" "$tmp.access.log")" 1800
+check "restored, nothing appended" \
+  "$(requests --restore "$tmp.a.log.gz" "$tmp.access.log")" 1800
+
+# 8000 lines over 20 days, 3600 of them within the time window
+lines 8000 0 400 >"$tmp.since.log"
+check "time window" "$(requests --since=2020-03-12 "$tmp.since.log")" 3600
+lines 200 8000 400 >>"$tmp.since.log"
+check "time window restored, lines appended" \
+  "$(requests --restore --since=2020-03-12 "$tmp.since.log")" 3800
+check "time window restored, nothing appended" \
+  "$(requests --restore --since=2020-03-12 "$tmp.since.log")" 3800
+
+exit $rc